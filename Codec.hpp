@@ -0,0 +1,172 @@
+#ifndef _CODEC_HPP_
+#define _CODEC_HPP_
+
+#include "Server.hpp"
+#include <string_view>
+#include <cstring>
+
+// 默认的单帧上限（不含头部），超出时调用错误回调
+#define CODEC_MAX_FRAME (16 * 1024 * 1024)
+
+// 解出的一帧，头部和帧体都是指向输入缓冲区的视图，只在帧回调中有效
+struct CodecFrame
+{
+    std::string_view Header;
+    std::string_view Body;
+};
+
+// 长度字段分帧的编解码器：头部由 offset 字节的前缀（如魔数、类型）和 width 字节的长度字段组成，随后是帧体
+// 帧体长度 = 长度字段的值 + adjustment（长度字段包含头部时 adjustment 为负的头部长度）
+// 作为 TCPServer/Connection 的消息回调使用，一次读到的所有完整帧收集成一批，一起从缓冲区中取走后交给帧回调
+// 复制出的对象共享同一份配置和回调，可以在多个线程的连接上同时使用
+class LengthFieldCodec
+{
+public:
+    using FrameCallback = std::function<void(const PtrConnection&, const CodecFrame*, size_t)>;
+    // 帧体长度超出上限或为负时调用，参数为解出的长度，出错的数据仍在缓冲区中，回调中应关闭连接
+    // 未设置时丢弃输入并关闭连接
+    using ErrorCallback = std::function<void(const PtrConnection&, int64_t)>;
+
+private:
+    struct Options
+    {
+        size_t Width;
+        bool BigEndian;
+        size_t Offset;
+        int64_t Adjustment;
+        uint64_t MaxFrame;
+        FrameCallback Frame;
+        ErrorCallback Error;
+    };
+    std::shared_ptr<Options> _Options;
+
+private:
+    uint64_t ReadLength(const char* header) const{
+        const uint8_t* p = (const uint8_t*)header + _Options->Offset;
+        uint64_t length = 0;
+        for(size_t i = 0; i < _Options->Width; ++i){
+            size_t index = _Options->BigEndian ? i : _Options->Width - 1 - i;
+            length = length << 8 | p[index];
+        }
+        return length;
+    }
+
+    void WriteLength(char* header, uint64_t length) const{
+        uint8_t* p = (uint8_t*)header + _Options->Offset;
+        for(size_t i = 0; i < _Options->Width; ++i){
+            size_t index = _Options->BigEndian ? _Options->Width - 1 - i : i;
+            p[index] = (uint8_t)length;
+            length >>= 8;
+        }
+    }
+
+    void Fail(const PtrConnection& conn, Buffer* buffer, int64_t length) const{
+        if(_Options->Error){
+            return _Options->Error(conn, length);
+        }
+        buffer->UpdateReadIndex(buffer->GetReadableSize());
+        conn->Shutdown();
+    }
+
+public:
+    // 编码时写入帧体前保存的位置，EndFrame 据此回填长度字段
+    struct FrameMark
+    {
+        size_t Start;
+    };
+
+    // width 为长度字段的字节数（1、2、4 或 8）
+    LengthFieldCodec(size_t width = 4, bool bigEndian = true, size_t offset = 0, int64_t adjustment = 0,
+                     uint64_t maxFrame = CODEC_MAX_FRAME):
+        _Options(std::make_shared<Options>())
+    {
+        assert(width == 1 || width == 2 || width == 4 || width == 8);
+        _Options->Width = width;
+        _Options->BigEndian = bigEndian;
+        _Options->Offset = offset;
+        _Options->Adjustment = adjustment;
+        _Options->MaxFrame = maxFrame;
+    }
+
+    void SetFrameCallback(const FrameCallback& cb) { _Options->Frame = cb; }
+    void SetErrorCallback(const ErrorCallback& cb) { _Options->Error = cb; }
+
+    size_t HeaderSize() const { return _Options->Offset + _Options->Width; }
+
+    // 消息回调：解出缓冲区中所有完整的帧，一次交给帧回调
+    // 回调中可以发送和关闭连接，但不能读写输入缓冲区；剩余的不完整帧留到下次数据到达
+    void operator()(const PtrConnection& conn, Buffer* buffer) const{
+        // 批次数组按线程复用；回调中关闭连接会重新进入本函数，先换出来，重入时用另一个数组
+        thread_local std::vector<CodecFrame> cached;
+        std::vector<CodecFrame> frames;
+        frames.swap(cached);
+        frames.clear();
+        size_t headerSize = HeaderSize();
+        const char* data = buffer->GetReadIndex();
+        size_t size = buffer->GetReadableSize();
+        size_t pos = 0;
+        int64_t error = 0;
+        bool failed = false;
+        while(size - pos >= headerSize){
+            int64_t length = (int64_t)ReadLength(data + pos) + _Options->Adjustment;
+            if(length < 0 || (uint64_t)length > _Options->MaxFrame){
+                error = length;
+                failed = true;
+                break;
+            }
+            if(size - pos - headerSize < (uint64_t)length){
+                break;
+            }
+            frames.push_back(CodecFrame{std::string_view(data + pos, headerSize),
+                                        std::string_view(data + pos + headerSize, length)});
+            pos += headerSize + length;
+        }
+        if(!frames.empty()){
+            // 先取走再回调：回调中关闭连接会重新进入消息回调，不能再次交出同样的帧
+            // 取走只移动读位置，回调期间不会有新数据写入缓冲区，视图仍然有效
+            buffer->UpdateReadIndex(pos);
+            if(_Options->Frame){
+                _Options->Frame(conn, frames.data(), frames.size());
+            }
+        }
+        frames.swap(cached);
+        if(failed){
+            Fail(conn, buffer, error);
+        }
+    }
+
+    // 开始编码一帧：在输出缓冲区中写入前缀并预留长度字段，帧体随后直接写入同一缓冲区
+    // prefix 为长度字段之前的字节，不足 offset 时补 0；Begin 和 End 之间不能调用 CommitOutput
+    FrameMark BeginFrame(Buffer* output, std::string_view prefix = std::string_view()) const{
+        FrameMark mark{output->GetReadableSize()};
+        char header[64] = {0};
+        size_t headerSize = HeaderSize();
+        assert(headerSize <= sizeof(header));
+        if(!prefix.empty()){
+            memcpy(header, prefix.data(), std::min(prefix.size(), _Options->Offset));
+        }
+        output->WritePush(header, headerSize);
+        return mark;
+    }
+
+    // 结束编码：按写入的帧体长度回填长度字段
+    // 偏移相对读位置保存，期间缓冲区扩容或搬移数据都不影响
+    void EndFrame(Buffer* output, const FrameMark& mark) const{
+        size_t headerSize = HeaderSize();
+        int64_t body = (int64_t)(output->GetReadableSize() - mark.Start - headerSize);
+        uint64_t length = (uint64_t)(body - _Options->Adjustment);
+        assert(_Options->Width == 8 || length >> (_Options->Width * 8) == 0);
+        WriteLength(output->GetReadIndex() + mark.Start, length);
+    }
+
+    // 编码一帧并安排发送，只能在连接所属线程中调用
+    void Send(const PtrConnection& conn, std::string_view body, std::string_view prefix = std::string_view()) const{
+        Buffer* output = conn->GetOutputBuffer();
+        FrameMark mark = BeginFrame(output, prefix);
+        output->WritePush(body.data(), body.size());
+        EndFrame(output, mark);
+        conn->CommitOutput();
+    }
+};
+
+#endif // _CODEC_HPP_
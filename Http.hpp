@@ -0,0 +1,1451 @@
+#ifndef _HTTP_HPP_
+#define _HTTP_HPP_
+
+#include "Server.hpp"
+#include <string_view>
+#include <cstring>
+#include <ctime>
+#include <sys/stat.h>
+
+// 请求各部分的默认大小限制，超出时分别返回 414/431/431/413
+#define HTTP_MAX_REQUEST_LINE 8192
+#define HTTP_MAX_HEADER_SIZE (64 * 1024)
+#define HTTP_MAX_HEADERS 100
+#define HTTP_MAX_BODY_SIZE (8 * 1024 * 1024)
+
+inline char HttpToLower(char c){
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// 不区分大小写比较，用于头部名称和取值
+inline bool HttpEqualNoCase(std::string_view a, std::string_view b){
+    if(a.size() != b.size()){
+        return false;
+    }
+    for(size_t i = 0; i < a.size(); ++i){
+        if(HttpToLower(a[i]) != HttpToLower(b[i])){
+            return false;
+        }
+    }
+    return true;
+}
+
+// 在逗号分隔的取值中查找 token，如 Connection: keep-alive, Upgrade
+inline bool HttpHasToken(std::string_view value, std::string_view token){
+    while(!value.empty()){
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        while(!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+        while(!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+        if(HttpEqualNoCase(item, token)){
+            return true;
+        }
+        if(comma == std::string_view::npos){
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+inline int HttpHexValue(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// URL 解码，解析结果中的路径和查询参数都是原始数据，需要时再解码
+// plusAsSpace 为 true 时把 '+' 解码为空格（查询参数）
+inline std::string HttpUrlDecode(std::string_view str, bool plusAsSpace = false){
+    std::string result;
+    result.reserve(str.size());
+    for(size_t i = 0; i < str.size(); ++i){
+        if(str[i] == '%' && i + 2 < str.size() && HttpHexValue(str[i + 1]) >= 0 && HttpHexValue(str[i + 2]) >= 0){
+            result.push_back((char)(HttpHexValue(str[i + 1]) * 16 + HttpHexValue(str[i + 2])));
+            i += 2;
+        }
+        else if(str[i] == '+' && plusAsSpace){
+            result.push_back(' ');
+        }
+        else{
+            result.push_back(str[i]);
+        }
+    }
+    return result;
+}
+
+// 依次对查询字符串中的每个参数调用 cb(key, value)，参数未解码
+template<class Callback>
+void HttpForEachParam(std::string_view query, Callback cb){
+    while(!query.empty()){
+        size_t amp = query.find('&');
+        std::string_view item = query.substr(0, amp);
+        if(!item.empty()){
+            size_t eq = item.find('=');
+            if(eq == std::string_view::npos){
+                cb(item, std::string_view());
+            }
+            else{
+                cb(item.substr(0, eq), item.substr(eq + 1));
+            }
+        }
+        if(amp == std::string_view::npos){
+            break;
+        }
+        query.remove_prefix(amp + 1);
+    }
+}
+
+
+// 请求中的一段，记录相对请求起始位置的偏移
+// 缓冲区扩容或搬移数据后偏移仍然有效
+struct HttpSlice
+{
+    uint32_t Offset;
+    uint32_t Length;
+};
+
+// 解析出的请求，各字段都是指向输入缓冲区的视图，不拷贝数据
+// 只在请求从缓冲区中取走（HttpParser::Consume）且缓冲区被修改之前有效
+class HttpRequest
+{
+    friend class HttpParser;
+private:
+    const char* _Base;
+    HttpSlice _Method;
+    HttpSlice _Target;  // 完整的请求目标，路径加查询字符串
+    HttpSlice _Path;
+    HttpSlice _Query;
+    HttpSlice _Version;
+    HttpSlice _Body;
+    std::vector<std::pair<HttpSlice, HttpSlice>> _Headers;
+    uint64_t _ContentLength;
+    size_t _HeaderSize;  // 请求行和头部（含空行）的长度
+    int _Minor;          // HTTP/1.x 的次版本号
+    bool _KeepAlive;
+
+private:
+    std::string_view View(const HttpSlice& slice) const{
+        return std::string_view(_Base + slice.Offset, slice.Length);
+    }
+
+    void Reset(){
+        _Base = nullptr;
+        _Method = _Target = _Path = _Query = _Version = _Body = HttpSlice{0, 0};
+        _Headers.clear();
+        _ContentLength = 0;
+        _HeaderSize = 0;
+        _Minor = 1;
+        _KeepAlive = true;
+    }
+
+public:
+    HttpRequest(){
+        _Headers.reserve(16);
+        Reset();
+    }
+
+    std::string_view Method() const  { return View(_Method); }
+    std::string_view Target() const  { return View(_Target); }
+    std::string_view Path() const    { return View(_Path); }
+    std::string_view Query() const   { return View(_Query); }
+    std::string_view Version() const { return View(_Version); }
+    std::string_view Body() const    { return View(_Body); }
+    int MinorVersion() const         { return _Minor; }
+    // HTTP/1.1 默认保持连接，HTTP/1.0 默认关闭，Connection 头部可以改变默认行为
+    bool KeepAlive() const           { return _KeepAlive; }
+    uint64_t ContentLength() const   { return _ContentLength; }
+    // 整个请求在缓冲区中占用的字节数
+    size_t Size() const              { return _HeaderSize + _ContentLength; }
+
+    size_t HeaderCount() const { return _Headers.size(); }
+    std::string_view HeaderName(size_t index) const  { return View(_Headers[index].first); }
+    std::string_view HeaderValue(size_t index) const { return View(_Headers[index].second); }
+
+    // 名称不区分大小写，不存在时返回空视图；同名头部返回第一个
+    std::string_view GetHeader(std::string_view name) const{
+        for(auto& header : _Headers){
+            if(HttpEqualNoCase(View(header.first), name)){
+                return View(header.second);
+            }
+        }
+        return std::string_view();
+    }
+    bool HasHeader(std::string_view name) const{
+        for(auto& header : _Headers){
+            if(HttpEqualNoCase(View(header.first), name)){
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+
+// HTTP/1.1 请求解析器，直接在连接的输入缓冲区上增量解析
+// 每次收到数据后调用 Parse，数据不完整时记住扫描位置，下次从断点继续，不会重复扫描
+// 请求完整后通过 GetRequest 访问，处理完调用 Consume 从缓冲区中取走，再解析流水线中的下一个请求
+// 只支持 Content-Length 请求体，带 Transfer-Encoding 的请求返回 501
+class HttpParser
+{
+public:
+    enum Status { HTTP_INCOMPLETE, HTTP_COMPLETE, HTTP_ERROR };
+
+private:
+    enum State { PARSE_LINE, PARSE_HEADERS, PARSE_BODY, PARSE_DONE, PARSE_ERROR };
+
+    State _State;
+    size_t _LineStart;  // 当前行的起始位置（相对请求起始）
+    size_t _Scanned;    // 当前行已经扫描过、确认没有换行符的位置
+    int _Error;         // 出错时对应的响应状态码
+    size_t _MaxRequestLine;
+    size_t _MaxHeaderSize;
+    size_t _MaxHeaders;
+    uint64_t _MaxBodySize;
+    bool _HasContentLength;
+    HttpRequest _Request;
+
+private:
+    Status Fail(int code){
+        _State = PARSE_ERROR;
+        _Error = code;
+        return HTTP_ERROR;
+    }
+
+    static bool IsTokenChar(char c){
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+            || (c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != nullptr);
+    }
+
+    // 请求行：方法 SP 请求目标 SP 版本
+    Status ParseRequestLine(const char* base, size_t start, size_t end){
+        const char* line = base + start;
+        size_t len = end - start;
+        const char* sp1 = (const char*)memchr(line, ' ', len);
+        if(sp1 == nullptr || sp1 == line){
+            return Fail(400);
+        }
+        for(const char* p = line; p < sp1; ++p){
+            if(!IsTokenChar(*p)){
+                return Fail(400);
+            }
+        }
+        const char* target = sp1 + 1;
+        const char* sp2 = (const char*)memchr(target, ' ', line + len - target);
+        if(sp2 == nullptr || sp2 == target){
+            return Fail(400);
+        }
+        std::string_view version(sp2 + 1, line + len - sp2 - 1);
+        if(version.size() != 8 || version.compare(0, 7, "HTTP/1.") != 0
+           || (version[7] != '0' && version[7] != '1')){
+            return Fail(version.compare(0, 5, "HTTP/") == 0 ? 505 : 400);
+        }
+        _Request._Method = HttpSlice{(uint32_t)start, (uint32_t)(sp1 - line)};
+        _Request._Target = HttpSlice{(uint32_t)(target - base), (uint32_t)(sp2 - target)};
+        const char* question = (const char*)memchr(target, '?', sp2 - target);
+        const char* pathEnd = question ? question : sp2;
+        _Request._Path = HttpSlice{(uint32_t)(target - base), (uint32_t)(pathEnd - target)};
+        if(question){
+            _Request._Query = HttpSlice{(uint32_t)(question + 1 - base), (uint32_t)(sp2 - question - 1)};
+        }
+        _Request._Version = HttpSlice{(uint32_t)(sp2 + 1 - base), (uint32_t)version.size()};
+        _Request._Minor = version[7] - '0';
+        _Request._KeepAlive = _Request._Minor == 1;
+        return HTTP_INCOMPLETE;
+    }
+
+    // 头部行：名称 ":" OWS 取值 OWS
+    Status ParseHeaderLine(const char* base, size_t start, size_t end){
+        const char* line = base + start;
+        size_t len = end - start;
+        // 不支持已废弃的折行
+        if(line[0] == ' ' || line[0] == '\t'){
+            return Fail(400);
+        }
+        const char* colon = (const char*)memchr(line, ':', len);
+        if(colon == nullptr || colon == line){
+            return Fail(400);
+        }
+        for(const char* p = line; p < colon; ++p){
+            if(!IsTokenChar(*p)){
+                return Fail(400);
+            }
+        }
+        if(_Request._Headers.size() >= _MaxHeaders){
+            return Fail(431);
+        }
+        const char* value = colon + 1;
+        const char* valueEnd = line + len;
+        while(value < valueEnd && (*value == ' ' || *value == '\t')) ++value;
+        while(valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) --valueEnd;
+        _Request._Headers.emplace_back(HttpSlice{(uint32_t)start, (uint32_t)(colon - line)},
+                                       HttpSlice{(uint32_t)(value - base), (uint32_t)(valueEnd - value)});
+
+        std::string_view name(line, colon - line);
+        std::string_view val(value, valueEnd - value);
+        if(HttpEqualNoCase(name, "Content-Length")){
+            if(val.empty() || val.size() > 19){
+                return Fail(400);
+            }
+            uint64_t length = 0;
+            for(char c : val){
+                if(c < '0' || c > '9'){
+                    return Fail(400);
+                }
+                length = length * 10 + (c - '0');
+            }
+            // 重复的 Content-Length 取值必须一致，否则无法确定请求边界
+            if(_HasContentLength && length != _Request._ContentLength){
+                return Fail(400);
+            }
+            if(length > _MaxBodySize){
+                return Fail(413);
+            }
+            _HasContentLength = true;
+            _Request._ContentLength = length;
+        }
+        else if(HttpEqualNoCase(name, "Transfer-Encoding")){
+            return Fail(501);
+        }
+        else if(HttpEqualNoCase(name, "Connection")){
+            if(HttpHasToken(val, "close")){
+                _Request._KeepAlive = false;
+            }
+            else if(HttpHasToken(val, "keep-alive")){
+                _Request._KeepAlive = true;
+            }
+        }
+        return HTTP_INCOMPLETE;
+    }
+
+public:
+    HttpParser()
+        :_MaxRequestLine(HTTP_MAX_REQUEST_LINE),
+        _MaxHeaderSize(HTTP_MAX_HEADER_SIZE),
+        _MaxHeaders(HTTP_MAX_HEADERS),
+        _MaxBodySize(HTTP_MAX_BODY_SIZE)
+    {
+        Reset();
+    }
+
+    // 设置大小限制：请求行长度、请求行加头部的总长度、头部个数、请求体长度
+    void SetLimits(size_t requestLine, size_t headerSize, size_t headers, uint64_t bodySize){
+        _MaxRequestLine = requestLine;
+        _MaxHeaderSize = headerSize;
+        _MaxHeaders = headers;
+        _MaxBodySize = std::min<uint64_t>(bodySize, UINT32_MAX);
+    }
+
+    // 准备解析下一个请求，不修改缓冲区
+    void Reset(){
+        _State = PARSE_LINE;
+        _LineStart = 0;
+        _Scanned = 0;
+        _Error = 0;
+        _HasContentLength = false;
+        _Request.Reset();
+    }
+
+    // 从缓冲区的可读位置开始解析一个请求，不取走数据
+    Status Parse(Buffer* buffer){
+        const char* base = buffer->GetReadIndex();
+        size_t size = buffer->GetReadableSize();
+        _Request._Base = base;
+        while(true){
+            switch(_State){
+            case PARSE_LINE:
+            case PARSE_HEADERS:{
+                const char* eol = (const char*)memchr(base + _Scanned, '\n', size - _Scanned);
+                size_t limit = _State == PARSE_LINE ? _MaxRequestLine : _MaxHeaderSize;
+                if(eol == nullptr){
+                    _Scanned = size;
+                    if(size > limit){
+                        return Fail(_State == PARSE_LINE ? 414 : 431);
+                    }
+                    return HTTP_INCOMPLETE;
+                }
+                size_t next = eol - base + 1;
+                if(next > limit){
+                    return Fail(_State == PARSE_LINE ? 414 : 431);
+                }
+                size_t start = _LineStart;
+                size_t end = next - 1;
+                if(end > start && base[end - 1] == '\r'){
+                    --end;
+                }
+                _LineStart = _Scanned = next;
+                if(_State == PARSE_LINE){
+                    // 容忍请求之间多余的空行
+                    if(end == start){
+                        continue;
+                    }
+                    if(ParseRequestLine(base, start, end) == HTTP_ERROR){
+                        return HTTP_ERROR;
+                    }
+                    _State = PARSE_HEADERS;
+                }
+                else if(end == start){
+                    _Request._HeaderSize = next;
+                    _State = PARSE_BODY;
+                }
+                else if(ParseHeaderLine(base, start, end) == HTTP_ERROR){
+                    return HTTP_ERROR;
+                }
+                break;
+            }
+            case PARSE_BODY:
+                if(size < _Request.Size()){
+                    return HTTP_INCOMPLETE;
+                }
+                _Request._Body = HttpSlice{(uint32_t)_Request._HeaderSize, (uint32_t)_Request._ContentLength};
+                _State = PARSE_DONE;
+                return HTTP_COMPLETE;
+            case PARSE_DONE:
+                return HTTP_COMPLETE;
+            default:
+                return HTTP_ERROR;
+            }
+        }
+    }
+
+    // Parse 返回 HTTP_COMPLETE 后有效
+    const HttpRequest& GetRequest() const { return _Request; }
+    // Parse 返回 HTTP_ERROR 后有效：400/413/414/431/501/505
+    int GetError() const { return _Error; }
+
+    // 从缓冲区中取走已完成的请求，并准备解析下一个
+    void Consume(Buffer* buffer){
+        assert(_State == PARSE_DONE);
+        buffer->UpdateReadIndex(_Request.Size());
+        Reset();
+    }
+};
+
+
+// 常用状态码的原因短语
+inline const char* HttpStatusReason(int status){
+    switch(status){
+    case 100: return "Continue";
+    case 101: return "Switching Protocols";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 416: return "Range Not Satisfiable";
+    case 426: return "Upgrade Required";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 505: return "HTTP Version Not Supported";
+    default:  return "Unknown";
+    }
+}
+
+// Date 头部的取值，每个线程每秒只格式化一次
+inline std::string_view HttpDate(){
+    thread_local time_t cached = 0;
+    thread_local char date[32];
+    thread_local size_t length = 0;
+    time_t now = time(nullptr);
+    if(now != cached){
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        length = strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        cached = now;
+    }
+    return std::string_view(date, length);
+}
+
+
+class HttpDeferred;
+
+// HttpBuildResponse 生成的条目的状态码和头部长度（含结尾的空行）
+// 作为删除器保存在 shared_ptr 的控制块中，SendCached 用 std::get_deleter 取出，命中时不需要重新解析
+struct HttpWireInfo
+{
+    int Status;
+    size_t HeaderSize;
+    void operator()(const std::string* wire) const { delete wire; }
+};
+
+// 从完整响应中解析状态码和头部长度，格式不对时返回 false
+inline bool HttpParseWire(const std::string& wire, HttpWireInfo* info){
+    if(wire.size() < 12 || wire.compare(0, 7, "HTTP/1.") != 0 || wire[8] != ' '){
+        return false;
+    }
+    for(int i = 9; i < 12; ++i){
+        if(wire[i] < '0' || wire[i] > '9'){
+            return false;
+        }
+    }
+    size_t pos = wire.find("\r\n\r\n");
+    if(pos == std::string::npos){
+        return false;
+    }
+    info->Status = (wire[9] - '0') * 100 + (wire[10] - '0') * 10 + (wire[11] - '0');
+    info->HeaderSize = pos + 4;
+    return true;
+}
+
+// 响应构造器，状态行和头部按调用顺序直接写入连接的输出缓冲区，不经过中间对象
+// 调用顺序：WriteHead（可省略，默认 200）-> AddHeader（任意次）-> End 或 Stream；也可以直接 Defer，稍后再写
+// Content-Length、Transfer-Encoding、Connection 和 Date 由 End 或 Stream 写入，处理函数不要自行添加
+class HttpResponse
+{
+    friend class HttpServer;
+    friend class HttpDeferred;
+private:
+    const PtrConnection& _Conn;
+    Buffer* _Output;
+    int _Status;
+    bool _Started;
+    bool _Ended;
+    bool _KeepAlive;
+    // 请求为 HTTP/1.0 时，保持连接需要显式回复 Connection: keep-alive
+    bool _Http10;
+    // HEAD 请求只回复头部
+    bool _HeadOnly;
+    // Stream 创建的写入器，由 HttpServer 在处理函数返回后接管
+    std::shared_ptr<StreamWriter> _Stream;
+    // 切换协议的回调，见 SetUpgradeCallback
+    std::function<void()> _Upgrade;
+    // Defer 创建的延迟响应，由 HttpServer 在处理函数返回后接管
+    std::shared_ptr<HttpDeferred> _Deferred;
+
+private:
+    void Append(std::string_view str){
+        _Output->WritePush(str.data(), str.size());
+    }
+
+    // 1xx、204 和 304 响应没有响应体，也不写 Content-Length
+    bool HasBody() const{
+        return _Status >= 200 && _Status != 204 && _Status != 304;
+    }
+
+    // 写入结束部分的头部，此后只能写响应体；contentLength 为 -1 表示长度未知
+    // 长度未知时 HTTP/1.1 使用分块编码，HTTP/1.0 不写长度，以关闭连接表示响应体结束
+    void WriteTail(int64_t contentLength){
+        assert(!_Ended);
+        if(!_Started){
+            WriteHead(200);
+        }
+        if(contentLength < 0 && _Http10 && HasBody()){
+            _KeepAlive = false;
+        }
+        Append("Date: ");
+        Append(HttpDate());
+        if(!_KeepAlive){
+            Append("\r\nConnection: close");
+        }
+        else if(_Http10){
+            Append("\r\nConnection: keep-alive");
+        }
+        if(!HasBody() || (contentLength < 0 && _Http10)){
+            Append("\r\n\r\n");
+        }
+        else if(contentLength < 0){
+            Append("\r\nTransfer-Encoding: chunked\r\n\r\n");
+        }
+        else{
+            char length[48];
+            int len = snprintf(length, sizeof(length), "\r\nContent-Length: %llu\r\n\r\n", (unsigned long long)contentLength);
+            Append(std::string_view(length, len));
+        }
+        _Ended = true;
+    }
+
+    HttpResponse(const PtrConnection& conn, bool keepAlive, bool http10, bool headOnly):
+        _Conn(conn),
+        _Output(conn->GetOutputBuffer()),
+        _Status(200),
+        _Started(false),
+        _Ended(false),
+        _KeepAlive(keepAlive),
+        _Http10(http10),
+        _HeadOnly(headOnly),
+        _Stream(),
+        _Upgrade(),
+        _Deferred()
+    {}
+
+    // request 为空表示请求无法解析，回复后关闭连接
+    HttpResponse(const PtrConnection& conn, const HttpRequest* request):
+        HttpResponse(conn, request ? request->KeepAlive() : false, request ? request->MinorVersion() == 0 : false,
+                     request ? request->Method() == "HEAD" : false)
+    {}
+
+public:
+    const PtrConnection& GetConnection() const { return _Conn; }
+    int GetStatus() const { return _Status; }
+    bool Ended() const { return _Ended; }
+    bool KeepAlive() const { return _KeepAlive; }
+    bool HeadOnly() const { return _HeadOnly; }
+
+    // 回复后关闭连接，需在 End 之前调用
+    void SetClose(){
+        assert(!_Ended);
+        _KeepAlive = false;
+    }
+
+    void WriteHead(int status){
+        assert(!_Started);
+        char line[64];
+        int len = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", status, HttpStatusReason(status));
+        Append(std::string_view(line, len));
+        _Status = status;
+        _Started = true;
+    }
+
+    void AddHeader(std::string_view name, std::string_view value){
+        assert(!_Ended);
+        if(!_Started){
+            WriteHead(200);
+        }
+        Append(name);
+        Append(": ");
+        Append(value);
+        Append("\r\n");
+    }
+
+    // 追加预先格式化好的若干行头部，每行以 \r\n 结尾
+    void AddRawHeaders(std::string_view headers){
+        assert(!_Ended);
+        if(!_Started){
+            WriteHead(200);
+        }
+        Append(headers);
+    }
+
+    // 写入结束部分的头部和响应体，响应随本轮的写合并一起发出
+    void End(std::string_view body = std::string_view()){
+        WriteTail(body.size());
+        if(!_HeadOnly && HasBody()){
+            Append(body);
+        }
+    }
+
+    // 只写入头部，声明的 contentLength 字节的响应体由调用方随后发送（如 Connection::SendFile）
+    // HeadOnly 为 true 或状态码不带响应体时不能再发送
+    void EndHead(uint64_t contentLength){
+        WriteTail((int64_t)contentLength);
+    }
+
+    void Reply(int status, std::string_view contentType, std::string_view body){
+        WriteHead(status);
+        AddHeader("Content-Type", contentType);
+        End(body);
+    }
+
+    // 写入头部并返回流式写入器，响应体由写入器逐段发送，需调用写入器的 End 结束
+    // contentLength 为 -1（默认）时使用分块编码，否则原样发送，写入的总长度应与声明一致
+    // 流结束之前同一连接上流水线中的后续请求不会被处理
+    std::shared_ptr<StreamWriter> Stream(int64_t contentLength = -1){
+        WriteTail(contentLength);
+        bool chunked = contentLength < 0 && !_Http10;
+        _Stream = StreamWriter::Create(_Conn, chunked ? STREAM_CHUNKED : STREAM_RAW, _HeadOnly || !HasBody());
+        return _Stream;
+    }
+
+    // 延迟响应：处理函数不写任何内容直接返回，之后通过返回对象的 Complete 写入响应，本对象不能再使用
+    // 用于结果需要等待的响应（如 ResponseCache::Get 的回调）；完成之前流水线中的后续请求不会被处理
+    std::shared_ptr<HttpDeferred> Defer();
+
+    // 切换协议：处理函数写完 101 响应后设置，HttpServer 从缓冲区取走本请求后调用 cb，不再解析之后的数据
+    // cb 中调用 Connection::Upgrade 接管连接，输入缓冲区中剩余的数据由新协议处理
+    void SetUpgradeCallback(const std::function<void()>& cb){
+        assert(_Ended && _Status == 101);
+        _Upgrade = cb;
+    }
+
+    // 发送 HttpBuildResponse 生成的完整响应（通常来自 ResponseCache），数据不拷贝
+    // 需要关闭连接、HTTP/1.0 保持连接或 HEAD 请求时，在头部末尾插入 Connection 头部或省略响应体
+    // 其他来源的数据每次解析状态行和头部，格式不对时回复 500
+    void SendCached(const ResponseCache::Blob& wire){
+        assert(!_Started);
+        HttpWireInfo parsed;
+        const HttpWireInfo* info = std::get_deleter<HttpWireInfo>(wire);
+        if(!info){
+            bool valid = wire && HttpParseWire(*wire, &parsed);
+            assert(valid);
+            if(!valid){
+                return Reply(500, "text/plain", HttpStatusReason(500));
+            }
+            info = &parsed;
+        }
+        _Status = info->Status;
+        _Started = _Ended = true;
+        if(_KeepAlive && !_Http10 && !_HeadOnly){
+            return _Conn->SendShared(wire->data(), wire->size(), wire);
+        }
+        size_t headerEnd = info->HeaderSize - 2;
+        _Conn->SendShared(wire->data(), headerEnd, wire);
+        if(!_KeepAlive){
+            Append("Connection: close\r\n");
+        }
+        else if(_Http10){
+            Append("Connection: keep-alive\r\n");
+        }
+        Append("\r\n");
+        if(!_HeadOnly){
+            _Conn->SendShared(wire->data() + headerEnd + 2, wire->size() - headerEnd - 2, wire);
+        }
+    }
+};
+
+// 延迟完成的响应，由 HttpResponse::Defer 创建
+// Complete 可在任意线程调用，writer 在连接所属线程中用一个新的 HttpResponse 写入响应，未调用 End 时自动结束
+// writer 中不能再调用 Stream、Defer 或 SetUpgradeCallback；只有第一次 Complete 有效
+// 只持有连接的弱引用，连接关闭后 Complete 直接返回；从未完成时连接一直等待，直到空闲超时
+class HttpDeferred: public std::enable_shared_from_this<HttpDeferred>
+{
+    friend class HttpServer;
+public:
+    using Writer = std::function<void(HttpResponse&)>;
+
+private:
+    std::weak_ptr<Connection> _Conn;
+    bool _KeepAlive;
+    bool _Http10;
+    bool _HeadOnly;
+    bool _Completed;
+    // HttpServer 设置，异步完成后继续处理流水线；处理函数返回前已经完成时不调用
+    std::function<void(const PtrConnection&, bool)> _FinishCallback;
+
+private:
+    void CompleteInLoop(const Writer& writer){
+        if(_Completed){
+            return;
+        }
+        _Completed = true;
+        PtrConnection conn = _Conn.lock();
+        if(!conn || !conn->IsConnected()){
+            return;
+        }
+        HttpResponse response(conn, _KeepAlive, _Http10, _HeadOnly);
+        writer(response);
+        assert(!response._Stream && !response._Deferred && !response._Upgrade);
+        if(!response.Ended()){
+            response.End();
+        }
+        _KeepAlive = response.KeepAlive();
+        std::function<void(const PtrConnection&, bool)> finish = std::move(_FinishCallback);
+        _FinishCallback = nullptr;
+        if(finish){
+            finish(conn, _KeepAlive);
+        }
+    }
+
+public:
+    HttpDeferred(const PtrConnection& conn, bool keepAlive, bool http10, bool headOnly):
+        _Conn(conn),
+        _KeepAlive(keepAlive),
+        _Http10(http10),
+        _HeadOnly(headOnly),
+        _Completed(false)
+    {}
+
+    bool Completed() const { return _Completed; }
+    bool KeepAlive() const { return _KeepAlive; }
+
+    void Complete(const Writer& writer){
+        PtrConnection conn = _Conn.lock();
+        if(conn){
+            conn->RunInLoop(std::bind(&HttpDeferred::CompleteInLoop, shared_from_this(), writer));
+        }
+    }
+};
+
+inline std::shared_ptr<HttpDeferred> HttpResponse::Defer(){
+    assert(!_Started);
+    _Deferred = std::make_shared<HttpDeferred>(_Conn, _KeepAlive, _Http10, _HeadOnly);
+    _Started = _Ended = true;
+    return _Deferred;
+}
+
+// 生成完整的 HTTP/1.1 响应（状态行、头部和响应体），用于 ResponseCache 中的条目
+// headers 为预先格式化好的若干行头部，每行以 \r\n 结尾；Date 为生成时间
+// 状态码和头部长度记录在 HttpWireInfo 中，随条目一起共享
+inline ResponseCache::Blob HttpBuildResponse(int status, std::string_view contentType, std::string_view body,
+                                             std::string_view headers = std::string_view()){
+    char line[128];
+    int len = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nContent-Type: ", status, HttpStatusReason(status));
+    std::string date(HttpDate());
+    char length[48];
+    int lengthLen = snprintf(length, sizeof(length), "\r\nContent-Length: %zu\r\n\r\n", body.size());
+    std::string* wire = new std::string();
+    wire->reserve(len + contentType.size() + headers.size() + date.size() + lengthLen + body.size() + 16);
+    wire->append(line, len).append(contentType.data(), contentType.size()).append("\r\n");
+    wire->append(headers.data(), headers.size());
+    wire->append("Date: ").append(date).append(length, lengthLen);
+    HttpWireInfo info{status, wire->size()};
+    wire->append(body.data(), body.size());
+    return ResponseCache::Blob(wire, info);
+}
+
+
+// 默认的保持连接超时（秒），通过 TCPServer 的非活跃连接释放实现
+#define HTTP_KEEPALIVE_TIMEOUT 60
+
+// 基于 TCPServer 的 HTTP/1.1 服务器
+// 连接默认保持，一次收到的多个流水线请求在同一轮中依次处理，响应按请求顺序写入输出缓冲区，由写合并一起发出
+// 请求无法解析、请求要求关闭或处理函数调用 SetClose 时，回复后关闭连接，之后收到的数据直接丢弃
+// 处理函数在连接所属线程中同步执行；需要边生成边发送的响应使用 HttpResponse::Stream，需要等待结果的响应使用 HttpResponse::Defer
+class HttpServer
+{
+public:
+    using Handler = std::function<void(const HttpRequest&, HttpResponse&)>;
+
+private:
+    // 每个连接的解析状态，保存在连接的内联上下文中
+    struct HttpContext
+    {
+        HttpParser Parser;
+        bool Closing;
+        // 进行中的流式响应或尚未完成的延迟响应，结束前后续请求留在输入缓冲区中
+        std::shared_ptr<StreamWriter> Stream;
+        std::shared_ptr<HttpDeferred> Deferred;
+        HttpContext(): Closing(false) {}
+    };
+
+    TCPServer _Server;
+    // 按路径精确匹配，同一路径下按方法区分；路径查找直接使用请求中的视图，不构造字符串
+    std::map<std::string, std::vector<std::pair<std::string, Handler>>, std::less<>> _Routes;
+    // 前缀路由，按前缀从长到短排列，精确匹配失败后依次检查
+    std::vector<std::pair<std::string, Handler>> _Mounts;
+    // 没有匹配的路径时调用，未设置时回复 404
+    Handler _DefaultHandler;
+    size_t _MaxRequestLine;
+    size_t _MaxHeaderSize;
+    size_t _MaxHeaders;
+    uint64_t _MaxBodySize;
+
+private:
+    void OnConnected(const PtrConnection& conn){
+        HttpContext& context = conn->EmplaceContext<HttpContext>();
+        context.Parser.SetLimits(_MaxRequestLine, _MaxHeaderSize, _MaxHeaders, _MaxBodySize);
+    }
+
+    void Dispatch(const HttpRequest& request, HttpResponse& response){
+        auto iter = _Routes.find(request.Path());
+        if(iter != _Routes.end()){
+            for(auto& route : iter->second){
+                if(route.first == request.Method() || (route.first == "GET" && request.Method() == "HEAD")){
+                    return route.second(request, response);
+                }
+            }
+            return response.Reply(405, "text/plain", "Method Not Allowed\n");
+        }
+        for(auto& mount : _Mounts){
+            if(request.Path().compare(0, mount.first.size(), mount.first) == 0){
+                return mount.second(request, response);
+            }
+        }
+        if(_DefaultHandler){
+            return _DefaultHandler(request, response);
+        }
+        response.Reply(404, "text/plain", "Not Found\n");
+    }
+
+    void OnMessage(const PtrConnection& conn, Buffer* buffer){
+        HttpContext* context = conn->GetContext()->Get<HttpContext>();
+        if(context->Closing){
+            buffer->UpdateReadIndex(buffer->GetReadableSize());
+            return;
+        }
+        if(context->Stream || context->Deferred){
+            return;
+        }
+        Buffer* output = conn->GetOutputBuffer();
+        size_t pending = output->GetReadableSize();
+        while(true){
+            HttpParser::Status status = context->Parser.Parse(buffer);
+            if(status == HttpParser::HTTP_INCOMPLETE){
+                break;
+            }
+            if(status == HttpParser::HTTP_ERROR){
+                int code = context->Parser.GetError();
+                HttpResponse response(conn, nullptr);
+                response.Reply(code, "text/plain", HttpStatusReason(code));
+                context->Closing = true;
+                break;
+            }
+            const HttpRequest& request = context->Parser.GetRequest();
+            HttpResponse response(conn, &request);
+            Dispatch(request, response);
+            if(response._Upgrade){
+                // 连接交给新协议，本对象的上下文随 Upgrade 一起销毁，之后不能再访问
+                context->Parser.Consume(buffer);
+                if(output->GetReadableSize() != pending){
+                    conn->CommitOutput();
+                }
+                std::function<void()> upgrade = std::move(response._Upgrade);
+                return upgrade();
+            }
+            if(response._Stream && !response._Stream->Ended() && !response._Stream->Closed()){
+                // 流式响应由写入器接管，结束后再继续处理缓冲区中的请求
+                context->Parser.Consume(buffer);
+                context->Stream = response._Stream;
+                // 后续请求排在流之后，不是客户端发送慢，读期限暂停到流结束
+                conn->HoldInput(true);
+                bool keepAlive = response.KeepAlive();
+                context->Stream->SetFinishCallback([this, conn, keepAlive](){
+                    FinishStream(conn, keepAlive);
+                });
+                break;
+            }
+            if(response._Deferred){
+                context->Parser.Consume(buffer);
+                if(!response._Deferred->Completed()){
+                    // 完成后由 FinishDeferred 发送并继续处理后续请求
+                    context->Deferred = response._Deferred;
+                    context->Deferred->_FinishCallback = std::bind(&HttpServer::FinishDeferred, this,
+                                                                   std::placeholders::_1, std::placeholders::_2);
+                    conn->HoldInput(true);
+                    break;
+                }
+                // 处理函数返回前已经完成（如缓存命中），响应已按顺序写入输出缓冲区
+                if(!response._Deferred->KeepAlive()){
+                    context->Closing = true;
+                    break;
+                }
+                continue;
+            }
+            if(!response.Ended()){
+                response.End();
+            }
+            context->Parser.Consume(buffer);
+            if(!response.KeepAlive()){
+                context->Closing = true;
+                break;
+            }
+        }
+        if(output->GetReadableSize() != pending){
+            conn->CommitOutput();
+        }
+        if(context->Closing){
+            // 关闭前丢弃剩余的流水线请求，已写入的响应发送完后再释放连接
+            buffer->UpdateReadIndex(buffer->GetReadableSize());
+            conn->Shutdown();
+        }
+    }
+
+    void FinishStream(const PtrConnection& conn, bool keepAlive){
+        HttpContext* context = conn->GetContext()->Get<HttpContext>();
+        context->Stream.reset();
+        ResumePipeline(conn, keepAlive);
+    }
+
+    void FinishDeferred(const PtrConnection& conn, bool keepAlive){
+        HttpContext* context = conn->GetContext()->Get<HttpContext>();
+        context->Deferred.reset();
+        conn->CommitOutput();
+        ResumePipeline(conn, keepAlive);
+    }
+
+    // 流式或延迟响应结束后，关闭连接或继续处理缓冲区中的后续请求
+    void ResumePipeline(const PtrConnection& conn, bool keepAlive){
+        if(!conn->IsConnected()){
+            return;
+        }
+        conn->HoldInput(false);
+        HttpContext* context = conn->GetContext()->Get<HttpContext>();
+        Buffer* buffer = conn->GetInputBuffer();
+        if(!keepAlive){
+            context->Closing = true;
+            buffer->UpdateReadIndex(buffer->GetReadableSize());
+            conn->Shutdown();
+        }
+        else if(buffer->GetReadableSize() > 0){
+            OnMessage(conn, buffer);
+        }
+    }
+
+public:
+    HttpServer(int port):
+        _Server(port),
+        _MaxRequestLine(HTTP_MAX_REQUEST_LINE),
+        _MaxHeaderSize(HTTP_MAX_HEADER_SIZE),
+        _MaxHeaders(HTTP_MAX_HEADERS),
+        _MaxBodySize(HTTP_MAX_BODY_SIZE)
+    {
+        _Server.SetEnableInactiveRelease(HTTP_KEEPALIVE_TIMEOUT);
+        _Server.SetConnectedCallback(std::bind(&HttpServer::OnConnected, this, std::placeholders::_1));
+        _Server.SetMessageCallback(std::bind(&HttpServer::OnMessage, this, std::placeholders::_1, std::placeholders::_2));
+    }
+
+    // 注册路由，method 如 "GET"；GET 路由同时处理 HEAD 请求
+    void Route(const std::string& method, const std::string& path, const Handler& handler){
+        _Routes[path].emplace_back(method, handler);
+    }
+    void Get(const std::string& path, const Handler& handler)  { Route("GET", path, handler); }
+    void Post(const std::string& path, const Handler& handler) { Route("POST", path, handler); }
+    void SetDefaultHandler(const Handler& handler) { _DefaultHandler = handler; }
+    // 路径以 prefix 开头的所有请求（任意方法）交给 handler，如静态文件目录
+    void Mount(const std::string& prefix, const Handler& handler){
+        auto iter = _Mounts.begin();
+        while(iter != _Mounts.end() && iter->first.size() >= prefix.size()){
+            ++iter;
+        }
+        _Mounts.emplace(iter, prefix, handler);
+    }
+
+    // 空闲的保持连接在 timeout 秒后关闭
+    void SetKeepAliveTimeout(uint32_t timeout){
+        _Server.SetEnableInactiveRelease(timeout);
+    }
+    // 请求大小限制，见 HttpParser::SetLimits
+    void SetLimits(size_t requestLine, size_t headerSize, size_t headers, uint64_t bodySize){
+        _MaxRequestLine = requestLine;
+        _MaxHeaderSize = headerSize;
+        _MaxHeaders = headers;
+        _MaxBodySize = bodySize;
+    }
+    void SetThreadCount(int count){
+        _Server.SetThreadCount(count);
+    }
+    // 线程、期限、准入控制等其他设置直接作用在底层的 TCPServer 上
+    TCPServer& GetServer(){ return _Server; }
+
+    void Start(){
+        _Server.Start();
+    }
+};
+
+
+// 按扩展名推断 Content-Type
+inline const char* HttpMimeType(std::string_view path){
+    static const std::pair<const char*, const char*> types[] = {
+        {".html", "text/html; charset=utf-8"}, {".htm", "text/html; charset=utf-8"},
+        {".css", "text/css"}, {".js", "application/javascript"}, {".json", "application/json"},
+        {".txt", "text/plain; charset=utf-8"}, {".xml", "application/xml"},
+        {".png", "image/png"}, {".jpg", "image/jpeg"}, {".jpeg", "image/jpeg"}, {".gif", "image/gif"},
+        {".svg", "image/svg+xml"}, {".ico", "image/x-icon"}, {".webp", "image/webp"},
+        {".woff", "font/woff"}, {".woff2", "font/woff2"}, {".wasm", "application/wasm"},
+        {".pdf", "application/pdf"}, {".mp4", "video/mp4"}, {".zip", "application/zip"},
+    };
+    size_t dot = path.rfind('.');
+    if(dot != std::string_view::npos){
+        std::string_view ext = path.substr(dot);
+        for(auto& type : types){
+            if(HttpEqualNoCase(ext, type.first)){
+                return type.second;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+// 解析 Range 头部，只支持单个字节范围：bytes=a-b、bytes=a-、bytes=-n
+// 返回 1 表示得到范围 [start, start + length)，0 表示不支持或格式错误（按完整响应处理），-1 表示范围无法满足
+inline int HttpParseRange(std::string_view value, uint64_t size, uint64_t* start, uint64_t* length){
+    if(value.compare(0, 6, "bytes=") != 0 || value.find(',') != std::string_view::npos){
+        return 0;
+    }
+    value.remove_prefix(6);
+    size_t dash = value.find('-');
+    if(dash == std::string_view::npos){
+        return 0;
+    }
+    // 数字过长时视为格式错误
+    auto number = [](std::string_view digits, uint64_t* out){
+        if(digits.empty() || digits.size() > 18){
+            return false;
+        }
+        uint64_t n = 0;
+        for(char c : digits){
+            if(c < '0' || c > '9'){
+                return false;
+            }
+            n = n * 10 + (c - '0');
+        }
+        *out = n;
+        return true;
+    };
+    uint64_t first = 0, last = 0;
+    std::string_view from = value.substr(0, dash);
+    std::string_view to = value.substr(dash + 1);
+    if(from.empty()){
+        // 最后 n 个字节
+        if(!number(to, &last)){
+            return 0;
+        }
+        if(last == 0 || size == 0){
+            return -1;
+        }
+        *length = std::min(last, size);
+        *start = size - *length;
+        return 1;
+    }
+    if(!number(from, &first) || (!to.empty() && !number(to, &last))){
+        return 0;
+    }
+    if(to.empty() || last >= size){
+        last = size - 1;
+    }
+    if(first >= size || first > last){
+        return (first > last && first < size) ? 0 : -1;
+    }
+    *start = first;
+    *length = last - first + 1;
+    return 1;
+}
+
+
+// 文件缓存的默认设置
+#define FILE_CACHE_MAX_ENTRIES 1024                  // 缓存的文件数上限，也是缓存占用的 fd 数上限
+#define FILE_CACHE_TTL_MS 1000                       // 条目超过该时间后再次访问时重新 stat，检查文件是否变化
+#define FILE_CACHE_INLINE_SIZE (16 * 1024)           // 不超过该大小的文件读入内存，不占用 fd
+#define FILE_CACHE_INLINE_TOTAL (32 * 1024 * 1024)   // 内存副本的总大小上限
+
+// 打开的文件和预先计算好的响应元数据，创建后不再修改，可以在多个线程间共享
+// 小文件只保存内存副本，大文件保持 fd 打开，最后一个持有者（缓存或发送中的连接）释放时关闭
+struct CachedFile
+{
+    int Fd;
+    struct stat Stat;
+    std::string ETag;
+    std::string LastModified;
+    // Content-Type、Last-Modified、ETag 和 Accept-Ranges 头部，200/206 响应直接追加
+    std::string Headers;
+    std::string Content;
+    bool Inline;
+
+    CachedFile(): Fd(-1), Inline(false) {}
+    ~CachedFile(){
+        if(Fd >= 0){
+            close(Fd);
+        }
+    }
+    CachedFile(const CachedFile&) = delete;
+    CachedFile& operator=(const CachedFile&) = delete;
+};
+
+struct FileCacheStatsSnapshot
+{
+    uint64_t Hits;          // 在 TTL 内直接命中
+    uint64_t Revalidated;   // 超过 TTL，stat 确认文件未变化
+    uint64_t Opened;        // 首次访问或文件变化后重新打开
+    uint64_t Evicted;
+    uint64_t Entries;
+    uint64_t InlineBytes;
+};
+
+// 按路径缓存打开的文件和 stat 结果，LRU 淘汰，条目数和内存副本总大小有上限
+// 命中时不产生系统调用；超过 TTL 的条目再次访问时 stat 一次，文件未变化则继续使用
+// 多个事件循环共享，锁内只做查表和链表操作，open/stat/读文件都在锁外进行
+class FileCache
+{
+private:
+    struct Entry
+    {
+        std::shared_ptr<const CachedFile> File;
+        uint64_t CheckedUs;
+        std::list<std::string>::iterator Position;
+    };
+
+    std::mutex _Mutex;
+    std::unordered_map<std::string, Entry> _Entries;
+    // 最近使用的在前
+    std::list<std::string> _Lru;
+    size_t _MaxEntries;
+    uint64_t _TtlUs;
+    size_t _InlineSize;
+    size_t _InlineTotal;
+    size_t _InlineBytes;
+    FileCacheStatsSnapshot _Stats;
+
+private:
+    static bool SameFile(const struct stat& a, const struct stat& b){
+        return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size
+            && a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+    }
+
+    // 打开文件并计算元数据，失败时返回空指针并设置 *error
+    static std::shared_ptr<const CachedFile> Open(const std::string& path, bool allowInline, size_t inlineSize, int* error){
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0){
+            *error = errno;
+            return nullptr;
+        }
+        std::shared_ptr<CachedFile> file = std::make_shared<CachedFile>();
+        file->Fd = fd;
+        if(fstat(fd, &file->Stat) < 0){
+            *error = errno;
+            return nullptr;
+        }
+        if(!S_ISREG(file->Stat.st_mode)){
+            *error = EISDIR;
+            return nullptr;
+        }
+        uint64_t size = file->Stat.st_size;
+        if(allowInline && size <= inlineSize){
+            file->Content.resize(size);
+            size_t got = 0;
+            while(got < size){
+                ssize_t n = pread(fd, &file->Content[got], size - got, got);
+                if(n <= 0){
+                    break;
+                }
+                got += n;
+            }
+            // 读取期间文件被截断时退回到 sendfile
+            if(got == size){
+                file->Inline = true;
+                file->Fd = -1;
+                close(fd);
+            }
+            else{
+                file->Content.clear();
+            }
+        }
+        char etag[64];
+        uint64_t mtime = (uint64_t)file->Stat.st_mtim.tv_sec * 1000000000ULL + file->Stat.st_mtim.tv_nsec;
+        snprintf(etag, sizeof(etag), "\"%llx-%llx\"", (unsigned long long)size, (unsigned long long)mtime);
+        file->ETag = etag;
+        char date[64];
+        struct tm tm;
+        gmtime_r(&file->Stat.st_mtim.tv_sec, &tm);
+        file->LastModified.assign(date, strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm));
+        file->Headers = std::string("Content-Type: ") + HttpMimeType(path) + "\r\nLast-Modified: " + file->LastModified
+                      + "\r\nETag: " + file->ETag + "\r\nAccept-Ranges: bytes\r\n";
+        return file;
+    }
+
+    void EraseLocked(std::unordered_map<std::string, Entry>::iterator iter){
+        if(iter->second.File->Inline){
+            _InlineBytes -= iter->second.File->Content.size();
+        }
+        _Lru.erase(iter->second.Position);
+        _Entries.erase(iter);
+    }
+
+    void InsertLocked(const std::string& path, const std::shared_ptr<const CachedFile>& file, uint64_t now){
+        auto iter = _Entries.find(path);
+        if(iter != _Entries.end()){
+            EraseLocked(iter);
+        }
+        _Lru.push_front(path);
+        _Entries[path] = Entry{file, now, _Lru.begin()};
+        if(file->Inline){
+            _InlineBytes += file->Content.size();
+        }
+        ++_Stats.Opened;
+        while(_Entries.size() > _MaxEntries || _InlineBytes > _InlineTotal){
+            EraseLocked(_Entries.find(_Lru.back()));
+            ++_Stats.Evicted;
+        }
+    }
+
+public:
+    FileCache(size_t maxEntries = FILE_CACHE_MAX_ENTRIES, uint32_t ttlMs = FILE_CACHE_TTL_MS,
+              size_t inlineSize = FILE_CACHE_INLINE_SIZE, size_t inlineTotal = FILE_CACHE_INLINE_TOTAL):
+        _MaxEntries(std::max<size_t>(maxEntries, 1)),
+        _TtlUs(ttlMs * 1000ULL),
+        _InlineSize(inlineSize),
+        _InlineTotal(inlineTotal),
+        _InlineBytes(0),
+        _Stats()
+    {}
+
+    // 返回路径对应的文件，失败时返回空指针，*error 为 errno（不是普通文件时为 EISDIR）
+    std::shared_ptr<const CachedFile> Get(const std::string& path, int* error){
+        uint64_t now = MonotonicUs();
+        std::shared_ptr<const CachedFile> stale;
+        bool allowInline;
+        {
+            std::lock_guard<std::mutex> lock(_Mutex);
+            auto iter = _Entries.find(path);
+            if(iter != _Entries.end()){
+                _Lru.splice(_Lru.begin(), _Lru, iter->second.Position);
+                if(now - iter->second.CheckedUs < _TtlUs){
+                    ++_Stats.Hits;
+                    return iter->second.File;
+                }
+                stale = iter->second.File;
+            }
+            allowInline = _InlineBytes + _InlineSize <= _InlineTotal;
+        }
+        if(stale){
+            struct stat st;
+            if(stat(path.c_str(), &st) == 0 && SameFile(st, stale->Stat)){
+                std::lock_guard<std::mutex> lock(_Mutex);
+                auto iter = _Entries.find(path);
+                if(iter != _Entries.end() && iter->second.File == stale){
+                    iter->second.CheckedUs = now;
+                }
+                ++_Stats.Revalidated;
+                return stale;
+            }
+        }
+        std::shared_ptr<const CachedFile> file = Open(path, allowInline, _InlineSize, error);
+        std::lock_guard<std::mutex> lock(_Mutex);
+        if(!file){
+            auto iter = _Entries.find(path);
+            if(iter != _Entries.end()){
+                EraseLocked(iter);
+            }
+            return nullptr;
+        }
+        InsertLocked(path, file, now);
+        return file;
+    }
+
+    FileCacheStatsSnapshot GetStats(){
+        std::lock_guard<std::mutex> lock(_Mutex);
+        FileCacheStatsSnapshot stats = _Stats;
+        stats.Entries = _Entries.size();
+        stats.InlineBytes = _InlineBytes;
+        return stats;
+    }
+};
+
+
+// 静态文件处理函数，挂载到 HttpServer 的前缀路由上：server.Mount("/static/", StaticFileHandler("/static/", "./www"))
+// 支持 GET/HEAD、单个 Range、ETag/If-None-Match、Last-Modified/If-Modified-Since 和 If-Range
+// 小文件从缓存的内存副本直接写入输出缓冲区，其余文件用 sendfile 发送；路径以 / 结尾时返回其中的 index.html
+// 可以复制，副本共享同一个文件缓存
+class StaticFileHandler
+{
+private:
+    std::string _Prefix;
+    std::string _Root;
+    std::shared_ptr<FileCache> _Cache;
+
+private:
+    // 把请求路径映射到根目录下的文件，包含 .. 或 NUL 的路径返回 false
+    bool Resolve(std::string_view path, std::string* file) const{
+        std::string relative = HttpUrlDecode(path.substr(std::min(_Prefix.size(), path.size())));
+        if(relative.find('\0') != std::string::npos){
+            return false;
+        }
+        size_t pos = 0;
+        while(pos <= relative.size()){
+            size_t slash = relative.find('/', pos);
+            if(slash == std::string::npos){
+                slash = relative.size();
+            }
+            if(relative.compare(pos, slash - pos, "..") == 0){
+                return false;
+            }
+            pos = slash + 1;
+        }
+        *file = _Root;
+        if(relative.empty() || relative.front() != '/'){
+            file->push_back('/');
+        }
+        file->append(relative);
+        if(file->back() == '/'){
+            file->append("index.html");
+        }
+        return true;
+    }
+
+    static void NotModified(const CachedFile& file, HttpResponse& response){
+        response.WriteHead(304);
+        response.AddHeader("ETag", file.ETag);
+        response.AddHeader("Last-Modified", file.LastModified);
+        response.End();
+    }
+
+public:
+    StaticFileHandler(const std::string& prefix, const std::string& root,
+                      const std::shared_ptr<FileCache>& cache = std::make_shared<FileCache>()):
+        _Prefix(prefix),
+        _Root(root),
+        _Cache(cache)
+    {
+        while(!_Root.empty() && _Root.back() == '/'){
+            _Root.pop_back();
+        }
+    }
+
+    const std::shared_ptr<FileCache>& GetCache() const { return _Cache; }
+
+    void operator()(const HttpRequest& request, HttpResponse& response) const{
+        if(request.Method() != "GET" && request.Method() != "HEAD"){
+            response.WriteHead(405);
+            response.AddHeader("Allow", "GET, HEAD");
+            return response.End();
+        }
+        std::string path;
+        if(!Resolve(request.Path(), &path)){
+            return response.Reply(403, "text/plain", "Forbidden\n");
+        }
+        int error = 0;
+        std::shared_ptr<const CachedFile> file = _Cache->Get(path, &error);
+        if(!file){
+            if(error == EACCES){
+                return response.Reply(403, "text/plain", "Forbidden\n");
+            }
+            if(error == ENOENT || error == ENOTDIR || error == EISDIR || error == ENAMETOOLONG){
+                return response.Reply(404, "text/plain", "Not Found\n");
+            }
+            return response.Reply(500, "text/plain", "Internal Server Error\n");
+        }
+
+        // 有 If-None-Match 时忽略 If-Modified-Since
+        std::string_view noneMatch = request.GetHeader("If-None-Match");
+        if(!noneMatch.empty()){
+            if(noneMatch == "*" || HttpHasToken(noneMatch, file->ETag)){
+                return NotModified(*file, response);
+            }
+        }
+        else if(request.GetHeader("If-Modified-Since") == file->LastModified){
+            return NotModified(*file, response);
+        }
+
+        uint64_t size = file->Stat.st_size;
+        uint64_t start = 0;
+        uint64_t length = size;
+        int status = 200;
+        std::string_view range = request.GetHeader("Range");
+        std::string_view ifRange = request.GetHeader("If-Range");
+        if(!range.empty() && (ifRange.empty() || ifRange == file->ETag || ifRange == file->LastModified)){
+            int ret = HttpParseRange(range, size, &start, &length);
+            if(ret < 0){
+                char unsatisfied[48];
+                snprintf(unsatisfied, sizeof(unsatisfied), "bytes */%llu", (unsigned long long)size);
+                response.WriteHead(416);
+                response.AddHeader("Content-Range", unsatisfied);
+                return response.End();
+            }
+            if(ret == 0){
+                start = 0;
+                length = size;
+            }
+            else{
+                status = 206;
+            }
+        }
+
+        response.WriteHead(status);
+        response.AddRawHeaders(file->Headers);
+        if(status == 206){
+            char contentRange[96];
+            snprintf(contentRange, sizeof(contentRange), "bytes %llu-%llu/%llu", (unsigned long long)start,
+                     (unsigned long long)(start + length - 1), (unsigned long long)size);
+            response.AddHeader("Content-Range", contentRange);
+        }
+        if(file->Inline){
+            return response.End(std::string_view(file->Content).substr(start, length));
+        }
+        response.EndHead(length);
+        if(!response.HeadOnly()){
+            response.GetConnection()->SendFile(file->Fd, start, length, file);
+        }
+    }
+};
+
+#endif // _HTTP_HPP_
@@ -1,3 +1,6 @@
+#ifndef _SERVER_HPP_
+#define _SERVER_HPP_
+
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -10,8 +13,12 @@
 #include <unordered_map>
 #include <memory>
 #include <list>
+#include <map>
+#include <algorithm>
 #include <unistd.h>
 #include <sys/timerfd.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <cstdio>
 #include <functional>
 #include <sys/epoll.h>
@@ -19,6 +26,7 @@
 #include <typeinfo>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <signal.h>
 #include <fcntl.h>
@@ -30,12 +38,41 @@
 #include <cstdio>
 #include <thread>
 #include <sstream>
+#include <deque>
+#include <atomic>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <climits>
+#include <new>
+#include <cstddef>
+#include <type_traits>
+#include <sys/syscall.h>
 
 
 #define MAX_POLLER_SIZE 1024
 #define MAX_LISTENFD 5
 #define MAX_EVENT 1024
 #define MAX_LISTEN_NUM 1024
+// 自动再平衡时，循环延迟需连续超标的检查次数
+#define REBALANCE_HOT_ROUNDS 2
+// 线程数减少时移出的线程保留多久以备复用（秒），之后没有被引用时退出
+#define LOOP_PARK_GRACE 60
+// 延迟任务每轮循环默认可占用的时间预算（微秒）
+#define DEFAULT_DEFERRED_BUDGET_US 1000
+// 每轮循环默认的读取预算：读取字节数和读事件数，任一用完后大流量连接的读取推迟到下一轮
+#define DEFAULT_READ_BUDGET_BYTES (256 * 1024)
+#define DEFAULT_READ_BUDGET_EVENTS 256
+// 连接自适应读取大小的范围和初始值，读取大小达到 READ_SIZE_BULK 的连接视为大流量连接
+#define READ_SIZE_MIN 512
+#define READ_SIZE_INIT 4096
+#define READ_SIZE_MAX (64 * 1024)
+#define READ_SIZE_BULK (32 * 1024)
+// 连续多少次读到的数据不足读取大小的一半时缩小读取大小
+#define READ_SIZE_SHRINK_ROUNDS 2
+// 一次 sendmsg 合并发送的最大段数
+#define OUTPUT_IOV_MAX 64
 
 
 // 日志宏颜色等级
@@ -87,6 +124,14 @@ public:
     Buffer(ssize_t size = 1024)
         : _buffer(size), _readIndex(0), _writeIndex(0)
     {}
+    // 使用已有的存储（如对象池回收的存储），为空时按默认大小分配
+    Buffer(std::vector<char>&& storage)
+        : _buffer(std::move(storage)), _readIndex(0), _writeIndex(0)
+    {
+        if(_buffer.empty()){
+            _buffer.resize(1024);
+        }
+    }
     // destructor
     ~Buffer() = default;
 
@@ -97,6 +142,13 @@ public:
 
     // 获取缓冲区大小的方法
     ssize_t GetSize() { return _buffer.size(); }
+    // 取走底层存储以便复用，缓冲区变为空
+    std::vector<char> TakeStorage(){
+        std::vector<char> storage;
+        storage.swap(_buffer);
+        _readIndex = _writeIndex = 0;
+        return storage;
+    }
     // 获取缓冲区的可读大小
     // 返回尾部剩余空间
     uint64_t GetTailRestSize() { return _buffer.size() - _writeIndex; }
@@ -274,19 +326,33 @@ public:
         setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
     }
 
+    // 关闭时丢弃未发出的数据并发送 RST，不再占用内核发送缓冲区
+    void AbortOnClose(){
+        struct linger opt;
+        opt.l_onoff = 1;
+        opt.l_linger = 0;
+        setsockopt(_fd, SOL_SOCKET, SO_LINGER, &opt, sizeof(opt));
+    }
+
+    // 开启时内核只发送满 MSS 的报文，关闭时立即发出积攒的数据
+    void Cork(bool on){
+        int opt = on ? 1 : 0;
+        setsockopt(_fd, IPPROTO_TCP, TCP_CORK, &opt, sizeof(opt));
+    }
+
     // 创建socket
     // 地址复用和端口复用标志位
     bool Create(bool AddrReuseFlag = 0, bool PortReuseFlag = 0){
-        // 设置地址和端口复用
-        if(AddrReuseFlag) { ReuseAddr(); }
-        if(PortReuseFlag) { ReusePort(); }
-
         // 创建socket
         _fd = socket(AF_INET, SOCK_STREAM, 0);
         if(_fd == -1){
             ERR_LOG("Create socket failed");
             return false;
         }
+
+        // 设置地址和端口复用，必须在 socket 创建之后
+        if(AddrReuseFlag) { ReuseAddr(); }
+        if(PortReuseFlag) { ReusePort(); }
         return true;
     }
 
@@ -332,10 +398,14 @@ public:
 
     // accept socket
     // 接受socket
-    int Accept(){
+    // peer 不为空时返回对端地址
+    int Accept(struct sockaddr_in* peer = nullptr){
         struct sockaddr_in addr;
         socklen_t len = sizeof(addr);
         int clientFd = accept(_fd, (struct sockaddr*)&addr, &len);
+        if(clientFd != -1 && peer){
+            *peer = addr;
+        }
         if(clientFd == -1){
             ERR_LOG("Accept socket failed");
             return -1;
@@ -403,11 +473,21 @@ public:
     }
 
 
+    // 暂时没有数据可读写或被信号打断，稍后重试即可，不算错误
+    static bool IsRetryError(int err){
+        return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+    }
+
     ssize_t Recv(void* buf, size_t len, int flag = 0){
         // 调用系统接口
         ssize_t recvLen = recv(_fd, buf, len, flag);
         if(recvLen == -1){
-            ERR_LOG("Recv socket failed");
+            // 日志会调用 time/localtime，可能改写 errno，先保存，返回前恢复给调用方判断
+            int err = errno;
+            if(!IsRetryError(err)){
+                ERR_LOG("Recv socket failed");
+            }
+            errno = err;
             return -1;
         }
         return recvLen;
@@ -423,7 +503,11 @@ public:
         // 调用系统接口
         ssize_t sendLen = send(_fd, buf, len, flag);
         if(sendLen == -1){
-            ERR_LOG("Send socket failed");
+            int err = errno;
+            if(!IsRetryError(err)){
+                ERR_LOG("Send socket failed");
+            }
+            errno = err;
             return -1;
         }
         return sendLen;
@@ -435,6 +519,36 @@ public:
         return Send(buf, len, flag);
     }
 
+    // 一次发送多段数据
+    ssize_t SendVector(const struct iovec* iov, int count, int flag = MSG_DONTWAIT){
+        struct msghdr msg = {};
+        msg.msg_iov = const_cast<struct iovec*>(iov);
+        msg.msg_iovlen = count;
+        ssize_t sendLen = sendmsg(_fd, &msg, flag);
+        if(sendLen == -1){
+            int err = errno;
+            if(!IsRetryError(err)){
+                ERR_LOG("Sendmsg failed");
+            }
+            errno = err;
+        }
+        return sendLen;
+    }
+
+    // 由内核直接把文件内容发到套接字，offset 随发送推进
+    // sendfile 没有 MSG_DONTWAIT 标志，套接字需先设置为非阻塞模式
+    ssize_t SendFile(int fileFd, off_t* offset, size_t len){
+        ssize_t sendLen = sendfile(_fd, fileFd, offset, len);
+        if(sendLen == -1){
+            int err = errno;
+            if(!IsRetryError(err)){
+                ERR_LOG("Sendfile failed");
+            }
+            errno = err;
+        }
+        return sendLen;
+    }
+
     void Close(){
         if(_fd != -1){
             close(_fd);
@@ -507,6 +621,8 @@ private:
     // _revents: 就绪事件（连接触发事件）
     uint32_t _events;
     uint32_t _revents;
+    // 大流量通道：每轮在其他通道之后处理，读取预算用完后推迟读取
+    bool _bulk;
 
     // 事件循环
     EventLoop* _loop;
@@ -528,7 +644,8 @@ public:
         : _loop(loop),
           _fd(fd),
           _events(0),
-          _revents(0)
+          _revents(0),
+          _bulk(false)
     {}
 
     int Getfd() const { return _fd; }
@@ -536,7 +653,10 @@ public:
     uint32_t GetRevents() const { return _revents; }
 
     void SetRevents(uint32_t revents) { _revents = revents; } // 设置活动事件
+    void SetLoop(EventLoop* loop) { _loop = loop; } // 连接迁移时更换所属的事件循环
     void SetEvents(uint32_t events) { _events = events; }
+    void SetBulk(bool bulk) { _bulk = bulk; }
+    bool IsBulk() const { return _bulk; }
 
     // 设置事件回调函数
     void SetReadCallback(const EventCallback& cb)   { _readCallback = cb; }
@@ -550,6 +670,9 @@ public:
     bool WriteAble() const  { return _revents & EPOLLOUT; }
     bool Error() const      { return _revents & EPOLLERR; }
     bool Close() const      { return _revents & EPOLLHUP; }
+    // 当前是否在监控读/写事件
+    bool IsReading() const  { return _events & EPOLLIN; }
+    bool IsWriting() const  { return _events & EPOLLOUT; }
 
     void Update();
     void Remove();
@@ -636,6 +759,10 @@ public:
         }
     }
 
+    ~Poller(){
+        close(_epollfd);
+    }
+
     void UpdateChannel(Channel* channel){
         // 修改事件
         if(HasChannel(channel)){
@@ -661,14 +788,17 @@ public:
 
     // epoll_wait: 等待事件的产生
     // int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
-    void Poll(std::vector<Channel*>& activeChannels){
+    void Poll(std::vector<Channel*>& activeChannels, int timeout = -1){
         // 阻塞式调用，等待事件的产生
         // 是否阻塞由 timeout 决定
         // timeout = -1: 阻塞
         // timeout = 0: 立即返回
         // timeout > 0: 等待 timeout 毫秒后返回
-        int nfds = epoll_wait(_epollfd, _events, MAX_POLLER_SIZE, -1);
+        int nfds = epoll_wait(_epollfd, _events, MAX_POLLER_SIZE, timeout);
         if(nfds < 0){
+            if(errno == EINTR){
+                return;
+            }
             ERR_LOG("epoll_wait error");
             exit(1);
         }
@@ -686,95 +816,495 @@ public:
 };
 
 
+// 单调时钟，单位微秒
+inline uint64_t MonotonicUs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
 using TaskFunc = std::function<void()>;
-using ReleaseFunc = std::function<void()>;
+
+// 分层时间轮的参数：第 0 层 256 个槽，每个槽一个 tick；其余每层 64 个槽，每个槽覆盖下一层一整圈
+// 共 5 层，可直接表示 2^32 个 tick 之内的定时器，更远的定时器先放在最高层，级联时再按真实到期时间重新放置
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_LEVELS 5
+// 默认 tick 粒度（毫秒）
+#define DEFAULT_TIMER_TICK_MS 10
+
+class TimerList;
+
+// 定时器节点，可以嵌入到拥有它的对象中（如连接的空闲超时），也可以由 TimerWheel 从节点池中分配
+// 节点自带链表指针，挂入、摘除和刷新都不需要分配内存
 class TimerTask
 {
     using TaskFunc = std::function<void()>;
-    using ReleaseFunc = std::function<void()>;
+    friend class TimerList;
+    friend class TimingWheel;
+    friend class TimerWheel;
 private:
     uint64_t _id;
-    uint32_t _timeout;
-    bool _isCanceled;
+    uint64_t _timeout;      // 超时时间（毫秒）
+    uint64_t _expire;       // 到期的 tick
+    uint64_t _linkedExpire; // 挂入时间轮时使用的到期 tick，刷新只推迟 _expire，到达该槽时再按 _expire 重新挂入
+    bool _owned;            // 由 TimerWheel 的节点池管理
+    bool _handle;           // 通过句柄管理（RunAt/RunAfter/RunEvery），此时 _timeout 为重复间隔，0 表示只执行一次
     TaskFunc _taskFunc;
-    ReleaseFunc _releaseFunc;
+    // 所在的槽和链表指针
+    TimerList* _slot;
+    TimerTask* _prev;
+    TimerTask* _next;
 public:
-    TimerTask(uint64_t id, int timeout, const TaskFunc &taskFunc)
+    TimerTask(uint64_t id = 0, uint64_t timeout = 0, const TaskFunc &taskFunc = TaskFunc())
         : _id(id),
           _timeout(timeout),
+          _expire(0),
+          _linkedExpire(0),
+          _owned(false),
+          _handle(false),
           _taskFunc(taskFunc),
-          _isCanceled(false)
+          _slot(nullptr),
+          _prev(nullptr),
+          _next(nullptr)
     {}
 
-    ~TimerTask()
+    // 节点地址记录在时间轮中，不允许拷贝
+    TimerTask(const TimerTask&) = delete;
+    TimerTask& operator=(const TimerTask&) = delete;
+
+    ~TimerTask(){
+        assert(_slot == nullptr);
+    }
+
+    void Run()
     {
-        if (_taskFunc && !_isCanceled) { _taskFunc(); }
-        if (_releaseFunc) { _releaseFunc(); }
+        if (_taskFunc) { _taskFunc(); }
     }
 
     void SetTaskFunc(const TaskFunc &taskFunc) { _taskFunc = taskFunc; }
-    void SetReleaseFunc(const ReleaseFunc &releaseFunc) { _releaseFunc = releaseFunc; }
-    void Cancel() { _isCanceled = true; }
+    void SetTimeout(uint64_t timeout) { _timeout = timeout; }
+    void SetExpire(uint64_t expire) { _expire = expire; }
     uint64_t GetID() const { return _id; }
-    uint32_t GetTimeout() const { return _timeout; }
+    uint64_t GetTimeout() const { return _timeout; }
+    uint64_t GetExpire() const { return _expire; }
+    bool IsLinked() const { return _slot != nullptr; }
+};
+
+// 时间轮的槽：由定时器节点串成的侵入式双向链表
+class TimerList
+{
+private:
+    TimerTask* _Head;
+    TimerTask* _Tail;
+public:
+    TimerList(): _Head(nullptr), _Tail(nullptr) {}
+    TimerList(const TimerList&) = delete;
+    TimerList& operator=(const TimerList&) = delete;
+
+    bool Empty() const { return _Head == nullptr; }
+
+    void PushBack(TimerTask* node){
+        node->_slot = this;
+        node->_prev = _Tail;
+        node->_next = nullptr;
+        if(_Tail){
+            _Tail->_next = node;
+        }
+        else{
+            _Head = node;
+        }
+        _Tail = node;
+    }
+
+    void Erase(TimerTask* node){
+        assert(node->_slot == this);
+        if(node->_prev){
+            node->_prev->_next = node->_next;
+        }
+        else{
+            _Head = node->_next;
+        }
+        if(node->_next){
+            node->_next->_prev = node->_prev;
+        }
+        else{
+            _Tail = node->_prev;
+        }
+        node->_slot = nullptr;
+        node->_prev = node->_next = nullptr;
+    }
+
+    TimerTask* PopFront(){
+        TimerTask* node = _Head;
+        if(node){
+            Erase(node);
+        }
+        return node;
+    }
+
+    // 把整条链表移到 other（other 须为空），节点的所属槽随之更新
+    void MoveTo(TimerList& other){
+        assert(other.Empty());
+        for(TimerTask* node = _Head; node; node = node->_next){
+            node->_slot = &other;
+        }
+        other._Head = _Head;
+        other._Tail = _Tail;
+        _Head = _Tail = nullptr;
+    }
+};
+
+
+// 分层时间轮，只负责定时器的组织和到期判定，不涉及描述符和事件循环
+// 添加、删除都是 O(1)；高层的定时器在低层转完一圈时才向下级联，每个定时器最多级联 WHEEL_LEVELS - 1 次
+// 时间轮不持有节点，节点在挂入期间必须保持有效
+class TimingWheel
+{
+    static const uint64_t ROOT_SIZE  = 1ULL << WHEEL_ROOT_BITS;
+    static const uint64_t ROOT_MASK  = ROOT_SIZE - 1;
+    static const uint64_t LEVEL_SIZE = 1ULL << WHEEL_LEVEL_BITS;
+    static const uint64_t LEVEL_MASK = LEVEL_SIZE - 1;
+    static const uint64_t MAX_DELTA  = (1ULL << (WHEEL_ROOT_BITS + (WHEEL_LEVELS - 1) * WHEEL_LEVEL_BITS)) - 1;
+
+private:
+    std::vector<TimerList> _Root;
+    std::vector<std::vector<TimerList>> _Levels;
+    // 当前 tick 中待执行的节点，执行期间被取消的节点会从这里摘除
+    TimerList _Pending;
+    uint64_t _Current; // 下一个要处理的 tick
+    size_t _Size;
+    // 缓存的最早到期 tick，添加和推进时失效；删除只会让它偏早，不需要失效
+    uint64_t _NextTick;
+    bool _NextValid;
+
+private:
+    // 根据到期时间和当前 tick 选择槽
+    TimerList* SlotOf(uint64_t expire){
+        if(expire < _Current){
+            // 已经过期的定时器在下一个 tick 处理
+            return &_Root[_Current & ROOT_MASK];
+        }
+        uint64_t delta = expire - _Current;
+        if(delta < ROOT_SIZE){
+            return &_Root[expire & ROOT_MASK];
+        }
+        if(delta > MAX_DELTA){
+            expire = _Current + MAX_DELTA;
+            delta = MAX_DELTA;
+        }
+        for(int level = 1; level < WHEEL_LEVELS; ++level){
+            int shift = WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS;
+            if(delta < (1ULL << shift) || level == WHEEL_LEVELS - 1){
+                return &_Levels[level - 1][(expire >> (shift - WHEEL_LEVEL_BITS)) & LEVEL_MASK];
+            }
+        }
+        return nullptr;
+    }
+
+    void Link(TimerTask* timer){
+        timer->_linkedExpire = timer->_expire;
+        SlotOf(timer->_expire)->PushBack(timer);
+        _NextValid = false;
+    }
+
+    // 把高层一个槽中的定时器按到期时间重新放置到更低的层
+    void Cascade(TimerList& slot){
+        TimerList list;
+        slot.MoveTo(list);
+        while(TimerTask* timer = list.PopFront()){
+            Link(timer);
+        }
+    }
+
+public:
+    TimingWheel(uint64_t current = 0)
+        :_Root(ROOT_SIZE)
+        ,_Levels(WHEEL_LEVELS - 1)
+        ,_Current(current)
+        ,_Size(0)
+        ,_NextTick(0)
+        ,_NextValid(false)
+    {
+        for(auto& level : _Levels){
+            level = std::vector<TimerList>(LEVEL_SIZE);
+        }
+    }
+
+    // 摘下仍挂在时间轮上的节点，嵌入在其他对象中的节点可能比时间轮活得更久
+    ~TimingWheel(){
+        for(auto& slot : _Root){
+            while(slot.PopFront());
+        }
+        for(auto& level : _Levels){
+            for(auto& slot : level){
+                while(slot.PopFront());
+            }
+        }
+        while(_Pending.PopFront());
+    }
+
+    uint64_t Current() const { return _Current; }
+    size_t Size() const { return _Size; }
+
+    // 最早需要处理的 tick，没有定时器时返回 false
+    // 高层的定时器以所在槽的级联时刻为准，结果可能早于真实的到期时间，但不会晚于
+    bool NextTick(uint64_t& tick){
+        if(_Size == 0){
+            return false;
+        }
+        if(_NextValid){
+            tick = _NextTick;
+            return true;
+        }
+        uint64_t next = UINT64_MAX;
+        for(uint64_t i = 0; i < ROOT_SIZE; ++i){
+            if(!_Root[(_Current + i) & ROOT_MASK].Empty()){
+                next = _Current + i;
+                break;
+            }
+        }
+        for(int level = 1; level < WHEEL_LEVELS; ++level){
+            int shift = WHEEL_ROOT_BITS + (level - 1) * WHEEL_LEVEL_BITS;
+            uint64_t base = _Current >> shift;
+            // _Current 恰好在本层的边界上时，处理 _Current 时就会级联当前槽
+            uint64_t first = (_Current & ((1ULL << shift) - 1)) == 0 ? 0 : 1;
+            for(uint64_t k = first; k <= LEVEL_SIZE; ++k){
+                if(((base + k) << shift) >= next){
+                    // 不会早于已经找到的 tick，不必继续查找
+                    break;
+                }
+                if(!_Levels[level - 1][(base + k) & LEVEL_MASK].Empty()){
+                    next = std::min(next, (base + k) << shift);
+                    break;
+                }
+            }
+        }
+        _NextTick = next;
+        _NextValid = true;
+        tick = next;
+        return true;
+    }
+
+    // 按定时器的到期 tick 放入时间轮
+    void Add(TimerTask* timer){
+        assert(!timer->IsLinked());
+        Link(timer);
+        ++_Size;
+    }
+
+    void Remove(TimerTask* timer){
+        if(!timer->IsLinked()){
+            return;
+        }
+        timer->_slot->Erase(timer);
+        --_Size;
+    }
+
+    // 修改到期时间：推迟时只记录新的到期 tick，不移动节点；提前时重新挂入
+    void Update(TimerTask* timer, uint64_t expire){
+        if(timer->IsLinked() && expire >= timer->_linkedExpire){
+            timer->_expire = expire;
+            return;
+        }
+        Remove(timer);
+        timer->_expire = expire;
+        Add(timer);
+    }
+
+    // 推进 ticks 个 tick，按顺序对到期的定时器调用 handler
+    // handler 中可以添加、取消其他定时器，也可以释放当前节点
+    // 没有槽要处理、也没有级联的 tick 直接跳过，长时间休眠后追赶的开销与经过的 tick 数无关
+    template <typename Handler>
+    void Advance(uint64_t ticks, Handler&& handler){
+        uint64_t target = _Current + ticks;
+        while(_Current < target){
+            if(_Size == 0){
+                _Current = target;
+                _NextValid = false;
+                break;
+            }
+            uint64_t next;
+            if(_Root[_Current & ROOT_MASK].Empty() && NextTick(next) && next > _Current){
+                // 跳到最早的非空槽或级联时刻，中间的 tick 没有任何定时器
+                // 缓存的 next 是绝对 tick，跳过后仍然有效
+                _Current = std::min(next, target);
+                if(_Current == target){
+                    break;
+                }
+            }
+            uint64_t tick = _Current;
+            uint64_t idx = tick & ROOT_MASK;
+            if(idx == 0){
+                // 第 0 层转完一圈，逐层向下级联，直到某一层没有转完一圈
+                for(int level = 1; level < WHEEL_LEVELS; ++level){
+                    uint64_t slot = (tick >> (WHEEL_ROOT_BITS + (level - 1) * WHEEL_LEVEL_BITS)) & LEVEL_MASK;
+                    Cascade(_Levels[level - 1][slot]);
+                    if(slot != 0){
+                        break;
+                    }
+                }
+            }
+            _Root[idx].MoveTo(_Pending);
+            ++_Current;
+            _NextValid = false;
+            while(TimerTask* timer = _Pending.PopFront()){
+                if(timer->_expire > tick){
+                    // 刷新过的定时器还没到期，按新的到期时间重新挂入
+                    Link(timer);
+                    continue;
+                }
+                --_Size;
+                handler(timer);
+            }
+        }
+    }
 };
 
 
+// 事件循环中的定时器模块：用 timerfd 按 tick 驱动分层时间轮
+// RunAt/RunAfter/RunEvery 返回的定时器句柄，用于取消定时器
+// 句柄的编号独立于 TimerAdd 使用的 id，由所属事件循环分配
+// 句柄存在期间计入所属循环的引用（EventLoop::Pin），线程池不会回收该循环
+class TimerHandle
+{
+    friend class TimerWheel;
+private:
+    uint64_t _Id;
+    EventLoop* _Loop;
+    TimerHandle(uint64_t id, EventLoop* loop);
+public:
+    TimerHandle(): _Id(0), _Loop(nullptr) {}
+    TimerHandle(const TimerHandle& other);
+    TimerHandle& operator=(const TimerHandle& other);
+    ~TimerHandle();
+    bool Valid() const { return _Id != 0; }
+    EventLoop* GetLoop() const { return _Loop; }
+};
+
+// 节点池最多缓存的空闲节点数
+#define TIMER_NODE_POOL_MAX 4096
 
 class TimerWheel
 {
-    using WeakTask   = std::weak_ptr<TimerTask>;
-    using TimerMap   = std::unordered_map<uint64_t, WeakTask>;
-    using TimerSet   = std::unordered_set<uint64_t>;
-    using SharedPtr  = std::shared_ptr<TimerTask>;
-    using TaskList   = std::list<SharedPtr>;
-    using Wheel      = std::vector<TaskList>;
+    using TimerMap = std::unordered_map<uint64_t, TimerTask*>;
 
 private:
-    int _Capacity;
-    int _Tick;
-    Wheel _Wheel;
+    uint32_t _TickMs;
+    uint64_t _StartUs;
+    TimingWheel _Wheel;
+    // 按 id 管理的定时器，节点从节点池中分配
     TimerMap _TimerMap;
+    std::vector<TimerTask*> _FreeNodes;
+    // 按句柄管理的定时器
+    TimerMap _HandleMap;
+    std::atomic<uint64_t> _NextHandle;
 
     EventLoop *_Loop;
-    // 定时器描述符
-    int _Timerfd; 
+    // 无节拍模式：不使用定时器描述符，由事件循环按最早的到期时间设置 epoll_wait 超时
+    bool _Tickless;
+    // 定时器描述符，无节拍模式下为 -1
+    int _Timerfd;
     std::unique_ptr<Channel> _TimerChannel;
 
 private:
-    static int CreateTimerfd();
+    static int CreateTimerfd(uint32_t tickMs);
     int ReadTimerfd();
-    void AddTimer(const SharedPtr &timer);
+    // 毫秒换算为 tick，向上取整
+    uint64_t ToTicks(uint64_t ms) const { return (ms + _TickMs - 1) / _TickMs; }
+    // 按单调时钟计算已经走过的 tick 数，时间轮据此推进，不依赖 timerfd 的触发次数，
+    // 事件循环繁忙导致 timerfd 事件延后处理时也不会累积误差
+    uint64_t NowTick() const { return (MonotonicUs() - _StartUs) / (_TickMs * 1000ULL); }
+    TimerTask* AllocNode(uint64_t id, uint64_t timeout, const TaskFunc &cb);
+    void FreeNode(TimerTask* node);
     void RemoveTimer(uint64_t id);
-    void RunOntimeTask();
+    void ExpireTimer(TimerTask* node);
+    void RunOntimeTask(uint64_t ticks);
     void OnTimerTask();
-    void TimerAddInLoop(uint64_t id, uint32_t delay, const TaskFunc &cb);
+    void TimerAddInLoop(uint64_t id, uint64_t delayMs, const TaskFunc &cb);
     void TimerRefreshInLoop(uint64_t id);
     void TimerCancelInLoop(uint64_t id);
+    // 绝对时间（MonotonicUs）换算为到期 tick，在该 tick 结束时执行，不会早于指定时间
+    uint64_t TickOf(uint64_t whenUs) const;
+    void RunAtInLoop(uint64_t id, uint64_t whenUs, uint32_t intervalMs, const TaskFunc &cb);
+    void CancelHandleInLoop(uint64_t id, bool retry);
 
 public:
-    TimerWheel(EventLoop *Loop)
-        : _Capacity(60),
-          _Tick(0),
-          _Wheel(_Capacity),
+    TimerWheel(EventLoop *Loop, uint32_t tickMs = DEFAULT_TIMER_TICK_MS, bool tickless = true)
+        : _TickMs(tickMs > 0 ? tickMs : 1),
+          _StartUs(MonotonicUs()),
+          _NextHandle(0),
           _Loop(Loop),
-          _Timerfd(CreateTimerfd()),
-          _TimerChannel(new Channel(Loop, _Timerfd))
+          _Tickless(tickless),
+          _Timerfd(-1)
     {
-        _TimerChannel->SetReadCallback(std::bind(&TimerWheel::OnTimerTask, this));
-        _TimerChannel->EnableRead();
+        if(!_Tickless){
+            _Timerfd = CreateTimerfd(_TickMs);
+            _TimerChannel.reset(new Channel(Loop, _Timerfd));
+            _TimerChannel->SetReadCallback(std::bind(&TimerWheel::OnTimerTask, this));
+            _TimerChannel->EnableRead();
+        }
+    }
+
+    // 事件循环退出时不再执行尚未到期的任务
+    ~TimerWheel(){
+        for(auto& item : _TimerMap){
+            _Wheel.Remove(item.second);
+            delete item.second;
+        }
+        for(auto& item : _HandleMap){
+            _Wheel.Remove(item.second);
+            delete item.second;
+        }
+        for(TimerTask* node : _FreeNodes){
+            delete node;
+        }
+        if(_Timerfd >= 0){
+            close(_Timerfd);
+        }
     }
 
+    // delay 单位为秒
     void TimerAdd(uint64_t id, uint32_t delay, const TaskFunc &cb);
+    void TimerAddMs(uint64_t id, uint64_t delayMs, const TaskFunc &cb);
     void TimerRefresh(uint64_t id);
     void TimerCancel(uint64_t id);
 
+    // 嵌入式节点：由调用者持有，只能在所属事件循环线程中调用
+    // 节点未挂入时挂入，已挂入时只推迟到期时间，都不分配内存；节点销毁前必须先摘除
+    void Schedule(TimerTask* node, uint64_t delayMs);
+    void Unschedule(TimerTask* node);
+
+    // 可以在任意线程调用，任务在所属事件循环线程中执行
+    // whenUs 为 MonotonicUs 时间；intervalMs 非 0 时从到期时刻起按该间隔重复执行，直到取消
+    TimerHandle RunAt(uint64_t whenUs, uint32_t intervalMs, const TaskFunc &cb);
+    void Cancel(const TimerHandle &handle);
+
     bool HasTimer(uint64_t id){
         return _TimerMap.find(id) != _TimerMap.end();
     }
+
+    // 时间轮中的定时器数量，包括嵌入式节点
+    size_t Size() const{
+        return _Wheel.Size();
+    }
+
+    uint32_t GetTickMs() const{
+        return _TickMs;
+    }
+
+    bool IsTickless() const{
+        return _Tickless;
+    }
+
+    // 距最早到期时间的毫秒数，作为 epoll_wait 的超时；没有定时器时返回 -1
+    int NextTimeout();
+    // 执行所有已到期的定时器，无节拍模式下由事件循环每轮调用
+    void RunExpired();
 };
 
-int TimerWheel::CreateTimerfd()
+int TimerWheel::CreateTimerfd(uint32_t tickMs)
 {
     int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
     if (timer_fd < 0){
@@ -783,10 +1313,9 @@ int TimerWheel::CreateTimerfd()
     }
 
     struct itimerspec new_value;
-    new_value.it_value.tv_sec = 1;
-    new_value.it_value.tv_nsec = 0;
-    new_value.it_interval.tv_sec = 1;
-    new_value.it_interval.tv_nsec = 0;
+    new_value.it_value.tv_sec = tickMs / 1000;
+    new_value.it_value.tv_nsec = (tickMs % 1000) * 1000000;
+    new_value.it_interval = new_value.it_value;
     timerfd_settime(timer_fd, 0, &new_value, nullptr);
     return timer_fd;
 }
@@ -796,158 +1325,663 @@ int TimerWheel::ReadTimerfd()
     uint64_t times;
     ssize_t n = read(_Timerfd, &times, sizeof(times));
     if (n != sizeof(times)){
+        if (errno == EAGAIN || errno == EINTR){
+            return 0;
+        }
         perror("read timerfd error");
         exit(1);
     }
     return times;
 }
 
-void TimerWheel::AddTimer(const SharedPtr &timer){
-    int timeout = timer->GetTimeout();
-    int index = (_Tick + timeout) % _Capacity;
-    _Wheel[index].push_back(timer);
-    _TimerMap[timer->GetID()] = timer;
+TimerTask* TimerWheel::AllocNode(uint64_t id, uint64_t timeout, const TaskFunc &cb){
+    TimerTask* node;
+    if(_FreeNodes.empty()){
+        node = new TimerTask(id, timeout, cb);
+    }
+    else{
+        node = _FreeNodes.back();
+        _FreeNodes.pop_back();
+        node->_id = id;
+        node->_timeout = timeout;
+        node->_taskFunc = cb;
+    }
+    node->_owned = true;
+    node->_handle = false;
+    return node;
+}
+
+void TimerWheel::FreeNode(TimerTask* node){
+    if(_FreeNodes.size() >= TIMER_NODE_POOL_MAX){
+        delete node;
+        return;
+    }
+    node->_taskFunc = nullptr;
+    _FreeNodes.push_back(node);
 }
 
 void TimerWheel::RemoveTimer(uint64_t id){
     auto iter = _TimerMap.find(id);
     if (iter != _TimerMap.end()){
+        TimerTask* node = iter->second;
         _TimerMap.erase(iter);
+        _Wheel.Remove(node);
+        FreeNode(node);
+    }
+}
+
+void TimerWheel::ExpireTimer(TimerTask* node){
+    if(!node->_owned){
+        // 嵌入式节点，任务中可能释放节点所在的对象
+        return node->Run();
+    }
+    if(node->_handle && node->_timeout > 0){
+        // 重复执行的定时器先按间隔重新挂入，任务中可以取消自己，因此执行的是任务的副本
+        node->SetExpire(std::max(node->GetExpire() + ToTicks(node->_timeout), _Wheel.Current()));
+        _Wheel.Add(node);
+        TaskFunc cb = node->_taskFunc;
+        return cb();
+    }
+    // 先归还节点再执行，任务中可以安全地添加、刷新或取消定时器
+    TaskFunc cb = std::move(node->_taskFunc);
+    if(node->_handle){
+        _HandleMap.erase(node->_id);
+    }
+    else{
+        _TimerMap.erase(node->_id);
+    }
+    FreeNode(node);
+    if(cb){
+        cb();
     }
 }
 
-void TimerWheel::RunOntimeTask(){
-    _Tick = (_Tick + 1) % _Capacity;
-    _Wheel[_Tick].clear();
+void TimerWheel::RunOntimeTask(uint64_t ticks){
+    _Wheel.Advance(ticks, [this](TimerTask* node){ ExpireTimer(node); });
 }
 
 void TimerWheel::OnTimerTask(){
-    int times = ReadTimerfd();
-    for(int i = 0; i < times; i++){
-        RunOntimeTask();
+    ReadTimerfd();
+    RunExpired();
+}
+
+void TimerWheel::RunExpired(){
+    uint64_t now = NowTick();
+    if(now > _Wheel.Current()){
+        RunOntimeTask(now - _Wheel.Current());
     }
 }
 
-void TimerWheel::TimerAddInLoop(uint64_t id, uint32_t delay, const TaskFunc &cb){
-    SharedPtr pt(new TimerTask(id, delay, cb));
-    pt->SetReleaseFunc(std::bind(&TimerWheel::RemoveTimer, this, id));
+int TimerWheel::NextTimeout(){
+    uint64_t tick;
+    if(!_Wheel.NextTick(tick)){
+        return -1;
+    }
+    // 第 tick 个 tick 结束时处理
+    uint64_t deadline = _StartUs + (tick + 1) * _TickMs * 1000ULL;
+    uint64_t now = MonotonicUs();
+    if(deadline <= now){
+        return 0;
+    }
+    uint64_t timeout = (deadline - now + 999) / 1000;
+    return timeout > INT_MAX ? INT_MAX : (int)timeout;
+}
 
-    int newPos = (_Tick + delay) % _Capacity;
-    _Wheel[newPos].push_back(pt);
-    _TimerMap[id] = WeakTask(pt);
+void TimerWheel::TimerAddInLoop(uint64_t id, uint64_t delayMs, const TaskFunc &cb){
+    // 同一 id 重复添加时替换旧的定时器
+    RemoveTimer(id);
+    TimerTask* node = AllocNode(id, delayMs, cb);
+    node->SetExpire(NowTick() + ToTicks(delayMs));
+    _Wheel.Add(node);
+    _TimerMap[id] = node;
 }
 
 void TimerWheel::TimerRefreshInLoop(uint64_t id){
     auto iter = _TimerMap.find(id);
     if(iter == _TimerMap.end()) return;
-    SharedPtr pt = iter->second.lock();
-    int delay = pt->GetTimeout();
-    int new_pos = (delay + _Tick) % _Capacity;
-    _Wheel[new_pos].push_back(pt); 
+    TimerTask* node = iter->second;
+    _Wheel.Update(node, NowTick() + ToTicks(node->GetTimeout()));
 }
 
 void TimerWheel::TimerCancelInLoop(uint64_t id){
-    auto it = _TimerMap.find(id);
-    if(it == _TimerMap.end()){
-        return;
-    }
-    SharedPtr pt = it->second.lock();
-    if (pt){
-        pt->Cancel();
+    RemoveTimer(id);
+}
+
+uint64_t TimerWheel::TickOf(uint64_t whenUs) const{
+    uint64_t tickUs = _TickMs * 1000ULL;
+    if(whenUs <= _StartUs + tickUs){
+        return 0;
     }
+    return (whenUs - _StartUs + tickUs - 1) / tickUs - 1;
+}
+
+void TimerWheel::RunAtInLoop(uint64_t id, uint64_t whenUs, uint32_t intervalMs, const TaskFunc &cb){
+    TimerTask* node = AllocNode(id, intervalMs, cb);
+    node->_handle = true;
+    node->SetExpire(TickOf(whenUs));
+    _Wheel.Add(node);
+    _HandleMap[id] = node;
 }
 
 
-class EventLoop
+
+// 对象池最多缓存的空闲内存块和缓冲区存储数量，以及可回收的缓冲区存储上限
+#define SLOT_POOL_MAX_FREE 1024
+#define SLOT_POOL_MAX_BUFFER (64 * 1024)
+
+// 固定大小内存块的对象池，每个事件循环一个，用于连接对象
+// 配合 PoolAllocator 和 std::allocate_shared，连接对象和控制块来自同一个回收的内存块
+// 同时回收连接缓冲区的底层存储，新连接直接使用，不必重新分配
+// 连接可能在其他线程释放，空闲链表由互斥锁保护，锁内只有 vector 的压入弹出
+class SlotPool
 {
-    using Functor = std::function<void()>;
 private:
-    int _EventFd;
-    std::thread::id _ThreadID; // 线程ID
-    TimerWheel _TimerWheel; // 定时器模块
-    std::unique_ptr<Channel> _EventChannel; // 管理和处理文件描述符上的事件
-    Poller _Poller; // 文件描述符监控
-    std::vector<Functor> _Tasks; // 任务池
     std::mutex _Mutex;
+    size_t _SlotSize;
+    std::vector<void*> _FreeSlots;
+    std::vector<std::vector<char>> _FreeBuffers;
+    std::atomic<uint64_t> _Allocated;
+    std::atomic<uint64_t> _Reused;
 
 public:
-    void RunAllTask(){
-        // 为什么不直接在加锁状态下直接执行_tasks内的任务，而使用swap函数？
-        // 1. 会长时间持有锁，导致程序整体的执行效率下降；
-        // 2. swap函数高效且不增加内存开销，本质上是常数时间的操作；
-        // 3. 将任务队列的执行和管理解耦，保证二者之间的独立性
-        std::vector<Functor> _TempFunctor;
-        {
-            std::lock_guard lk(_Mutex);
-            _Tasks.swap(_TempFunctor);
-        }
-        // 在临时函数容器中执行任务队列
-        for(auto &func : _TempFunctor){
-            func();
+    SlotPool(): _SlotSize(0), _Allocated(0), _Reused(0) {}
+
+    ~SlotPool(){
+        for(void* slot : _FreeSlots){
+            ::operator delete(slot);
         }
-        return;
     }
 
-    static int CreateEventFd(){
-        int EventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
-        if(EventFd < 0){
-            ERR_LOG("CREATE EVENTFD ERROR");
-            std::abort();
+    // 第一次分配时确定块大小，其他大小的请求直接向系统申请
+    void* Allocate(size_t size){
+        {
+            std::unique_lock<std::mutex> lock(_Mutex);
+            if(_SlotSize == 0){
+                _SlotSize = size;
+            }
+            if(size == _SlotSize && !_FreeSlots.empty()){
+                void* slot = _FreeSlots.back();
+                _FreeSlots.pop_back();
+                _Reused.fetch_add(1, std::memory_order_relaxed);
+                return slot;
+            }
         }
-        return EventFd;
+        _Allocated.fetch_add(1, std::memory_order_relaxed);
+        return ::operator new(size);
     }
 
-    void ReadEventFd(){
-        uint64_t res = 0;
-        int ret = read(_EventFd, &res, sizeof(res));
-        if(ret < 0){
-            if(errno == EINTR || errno == EAGAIN){
+    void Deallocate(void* slot, size_t size){
+        {
+            std::unique_lock<std::mutex> lock(_Mutex);
+            if(size == _SlotSize && _FreeSlots.size() < SLOT_POOL_MAX_FREE){
+                _FreeSlots.push_back(slot);
                 return;
             }
-            ERR_LOG("READ EVENTFD ERROR");
-            std::abort();
         }
-        return;
+        ::operator delete(slot);
     }
 
-    void WakeUpEventFd(){
-        uint64_t val = 1;
-        int ret = write(_EventFd, &val, sizeof(val));
-        if(ret < 0){
-            if(errno == EINTR){
-                return;
-            }
-            ERR_LOG("WRITE VAL ERROR");
-            std::abort();
+    std::vector<char> TakeBuffer(){
+        std::unique_lock<std::mutex> lock(_Mutex);
+        if(_FreeBuffers.empty()){
+            return std::vector<char>();
         }
-        return;
+        std::vector<char> storage = std::move(_FreeBuffers.back());
+        _FreeBuffers.pop_back();
+        return storage;
     }
-public:
-    EventLoop()
-        :_ThreadID(std::this_thread::get_id()),
-        _EventFd(CreateEventFd()),
-        _EventChannel(new Channel(this, _EventFd)),
-        _TimerWheel(this)
-    {
-        _EventChannel->SetReadCallback(std::bind(&EventLoop::ReadEventFd, this));
-        _EventChannel->EnableRead();
+
+    // 过大的存储不回收，避免个别大消息长期占用内存
+    void ReturnBuffer(std::vector<char>&& storage){
+        if(storage.empty() || storage.size() > SLOT_POOL_MAX_BUFFER){
+            return;
+        }
+        std::unique_lock<std::mutex> lock(_Mutex);
+        if(_FreeBuffers.size() < SLOT_POOL_MAX_FREE){
+            _FreeBuffers.push_back(std::move(storage));
+        }
     }
 
-    void Start(){
-        for(;;){
-            std::vector<Channel*> Activities;
-            _Poller.Poll(Activities);
+    // 向系统申请的次数和复用的次数
+    uint64_t GetAllocated() const { return _Allocated.load(std::memory_order_relaxed); }
+    uint64_t GetReused() const { return _Reused.load(std::memory_order_relaxed); }
+};
 
-            for(auto &channel : Activities){
-                channel->HandleEvent();
-            }
+// 从 SlotPool 分配单个对象的分配器，只用于 std::allocate_shared
+// 分配器保存在控制块中，对象池在最后一个对象释放前不会销毁，即使所属事件循环已经退出
+template <typename T>
+class PoolAllocator
+{
+    template <typename U> friend class PoolAllocator;
+private:
+    std::shared_ptr<SlotPool> _Pool;
+public:
+    using value_type = T;
 
-            RunAllTask();
+    explicit PoolAllocator(const std::shared_ptr<SlotPool>& pool): _Pool(pool) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other): _Pool(other._Pool) {}
+
+    T* allocate(size_t n){
+        if(n != 1 || !_Pool){
+            return static_cast<T*>(::operator new(n * sizeof(T)));
         }
+        return static_cast<T*>(_Pool->Allocate(sizeof(T)));
     }
 
-    bool IsInLoop(){
-        return (_ThreadID == std::this_thread::get_id());
+    void deallocate(T* p, size_t n){
+        if(n != 1 || !_Pool){
+            return ::operator delete(p);
+        }
+        _Pool->Deallocate(p, sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return _Pool == other._Pool; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const { return _Pool != other._Pool; }
+};
+
+// 以 2 的幂划分区间的直方图
+// 第 i 个桶统计落在 [2^(i-1), 2^i) 内的样本，0 落在第 0 个桶，超出范围的样本计入最后一个桶
+// 只由所属事件循环线程写入，任意线程可无锁读取
+class Histogram
+{
+public:
+    static const int BUCKETS = 24;
+private:
+    std::atomic<uint64_t> _Buckets[BUCKETS];
+public:
+    Histogram(){
+        for(auto &bucket : _Buckets){
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static int BucketOf(uint64_t value){
+        int idx = value == 0 ? 0 : 64 - __builtin_clzll(value);
+        return idx < BUCKETS ? idx : BUCKETS - 1;
+    }
+
+    void Record(uint64_t value){
+        std::atomic<uint64_t> &bucket = _Buckets[BucketOf(value)];
+        // 单写者，不需要原子的读-改-写
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void Load(uint64_t out[BUCKETS]) const{
+        for(int i = 0; i < BUCKETS; ++i){
+            out[i] = _Buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+// 事件循环运行统计的快照，各字段分别读取，彼此之间不保证严格一致
+struct LoopStatsSnapshot
+{
+    uint64_t Iterations;      // 循环轮数（即 epoll_wait 返回次数）
+    uint64_t WaitUs;          // 阻塞在 epoll_wait 中的累计时间
+    uint64_t BusyUs;          // 处理事件和任务的累计时间
+    uint64_t LagUs;           // 单轮处理耗时的滑动平均，即新事件最多需要等待的时间
+    uint64_t MaxLagUs;        // 单轮处理耗时的最大值
+    uint32_t BusyPermille;    // 最近的忙碌比例（千分比，滑动平均）
+    uint64_t TasksRun;        // 任务池中执行过的任务总数
+    uint64_t QueuedTasks;     // 当前等待执行的任务数
+    uint64_t MaxQueuedTasks;  // 等待执行任务数的最大值
+    uint64_t DeferredTasks;   // 当前等待执行的延迟任务数
+    uint64_t Timers;          // 时间轮中的定时器数量
+    uint64_t Connections;     // 当前连接数
+    uint64_t BytesIn;         // 累计接收字节数
+    uint64_t BytesOut;        // 累计发送字节数
+    uint64_t ReadTimeouts;    // 读超时次数（未在期限内收完一条消息）
+    uint64_t WriteTimeouts;   // 写超时次数（未在期限内发完输出缓冲区）
+    uint64_t IdleTimeouts;    // 空闲超时次数
+    uint64_t DeferredReads;   // 因读取预算用完而推迟的读事件数
+    uint64_t Writes;          // 发送数据的系统调用次数
+    uint64_t EventUpdates;    // 修改事件监控的 epoll_ctl 调用次数
+    uint64_t ShedRequests;    // 过载时交给过载回调、没有正常处理的消息数
+    uint64_t EventsHist[Histogram::BUCKETS];  // 每轮就绪事件数分布
+    uint64_t TasksHist[Histogram::BUCKETS];   // 每次 RunAllTask 执行任务数分布
+    uint64_t BusyUsHist[Histogram::BUCKETS];  // 每轮处理耗时分布（微秒）
+};
+
+// 事件循环运行统计
+// 计数器常开，由所属事件循环线程写入（排队任务数由投递任务的线程在锁内写入，连接数原子加减）
+// 所有字段都是 relaxed 原子变量，任意线程可以通过 Snapshot 无锁读取
+class LoopStats
+{
+    using Counter = std::atomic<uint64_t>;
+private:
+    Counter _Iterations;
+    Counter _WaitUs;
+    Counter _BusyUs;
+    Counter _LagUs;
+    Counter _MaxLagUs;
+    std::atomic<uint32_t> _BusyPermille;
+    Counter _TasksRun;
+    Counter _QueuedTasks;
+    Counter _MaxQueuedTasks;
+    Counter _DeferredTasks;
+    Counter _Timers;
+    Counter _Connections;
+    Counter _BytesIn;
+    Counter _BytesOut;
+    Counter _ReadTimeouts;
+    Counter _WriteTimeouts;
+    Counter _IdleTimeouts;
+    Counter _DeferredReads;
+    Counter _Writes;
+    Counter _EventUpdates;
+    Counter _ShedRequests;
+    // 开始等待 epoll_wait 的时间，处理事件期间为 0
+    Counter _WaitSinceUs;
+    Histogram _EventsHist;
+    Histogram _TasksHist;
+    Histogram _BusyUsHist;
+
+private:
+    // 单写者计数器累加
+    static void Add(Counter &counter, uint64_t value){
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+    static uint64_t Get(const Counter &counter){
+        return counter.load(std::memory_order_relaxed);
+    }
+
+public:
+    LoopStats()
+        :_Iterations(0), _WaitUs(0), _BusyUs(0), _LagUs(0), _MaxLagUs(0), _BusyPermille(0),
+        _TasksRun(0), _QueuedTasks(0), _MaxQueuedTasks(0), _DeferredTasks(0), _Timers(0),
+        _Connections(0), _BytesIn(0), _BytesOut(0), _ReadTimeouts(0), _WriteTimeouts(0), _IdleTimeouts(0),
+        _DeferredReads(0), _Writes(0), _EventUpdates(0), _ShedRequests(0),
+        _WaitSinceUs(0)
+    {}
+
+    // 记录一轮循环：等待时间、处理时间和就绪事件数
+    void RecordIteration(uint64_t waitUs, uint64_t busyUs, size_t events){
+        Add(_Iterations, 1);
+        Add(_WaitUs, waitUs);
+        Add(_BusyUs, busyUs);
+        // 滑动平均，权重 1/8
+        uint64_t lag = Get(_LagUs);
+        _LagUs.store(lag - lag / 8 + busyUs / 8, std::memory_order_relaxed);
+        if(busyUs > Get(_MaxLagUs)){
+            _MaxLagUs.store(busyUs, std::memory_order_relaxed);
+        }
+        if(waitUs + busyUs > 0){
+            uint32_t permille = _BusyPermille.load(std::memory_order_relaxed);
+            uint32_t sample = (uint32_t)(busyUs * 1000 / (waitUs + busyUs));
+            _BusyPermille.store(permille - permille / 8 + sample / 8, std::memory_order_relaxed);
+        }
+        _EventsHist.Record(events);
+        _BusyUsHist.Record(busyUs);
+    }
+
+    void RecordTasks(size_t tasks){
+        Add(_TasksRun, tasks);
+        _TasksHist.Record(tasks);
+    }
+
+    // 在任务池的锁内调用
+    void SetQueuedTasks(uint64_t count){
+        _QueuedTasks.store(count, std::memory_order_relaxed);
+        if(count > Get(_MaxQueuedTasks)){
+            _MaxQueuedTasks.store(count, std::memory_order_relaxed);
+        }
+    }
+
+    void SetDeferredTasks(uint64_t count) { _DeferredTasks.store(count, std::memory_order_relaxed); }
+    void SetTimers(uint64_t count)        { _Timers.store(count, std::memory_order_relaxed); }
+    // 连接在分配到事件循环时（主循环线程）计入，释放时（所属线程）移除，因此需要原子加减
+    void AddConnection()                  { _Connections.fetch_add(1, std::memory_order_relaxed); }
+    void RemoveConnection()               { _Connections.fetch_sub(1, std::memory_order_relaxed); }
+    void AddBytesIn(uint64_t len)         { Add(_BytesIn, len); }
+    void AddBytesOut(uint64_t len)        { Add(_BytesOut, len); }
+    void AddReadTimeout()                 { Add(_ReadTimeouts, 1); }
+    void AddWriteTimeout()                { Add(_WriteTimeouts, 1); }
+    void AddIdleTimeout()                 { Add(_IdleTimeouts, 1); }
+    void AddDeferredRead()                { Add(_DeferredReads, 1); }
+    void AddWrite()                       { Add(_Writes, 1); }
+    void AddEventUpdate()                 { Add(_EventUpdates, 1); }
+    void AddShedRequest()                 { Add(_ShedRequests, 1); }
+
+    uint64_t GetConnections() const  { return Get(_Connections); }
+    uint64_t GetLagUs() const        { return Get(_LagUs); }
+    void MarkWaiting(uint64_t nowUs) { _WaitSinceUs.store(nowUs, std::memory_order_relaxed); }
+    void MarkBusy()                  { _WaitSinceUs.store(0, std::memory_order_relaxed); }
+    // 供其他线程判断过载：空闲等待的时间已经超过平均每轮处理耗时，说明最近的延迟已不再成立，返回 0
+    // 否则空闲的循环不再更新统计，最后几轮的高延迟会一直保留
+    uint64_t GetCurrentLagUs(uint64_t nowUs) const{
+        uint64_t lag = Get(_LagUs);
+        uint64_t since = Get(_WaitSinceUs);
+        return (since > 0 && nowUs > since && nowUs - since >= lag) ? 0 : lag;
+    }
+    uint32_t GetBusyPermille() const { return _BusyPermille.load(std::memory_order_relaxed); }
+
+    LoopStatsSnapshot Snapshot() const{
+        LoopStatsSnapshot snap;
+        snap.Iterations = Get(_Iterations);
+        snap.WaitUs = Get(_WaitUs);
+        snap.BusyUs = Get(_BusyUs);
+        snap.LagUs = Get(_LagUs);
+        snap.MaxLagUs = Get(_MaxLagUs);
+        snap.BusyPermille = GetBusyPermille();
+        snap.TasksRun = Get(_TasksRun);
+        snap.QueuedTasks = Get(_QueuedTasks);
+        snap.MaxQueuedTasks = Get(_MaxQueuedTasks);
+        snap.DeferredTasks = Get(_DeferredTasks);
+        snap.Timers = Get(_Timers);
+        snap.Connections = Get(_Connections);
+        snap.BytesIn = Get(_BytesIn);
+        snap.BytesOut = Get(_BytesOut);
+        snap.ReadTimeouts = Get(_ReadTimeouts);
+        snap.WriteTimeouts = Get(_WriteTimeouts);
+        snap.IdleTimeouts = Get(_IdleTimeouts);
+        snap.DeferredReads = Get(_DeferredReads);
+        snap.Writes = Get(_Writes);
+        snap.EventUpdates = Get(_EventUpdates);
+        snap.ShedRequests = Get(_ShedRequests);
+        _EventsHist.Load(snap.EventsHist);
+        _TasksHist.Load(snap.TasksHist);
+        _BusyUsHist.Load(snap.BusyUsHist);
+        return snap;
+    }
+};
+
+
+class Connection;
+using PtrConnection = std::shared_ptr<Connection>;
+
+class EventLoop
+{
+    using Functor = std::function<void()>;
+    // 延迟任务返回 true 表示尚未完成，会在之后的循环中继续执行下一个切片
+    using DeferredFunctor = std::function<bool()>;
+private:
+    std::thread::id _ThreadID; // 线程ID
+    int _EventFd;
+    // 本循环负责的连接，只在本线程访问；放在时间轮之前，析构时连接中的定时器节点已经摘下
+    std::unordered_map<uint64_t, PtrConnection> _Connections;
+    // 本轮写入过数据的连接，在一轮结束时统一发送；两个数组交替使用以复用内存
+    std::vector<PtrConnection> _DirtyConnections;
+    std::vector<PtrConnection> _FlushingConnections;
+    // 每轮结束、统一发送之前执行
+    Functor _BatchEndCallback;
+    // _Poller 必须先于 _EventChannel 和 _TimerWheel 构造，二者在构造时就会注册事件
+    Poller _Poller; // 文件描述符监控
+    std::unique_ptr<Channel> _EventChannel; // 管理和处理文件描述符上的事件
+    TimerWheel _TimerWheel; // 定时器模块
+    std::vector<Functor> _Tasks; // 任务池
+    std::mutex _Mutex;
+    std::deque<DeferredFunctor> _DeferredTasks; // 低优先级延迟任务，只在本线程访问
+    uint64_t _DeferredBudget; // 每轮循环留给延迟任务的时间预算（微秒）
+    uint64_t _ReadBudgetBytes; // 每轮循环的读取预算，为 0 表示不限制
+    uint64_t _ReadBudgetEvents;
+    uint64_t _ReadBytes; // 本轮已读取的字节数和读事件数
+    uint64_t _ReadEvents;
+    uint64_t _ShedLagUs; // 本轮已处理的时间超过该值时视为过载，为 0 表示不检查
+    uint64_t _BusyStartUs; // 本轮 epoll_wait 返回的时间
+    LoopStats _Stats; // 运行统计
+    std::shared_ptr<SlotPool> _ConnectionPool; // 本循环连接对象的对象池
+    std::atomic<bool> _Quit; // 退出事件循环
+    std::atomic<uint64_t> _Pins; // 长期持有本循环指针的对象数，见 Pin
+
+public:
+    void RunAllTask(){
+        // 为什么不直接在加锁状态下直接执行_tasks内的任务，而使用swap函数？
+        // 1. 会长时间持有锁，导致程序整体的执行效率下降；
+        // 2. swap函数高效且不增加内存开销，本质上是常数时间的操作；
+        // 3. 将任务队列的执行和管理解耦，保证二者之间的独立性
+        std::vector<Functor> _TempFunctor;
+        {
+            std::lock_guard lk(_Mutex);
+            _Tasks.swap(_TempFunctor);
+            _Stats.SetQueuedTasks(0);
+        }
+        // 在临时函数容器中执行任务队列
+        for(auto &func : _TempFunctor){
+            func();
+        }
+        _Stats.RecordTasks(_TempFunctor.size());
+        return;
+    }
+
+    // 在 I/O 事件和任务池处理完之后执行延迟任务
+    // 每轮至少执行一个切片以保证后台任务能够推进，超出时间预算后剩余任务留到下一轮
+    // 未完成的任务重新放回队尾，多个长任务之间轮转执行
+    void RunDeferredTask(){
+        if(_DeferredTasks.empty()){
+            return;
+        }
+        uint64_t deadline = MonotonicUs() + _DeferredBudget;
+        size_t count = _DeferredTasks.size();
+        for(size_t i = 0; i < count; ++i){
+            DeferredFunctor task = std::move(_DeferredTasks.front());
+            _DeferredTasks.pop_front();
+            if(task()){
+                _DeferredTasks.push_back(std::move(task));
+            }
+            if(MonotonicUs() >= deadline){
+                break;
+            }
+        }
+        _Stats.SetDeferredTasks(_DeferredTasks.size());
+        return;
+    }
+
+    static int CreateEventFd(){
+        int EventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(EventFd < 0){
+            ERR_LOG("CREATE EVENTFD ERROR");
+            std::abort();
+        }
+        return EventFd;
+    }
+
+    void ReadEventFd(){
+        uint64_t res = 0;
+        int ret = read(_EventFd, &res, sizeof(res));
+        if(ret < 0){
+            if(errno == EINTR || errno == EAGAIN){
+                return;
+            }
+            ERR_LOG("READ EVENTFD ERROR");
+            std::abort();
+        }
+        return;
+    }
+
+    void WakeUpEventFd(){
+        uint64_t val = 1;
+        int ret = write(_EventFd, &val, sizeof(val));
+        if(ret < 0){
+            if(errno == EINTR){
+                return;
+            }
+            ERR_LOG("WRITE VAL ERROR");
+            std::abort();
+        }
+        return;
+    }
+public:
+    EventLoop(uint32_t timerTickMs = DEFAULT_TIMER_TICK_MS, bool timerTickless = true)
+        :_ThreadID(std::this_thread::get_id()),
+        _EventFd(CreateEventFd()),
+        _EventChannel(new Channel(this, _EventFd)),
+        _TimerWheel(this, timerTickMs, timerTickless),
+        _DeferredBudget(DEFAULT_DEFERRED_BUDGET_US),
+        _ReadBudgetBytes(DEFAULT_READ_BUDGET_BYTES),
+        _ReadBudgetEvents(DEFAULT_READ_BUDGET_EVENTS),
+        _ReadBytes(0),
+        _ReadEvents(0),
+        _ShedLagUs(0),
+        _BusyStartUs(0),
+        _ConnectionPool(std::make_shared<SlotPool>()),
+        _Quit(false),
+        _Pins(0)
+    {
+        _EventChannel->SetReadCallback(std::bind(&EventLoop::ReadEventFd, this));
+        _EventChannel->EnableRead();
+    }
+
+    ~EventLoop(){
+        close(_EventFd);
+    }
+
+    void Start(){
+        std::vector<Channel*> Bulk;
+        while(!_Quit){
+            std::vector<Channel*> Activities;
+            uint64_t waitStart = MonotonicUs();
+            // 还有未完成的延迟任务时不能阻塞在 epoll_wait 上；无节拍模式下最多等到最早的定时器到期
+            int timeout = 0;
+            if(_DeferredTasks.empty() && _DirtyConnections.empty()){
+                timeout = _TimerWheel.IsTickless() ? _TimerWheel.NextTimeout() : -1;
+            }
+            _Stats.MarkWaiting(waitStart);
+            _Poller.Poll(Activities, timeout);
+            _Stats.MarkBusy();
+            uint64_t busyStart = MonotonicUs();
+            _BusyStartUs = busyStart;
+
+            // 先处理普通通道，大流量通道放在最后，交互式的小请求不必排在大块读取之后
+            _ReadBytes = 0;
+            _ReadEvents = 0;
+            Bulk.clear();
+            for(auto &channel : Activities){
+                if(channel->IsBulk()){
+                    Bulk.push_back(channel);
+                    continue;
+                }
+                channel->HandleEvent();
+            }
+            for(auto &channel : Bulk){
+                channel->HandleEvent();
+            }
+            if(_TimerWheel.IsTickless()){
+                _TimerWheel.RunExpired();
+            }
+
+            RunAllTask();
+            RunDeferredTask();
+            if(_BatchEndCallback){
+                _BatchEndCallback();
+            }
+            FlushDirty();
+
+            _Stats.SetTimers(_TimerWheel.Size());
+            _Stats.RecordIteration(busyStart - waitStart, MonotonicUs() - busyStart, Activities.size());
+        }
+    }
+
+    // 让 Start 在本轮结束后返回，可在任意线程调用
+    void Quit(){
+        _Quit = true;
+        WakeUpEventFd();
+    }
+
+    bool IsInLoop(){
+        return (_ThreadID == std::this_thread::get_id());
     }
 
     void AssertInLoop(){
@@ -967,50 +2001,263 @@ public:
         {
             std::unique_lock<std::mutex> _lock(_Mutex);
             _Tasks.push_back(cb);
+            _Stats.SetQueuedTasks(_Tasks.size());
         }
         // 唤醒有可能因为没有事件就绪，⽽导致的epoll阻塞；
         // 其实就是给eventfd写⼊⼀个数据，eventfd就会触发可读事件
         WakeUpEventFd();
     }
 
+    // 提交低优先级的延迟任务，可在任意线程调用
+    // 适合缓存淘汰、统计汇总等后台工作，长任务可以拆成多个切片，返回 true 表示还需继续
+    void Defer(const DeferredFunctor &cb){
+        RunInLoop([this, cb](){ _DeferredTasks.push_back(cb); });
+    }
+
+    // 设置每轮循环延迟任务的时间预算（微秒）
+    void SetDeferredBudget(uint64_t us){
+        RunInLoop([this, us](){ _DeferredBudget = us; });
+    }
+
+    // 设置每轮循环的读取预算，bytes 或 events 为 0 表示该项不限制
+    void SetReadBudget(uint64_t bytes, uint64_t events){
+        RunInLoop([this, bytes, events](){
+            _ReadBudgetBytes = bytes;
+            _ReadBudgetEvents = events;
+        });
+    }
+    // 设置过载的延迟阈值（微秒），为 0 表示不检查
+    void SetShedLag(uint64_t us){
+        RunInLoop([this, us](){ _ShedLagUs = us; });
+    }
+    // 本轮已处理的时间是否超过阈值，只能在本线程中调用
+    // 本轮后面的事件至少已经等待了这么久，继续正常处理只会让它们的延迟更高
+    bool IsOverloaded() const{
+        return _ShedLagUs > 0 && MonotonicUs() - _BusyStartUs > _ShedLagUs;
+    }
+
+    // 一轮结束时执行的回调，可以在这里把本轮积攒的输出写入连接，随后与其他输出一起发送
+    void SetBatchEndCallback(const Functor &cb){
+        RunInLoop([this, cb](){ _BatchEndCallback = cb; });
+    }
+    // 登记本轮写入过数据的连接，只能在本线程中调用
+    void AddDirty(const PtrConnection& conn){
+        _DirtyConnections.push_back(conn);
+    }
+    void FlushDirty();
+
+    // 记录一次读取，只能在本线程中调用
+    void ChargeRead(uint64_t bytes){
+        _ReadBytes += bytes;
+        ++_ReadEvents;
+    }
+    // 本轮的读取预算是否已经用完
+    bool ReadBudgetExhausted() const{
+        return (_ReadBudgetBytes > 0 && _ReadBytes >= _ReadBudgetBytes)
+            || (_ReadBudgetEvents > 0 && _ReadEvents >= _ReadBudgetEvents);
+    }
+
+    // 运行统计，写入只能在本线程进行，读取可在任意线程
+    LoopStats& GetStats() { return _Stats; }
+    const std::shared_ptr<SlotPool>& GetConnectionPool() const { return _ConnectionPool; }
+
+    // 连接表，只能在本线程中调用
+    void AddConnection(const PtrConnection& conn, uint64_t id){
+        AssertInLoop();
+        _Connections[id] = conn;
+    }
+    // 返回连接是否在表中
+    bool RemoveConnection(uint64_t id){
+        AssertInLoop();
+        return _Connections.erase(id) > 0;
+    }
+    const std::unordered_map<uint64_t, PtrConnection>& GetConnections(){
+        AssertInLoop();
+        return _Connections;
+    }
+    LoopStatsSnapshot GetStatsSnapshot() const { return _Stats.Snapshot(); }
+
     // 添加/修改描述符的事件监控
-    void UpdateEvent(Channel *channel) { return _Poller.UpdateChannel(channel); }
+    void UpdateEvent(Channel *channel){
+        _Stats.AddEventUpdate();
+        return _Poller.UpdateChannel(channel);
+    }
 
     // 移除描述符的监控
-    void RemoveEvent(Channel *channel) { return _Poller.RemoveChannel(channel); }
+    void RemoveEvent(Channel *channel){
+        _Stats.AddEventUpdate();
+        return _Poller.RemoveChannel(channel);
+    }
     void TimerAdd(uint64_t id, uint32_t delay, const TaskFunc &cb) { return _TimerWheel.TimerAdd(id, delay, cb); }
+    void TimerAddMs(uint64_t id, uint64_t delayMs, const TaskFunc &cb) { return _TimerWheel.TimerAddMs(id, delayMs, cb); }
 
     void TimerRefresh(uint64_t id){ return _TimerWheel.TimerRefresh(id); }
     void TimerCancel(uint64_t id) { return _TimerWheel.TimerCancel(id); }
+    // 嵌入式定时器节点，只能在本线程中调用
+    void TimerSchedule(TimerTask* node, uint64_t delayMs) { return _TimerWheel.Schedule(node, delayMs); }
+    void TimerUnschedule(TimerTask* node) { return _TimerWheel.Unschedule(node); }
+
+    // 定时任务，可以在任意线程调用，任务在本循环中执行，返回的句柄用于取消
+    // whenUs 为 MonotonicUs 时间，时间单位为毫秒
+    TimerHandle RunAt(uint64_t whenUs, const TaskFunc &cb) { return _TimerWheel.RunAt(whenUs, 0, cb); }
+    TimerHandle RunAfter(uint64_t delayMs, const TaskFunc &cb) { return RunAt(MonotonicUs() + delayMs * 1000ULL, cb); }
+    TimerHandle RunEvery(uint32_t intervalMs, const TaskFunc &cb){
+        return _TimerWheel.RunAt(MonotonicUs() + intervalMs * 1000ULL, intervalMs, cb);
+    }
+    void CancelTimer(const TimerHandle &handle) { return _TimerWheel.Cancel(handle); }
     bool HasTimer(uint64_t id) { return _TimerWheel.HasTimer(id); }
+    // 时间轮中的定时器数量，只在本线程调用
+    size_t TimerCount() const { return _TimerWheel.Size(); }
+
+    // 长期持有本循环指针的对象（连接、定时器句柄、ResponseCache 的分片）在持有期间计数，可在任意线程调用
+    // 线程池移出的循环只在计数为 0 时退出，其他地方不要长期保存从属循环的指针
+    void Pin() { _Pins.fetch_add(1, std::memory_order_relaxed); }
+    void Unpin() { _Pins.fetch_sub(1, std::memory_order_release); }
+    uint64_t GetPins() const { return _Pins.load(std::memory_order_acquire); }
 };
 
 
+// set_mempolicy 的策略值，见 <numaif.h>，这里直接使用系统调用以免依赖 libnuma
+#define NUMA_MPOL_PREFERRED 1
+
+// 读取 /sys 获取 CPU 所在的 NUMA 节点，无法确定时返回 -1
+inline int CpuNumaNode(int cpu){
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* dir = opendir(path);
+    if(dir == nullptr){
+        return -1;
+    }
+    int node = -1;
+    struct dirent* entry;
+    while((entry = readdir(dir)) != nullptr){
+        if(sscanf(entry->d_name, "node%d", &node) == 1){
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+// 当前进程允许运行的 CPU 列表
+inline std::vector<int> AllowedCpus(){
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) < 0){
+        return cpus;
+    }
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu){
+        if(CPU_ISSET(cpu, &set)){
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// 将当前线程绑定到指定的 CPU 集合
+inline bool BindThreadToCpus(const std::vector<int>& cpus){
+    if(cpus.empty()){
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus){
+        CPU_SET(cpu, &set);
+    }
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(ret != 0){
+        ERR_LOG("pthread_setaffinity_np error: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+// 设置当前线程名，内核限制最长 15 个字符
+inline void SetThreadName(const std::string& name){
+    if(name.empty()){
+        return;
+    }
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+}
+
+// 让当前线程之后的内存分配优先落在指定 NUMA 节点上
+inline bool SetPreferredNumaNode(int node){
+    if(node < 0 || node >= 64){
+        return false;
+    }
+    unsigned long mask = 1UL << node;
+    if(syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1) < 0){
+        ERR_LOG("set_mempolicy error: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+// 事件循环线程的启动参数
+struct LoopThreadOptions
+{
+    std::string Name;       // 线程名，为空表示不设置
+    std::vector<int> Cpus;  // 绑定的 CPU 集合，为空表示不绑定
+    bool NumaLocal;         // 内存优先分配在所绑定 CPU 所在的 NUMA 节点
+    uint32_t TimerTickMs;   // 定时器 tick 粒度（毫秒）
+    bool TimerTickless;     // 定时器使用无节拍模式
+
+    LoopThreadOptions(): NumaLocal(false), TimerTickMs(DEFAULT_TIMER_TICK_MS), TimerTickless(true) {}
+};
+
+// 按参数设置当前线程：线程名、CPU 亲和性和 NUMA 内存策略
+inline void ApplyThreadOptions(const LoopThreadOptions& options){
+    SetThreadName(options.Name);
+    if(!BindThreadToCpus(options.Cpus)){
+        return;
+    }
+    if(options.NumaLocal && !options.Cpus.empty()){
+        SetPreferredNumaNode(CpuNumaNode(options.Cpus[0]));
+    }
+}
+
 class LoopThread
 {
 private:
     std::mutex _Mutex;
     std::condition_variable _Cond;
     EventLoop* _Loop;
+    // 事件循环在线程内构造，但由 LoopThread 持有，线程退出后仍然有效，直到 LoopThread 析构
+    std::unique_ptr<EventLoop> _OwnedLoop;
+    LoopThreadOptions _Options;
     std::thread _Thread;
 
 private:
     void ThreadEntry(){
-        EventLoop loop;
+        // 先完成绑核和内存策略的设置，再构造事件循环
+        // 这样 epoll 事件数组等循环内的数据都由本线程首次访问，分配在本地节点
+        ApplyThreadOptions(_Options);
+        EventLoop* loop = new EventLoop(_Options.TimerTickMs, _Options.TimerTickless);
         {
             std::lock_guard lk(_Mutex);
-            _Loop = &loop;
+            _OwnedLoop.reset(loop);
+            _Loop = loop;
             _Cond.notify_one();
         }
-        loop.Start();
+        loop->Start();
+        // 退出前处理剩余任务，迁移途中投递到这里的任务会被转发到连接的新循环
+        loop->RunAllTask();
     }
 
 public:
-    LoopThread()
+    LoopThread(const LoopThreadOptions& options = LoopThreadOptions())
         :_Loop(nullptr)
+        ,_Options(options)
         ,_Thread(std::bind(&LoopThread::ThreadEntry, this))
     {}
 
+    // 析构前应先把该循环上的连接迁走
+    ~LoopThread(){
+        GetLoop()->Quit();
+        _Thread.join();
+    }
+
     EventLoop* GetLoop(){
         EventLoop* loop = nullptr;
         {
@@ -1022,133 +2269,967 @@ public:
         }
         return loop;
     }
-};
-
+};
+
+
+// 新连接分配事件循环的策略
+typedef enum {
+    ROUND_ROBIN,          // 轮询
+    LEAST_CONNECTIONS,    // 连接数最少
+    LEAST_BUSY,           // 最近忙碌时间最少
+    POWER_OF_TWO_CHOICES  // 随机选两个，取负载较低者
+} LoopBalance;
+
+// 自定义分配策略，参数为所有从属事件循环，返回其中之一
+using LoopSelector = std::function<EventLoop*(const std::vector<EventLoop*>&)>;
+
+class LoopThreadPool
+{
+    // 最近忙碌比例的采样间隔（微秒）
+    static const uint64_t LOAD_SAMPLE_US = 100000;
+
+    // 根据累计忙碌时间的增量计算最近忙碌比例
+    // 不使用 LoopStats 中按轮次平滑的比例，空闲的循环可能长时间不更新它
+    struct LoadSample
+    {
+        uint64_t BusyUs;
+        uint64_t TimeUs;
+        uint32_t Permille;
+    };
+
+private:
+    int _ThreadCount;
+    int _NextIdx;
+    EventLoop* _BaseLoop;
+    std::vector<std::unique_ptr<LoopThread>> _Threads;
+    std::vector<EventLoop*> _Loops;
+    // 移出的线程先不析构，循环继续运行：迁移途中的连接、定时器句柄和按循环分片的缓存可能还持有指向它的指针
+    // 投递过来的任务照常执行；再次增加线程时后进先出复用，序号和 CPU 绑定与移出前一致
+    // 移出超过 LOOP_PARK_GRACE 秒、且不再被引用（EventLoop::Pin）的线程由 TCPServer 通过 ReleaseParked 结束
+    struct ParkedThread
+    {
+        std::unique_ptr<LoopThread> Thread;
+        uint64_t SinceUs;
+    };
+    std::vector<ParkedThread> _Parked;
+    // 线程数可以在运行时调整，由主循环线程修改，其他线程读取时需要加锁
+    std::mutex _Mutex;
+    LoopBalance _Balance;
+    LoopSelector _Selector;
+    std::vector<LoadSample> _LoadSamples;
+    uint64_t _RandState;
+    std::vector<std::vector<int>> _CpuSets;
+    std::string _ThreadName;
+    bool _NumaLocal;
+    int _ReservedCpu;
+    uint32_t _TimerTickMs;
+    bool _TimerTickless;
+
+private:
+    // xorshift 伪随机数，只在主循环线程中使用
+    uint64_t Random(){
+        _RandState ^= _RandState << 13;
+        _RandState ^= _RandState >> 7;
+        _RandState ^= _RandState << 17;
+        return _RandState;
+    }
+
+public:
+    // 第 idx 个循环最近的忙碌比例（千分比），只在主循环线程中调用
+    uint32_t RecentBusyPermille(int idx){
+        LoadSample &sample = _LoadSamples[idx];
+        uint64_t now = MonotonicUs();
+        if(now - sample.TimeUs >= LOAD_SAMPLE_US){
+            uint64_t busy = _Loops[idx]->GetStatsSnapshot().BusyUs;
+            sample.Permille = (uint32_t)((busy - sample.BusyUs) * 1000 / (now - sample.TimeUs));
+            sample.BusyUs = busy;
+            sample.TimeUs = now;
+        }
+        return sample.Permille;
+    }
+
+private:
+    uint64_t Connections(int idx){
+        return _Loops[idx]->GetStats().GetConnections();
+    }
+
+    // 负载比较：先比较最近忙碌比例，相同再比较连接数
+    bool LighterThan(int a, int b){
+        uint32_t busyA = RecentBusyPermille(a), busyB = RecentBusyPermille(b);
+        if(busyA != busyB){
+            return busyA < busyB;
+        }
+        return Connections(a) < Connections(b);
+    }
+
+    int LeastConnections(){
+        int best = 0;
+        for(int i = 1; i < _ThreadCount; ++i){
+            if(Connections(i) < Connections(best)){
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    int LeastBusy(){
+        int best = 0;
+        for(int i = 1; i < _ThreadCount; ++i){
+            if(LighterThan(i, best)){
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    int PowerOfTwoChoices(){
+        int a = Random() % _ThreadCount;
+        int b = Random() % _ThreadCount;
+        return LighterThan(b, a) ? b : a;
+    }
+
+public:
+    LoopThreadPool(EventLoop* baseloop)
+        :_ThreadCount(0)
+        ,_NextIdx(0)
+        ,_BaseLoop(baseloop)
+        ,_Balance(ROUND_ROBIN)
+        ,_RandState(MonotonicUs() | 1)
+        ,_ThreadName("loop")
+        ,_NumaLocal(false)
+        ,_ReservedCpu(-1)
+        ,_TimerTickMs(DEFAULT_TIMER_TICK_MS)
+        ,_TimerTickless(true)
+    {}
+
+    void SetThreadCount(int count){
+        _ThreadCount = count;
+    }
+    void SetBalance(LoopBalance balance){
+        _Balance = balance;
+    }
+    // 设置后优先于 SetBalance 指定的内置策略
+    void SetSelector(const LoopSelector& selector){
+        _Selector = selector;
+    }
+    // 第 i 个线程绑定到 cpuSets[i % cpuSets.size()]
+    void SetCpuSets(const std::vector<std::vector<int>>& cpuSets){
+        _CpuSets = cpuSets;
+    }
+    // 线程名为 "name-序号"
+    void SetThreadName(const std::string& name){
+        _ThreadName = name;
+    }
+    void SetNumaLocal(bool numaLocal){
+        _NumaLocal = numaLocal;
+    }
+    // 为主循环保留的 CPU，未指定 CPU 集合时从属线程绑定到其余 CPU 上
+    void SetReservedCpu(int cpu){
+        _ReservedCpu = cpu;
+    }
+    bool IsNumaLocal() const{
+        return _NumaLocal;
+    }
+    void SetTimerTick(uint32_t tickMs){
+        _TimerTickMs = tickMs;
+    }
+    void SetTimerTickless(bool tickless){
+        _TimerTickless = tickless;
+    }
+    LoopThreadOptions GetThreadOptions(int idx){
+        LoopThreadOptions options;
+        options.Name = _ThreadName + "-" + std::to_string(idx);
+        options.NumaLocal = _NumaLocal;
+        options.TimerTickMs = _TimerTickMs;
+        options.TimerTickless = _TimerTickless;
+        if(!_CpuSets.empty()){
+            options.Cpus = _CpuSets[idx % _CpuSets.size()];
+        }
+        else if(_ReservedCpu >= 0){
+            for(int cpu : AllowedCpus()){
+                if(cpu != _ReservedCpu){
+                    options.Cpus.push_back(cpu);
+                }
+            }
+        }
+        return options;
+    }
+    void Create(){
+        int count = _ThreadCount;
+        _ThreadCount = 0;
+        for(int i = 0; i < count; ++i){
+            AddLoop();
+        }
+        return;
+    }
+    // 以下增减线程的接口只在主循环线程中调用
+    // 新增一个事件循环线程，优先复用移出的线程，CPU 绑定按其序号分配
+    EventLoop* AddLoop(){
+        std::unique_ptr<LoopThread> thread;
+        if(!_Parked.empty()){
+            thread = std::move(_Parked.back().Thread);
+            _Parked.pop_back();
+        }
+        else{
+            thread.reset(new LoopThread(GetThreadOptions(_Loops.size())));
+        }
+        EventLoop* loop = thread->GetLoop();
+        {
+            std::lock_guard<std::mutex> lock(_Mutex);
+            _Threads.push_back(std::move(thread));
+            _Loops.push_back(loop);
+            _LoadSamples.push_back(LoadSample{loop->GetStatsSnapshot().BusyUs, MonotonicUs(), 0});
+            _ThreadCount = _Loops.size();
+        }
+        return loop;
+    }
+    // 移出最后一个事件循环线程，之后不再向它分配连接，由调用者迁走其上的连接
+    // 线程和循环暂时保留，见 _Parked
+    EventLoop* RemoveLoop(){
+        std::lock_guard<std::mutex> lock(_Mutex);
+        assert(!_Threads.empty());
+        EventLoop* loop = _Loops.back();
+        _Parked.push_back(ParkedThread{std::move(_Threads.back()), MonotonicUs()});
+        _Threads.pop_back();
+        _Loops.pop_back();
+        _LoadSamples.pop_back();
+        _ThreadCount = _Loops.size();
+        _NextIdx = _ThreadCount > 0 ? _NextIdx % _ThreadCount : 0;
+        return loop;
+    }
+    // 循环是否已经移出且没有被复用
+    bool IsParked(EventLoop* loop){
+        for(auto& parked : _Parked){
+            if(parked.Thread->GetLoop() == loop){
+                return true;
+            }
+        }
+        return false;
+    }
+    bool HasParked() const{
+        return !_Parked.empty();
+    }
+    // 移出至少 idleUs 微秒、没有连接也没有被引用的循环
+    std::vector<EventLoop*> IdleParked(uint64_t idleUs){
+        std::vector<EventLoop*> loops;
+        uint64_t now = MonotonicUs();
+        for(auto& parked : _Parked){
+            EventLoop* loop = parked.Thread->GetLoop();
+            if(now - parked.SinceUs >= idleUs && loop->GetPins() == 0 && loop->GetStats().GetConnections() == 0){
+                loops.push_back(loop);
+            }
+        }
+        return loops;
+    }
+    // 结束移出的循环线程：循环退出前执行完已投递的任务，之后释放循环
+    // 循环已被复用、或期间又被引用时不结束，返回 false；只比较指针，loop 可以是已经结束的循环
+    bool ReleaseParked(EventLoop* loop){
+        for(auto iter = _Parked.begin(); iter != _Parked.end(); ++iter){
+            if(iter->Thread->GetLoop() != loop){
+                continue;
+            }
+            if(loop->GetPins() > 0 || loop->GetStats().GetConnections() > 0){
+                return false;
+            }
+            std::unique_ptr<LoopThread> thread = std::move(iter->Thread);
+            _Parked.erase(iter);
+            thread.reset();
+            return true;
+        }
+        return false;
+    }
+    int GetThreadCount() const{
+        return _ThreadCount;
+    }
+    // 可在任意线程调用
+    std::vector<LoopStatsSnapshot> GetStats(){
+        std::lock_guard<std::mutex> lock(_Mutex);
+        std::vector<LoopStatsSnapshot> stats;
+        for(auto loop : _Loops){
+            stats.push_back(loop->GetStatsSnapshot());
+        }
+        return stats;
+    }
+    // 只在主循环线程中调用
+    EventLoop* NextLoop(){
+        if(_ThreadCount == 0){
+            return _BaseLoop;
+        }
+        if(_Selector){
+            return _Selector(_Loops);
+        }
+        switch(_Balance){
+            case LEAST_CONNECTIONS:    _NextIdx = LeastConnections(); break;
+            case LEAST_BUSY:           _NextIdx = LeastBusy(); break;
+            case POWER_OF_TWO_CHOICES: _NextIdx = PowerOfTwoChoices(); break;
+            default:                   _NextIdx = (_NextIdx + 1) % _ThreadCount; break;
+        }
+        return _Loops[_NextIdx];
+    }
+    const std::vector<EventLoop*>& GetLoops() const{
+        return _Loops;
+    }
+};
+
+
+// 计算线程池运行统计
+struct ComputeStatsSnapshot
+{
+    uint64_t Pending;              // 等待执行的任务总数
+    uint64_t Executed;             // 已执行的任务数
+    uint64_t Steals;               // 从其他线程队列窃取的任务数
+    std::vector<uint64_t> Depths;  // 各线程队列长度
+};
+
+// 在计算线程中执行，返回值在连接所属的事件循环中执行，用于把结果交还给连接
+using ComputeJob = std::function<std::function<void()>()>;
+
+// 用于卸载 CPU 密集型消息处理的工作窃取线程池
+// 每个线程有自己的任务队列，从队首取任务；自己的队列为空时从其他线程的队尾窃取
+// 这样计算耗时不会阻塞事件循环上其他连接的 I/O
+class ComputePool
+{
+    using Job = std::function<void()>;
+
+    struct WorkerQueue
+    {
+        std::mutex Mutex;
+        std::deque<Job> Jobs;
+    };
+
+private:
+    std::vector<std::unique_ptr<WorkerQueue>> _Queues;
+    std::vector<std::thread> _Workers;
+    std::atomic<uint64_t> _NextQueue;
+    std::atomic<uint64_t> _Pending;
+    std::atomic<uint64_t> _Executed;
+    std::atomic<uint64_t> _Steals;
+    std::atomic<bool> _Stop;
+    // 无任务时线程在此休眠
+    std::mutex _SleepMutex;
+    std::condition_variable _SleepCond;
+
+private:
+    bool PopLocal(int idx, Job& job){
+        WorkerQueue& queue = *_Queues[idx];
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        if(queue.Jobs.empty()){
+            return false;
+        }
+        job = std::move(queue.Jobs.front());
+        queue.Jobs.pop_front();
+        return true;
+    }
+
+    bool Steal(int idx, Job& job){
+        int count = _Queues.size();
+        for(int i = 1; i < count; ++i){
+            WorkerQueue& queue = *_Queues[(idx + i) % count];
+            std::lock_guard<std::mutex> lock(queue.Mutex);
+            if(queue.Jobs.empty()){
+                continue;
+            }
+            job = std::move(queue.Jobs.back());
+            queue.Jobs.pop_back();
+            _Steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    void WorkerEntry(int idx){
+        SetThreadName("compute-" + std::to_string(idx));
+        for(;;){
+            Job job;
+            if(PopLocal(idx, job) || Steal(idx, job)){
+                _Pending.fetch_sub(1, std::memory_order_relaxed);
+                job();
+                _Executed.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_SleepMutex);
+            _SleepCond.wait(lock, [this](){
+                return _Stop || _Pending.load() > 0;
+            });
+            if(_Stop && _Pending.load() == 0){
+                return;
+            }
+        }
+    }
+
+public:
+    ComputePool(int count)
+        :_NextQueue(0)
+        ,_Pending(0)
+        ,_Executed(0)
+        ,_Steals(0)
+        ,_Stop(false)
+    {
+        assert(count > 0);
+        for(int i = 0; i < count; ++i){
+            _Queues.emplace_back(new WorkerQueue());
+        }
+        for(int i = 0; i < count; ++i){
+            _Workers.emplace_back(&ComputePool::WorkerEntry, this, i);
+        }
+    }
+
+    ~ComputePool(){
+        {
+            std::lock_guard<std::mutex> lock(_SleepMutex);
+            _Stop = true;
+        }
+        _SleepCond.notify_all();
+        for(auto& worker : _Workers){
+            worker.join();
+        }
+    }
+
+    // 提交任务，可在任意线程调用，任务按轮询放入各线程队列
+    void Submit(const Job& job){
+        WorkerQueue& queue = *_Queues[_NextQueue.fetch_add(1, std::memory_order_relaxed) % _Queues.size()];
+        {
+            // 先加计数再放入任务，否则任务可能在加计数之前就被取走执行，计数减到负数
+            std::lock_guard<std::mutex> lock(queue.Mutex);
+            _Pending.fetch_add(1, std::memory_order_relaxed);
+            queue.Jobs.push_back(job);
+        }
+        {
+            // 经过一次休眠锁再唤醒，避免线程在检查条件和休眠之间错过唤醒
+            std::lock_guard<std::mutex> lock(_SleepMutex);
+        }
+        _SleepCond.notify_one();
+    }
+
+    // 在连接所属的事件循环中调用（一般是消息回调内）
+    // job 在计算线程执行，其返回的回调按提交顺序回到连接所属的事件循环执行
+    void Offload(const PtrConnection& conn, const ComputeJob& job);
+
+    ComputeStatsSnapshot GetStats(){
+        ComputeStatsSnapshot snap;
+        snap.Pending = _Pending.load(std::memory_order_relaxed);
+        snap.Executed = _Executed.load(std::memory_order_relaxed);
+        snap.Steals = _Steals.load(std::memory_order_relaxed);
+        for(auto& queue : _Queues){
+            std::lock_guard<std::mutex> lock(queue->Mutex);
+            snap.Depths.push_back(queue->Jobs.size());
+        }
+        return snap;
+    }
+};
+
+
+
+class Any
+{
+private:
+    
+    class PlaceHolder
+    {
+    public:
+        virtual ~PlaceHolder() {}
+        virtual const std::type_info& type() = 0;
+        virtual PlaceHolder* clone() = 0;
+    };
+
+    template<class T>
+    class Holder : public PlaceHolder
+    {
+    public:
+        Holder(const T& data)
+            :_data(data)
+        {}
+        ~Holder() = default;
+        const std::type_info& type(){
+            return typeid(T);
+        }
+        PlaceHolder* clone(){
+            return new Holder(_data);
+        }
+    public:
+        T _data;
+        
+    };
+
+private:
+    PlaceHolder* _content;
+
+public:
+    Any(): _content(nullptr){}
+
+    template <typename T>
+    Any(const T &data) : _content(new Holder<T>(data)) {}
+    Any(const Any &other) : _content(other._content ? other._content->clone() : nullptr) {}
+    ~Any()
+    {
+        if (_content)
+            delete _content;
+    }
+
+    // 若 content 不为空，则返回 content 的类型信息，否则返回 void 类型信息
+    const std::type_info &type(){
+        return _content ? _content->type() : typeid(void);
+    }
+
+    // 获取 data 指针
+    template<typename T>
+    T* get(){
+        assert(typeid(T) == _content->type());
+        return &(static_cast<Holder<T>*>(_content)->_data);
+    }
+};
+
+
+// 连接上下文的内联存储大小，常见的协议状态对象放得下时不需要分配内存
+#define CONTEXT_INLINE_SIZE 256
+
+// 连接上下文，保存任意类型的协议状态
+// 对象放得下且移动构造不抛异常时直接构造在内联存储中，否则分配在堆上；支持只能移动的类型
+// 每个类型有一张唯一的操作表，类型检查只比较表的地址，Get 只在 debug 版本中检查类型
+class Context
+{
+private:
+    struct Ops{
+        void (*destroy)(Context&);
+        // 把 from 中的对象移到 to 的存储中，之后 from 的存储视为空
+        void (*move)(Context& from, Context& to);
+        const std::type_info& (*type)();
+    };
+
+    template<class T>
+    struct Inline{
+        static T* Get(Context& ctx){ return std::launder(reinterpret_cast<T*>(ctx._Storage)); }
+        template<class... Args>
+        static T* Create(Context& ctx, Args&&... args){ return ::new(ctx._Storage) T(std::forward<Args>(args)...); }
+        static void Destroy(Context& ctx){ Get(ctx)->~T(); }
+        static void Move(Context& from, Context& to){
+            ::new(to._Storage) T(std::move(*Get(from)));
+            Destroy(from);
+        }
+        static const std::type_info& Type(){ return typeid(T); }
+        static inline const Ops ops = { &Destroy, &Move, &Type };
+    };
+
+    // 存储中只保存对象指针
+    template<class T>
+    struct Heap{
+        static T*& Slot(Context& ctx){ return *std::launder(reinterpret_cast<T**>(ctx._Storage)); }
+        static T* Get(Context& ctx){ return Slot(ctx); }
+        template<class... Args>
+        static T* Create(Context& ctx, Args&&... args){
+            T* data = new T(std::forward<Args>(args)...);
+            ::new(ctx._Storage) T*(data);
+            return data;
+        }
+        static void Destroy(Context& ctx){ delete Slot(ctx); }
+        static void Move(Context& from, Context& to){ ::new(to._Storage) T*(Slot(from)); }
+        static const std::type_info& Type(){ return typeid(T); }
+        static inline const Ops ops = { &Destroy, &Move, &Type };
+    };
+
+    template<class T>
+    using Manager = typename std::conditional<sizeof(T) <= CONTEXT_INLINE_SIZE
+                                              && alignof(T) <= alignof(std::max_align_t)
+                                              && std::is_nothrow_move_constructible<T>::value,
+                                              Inline<T>, Heap<T>>::type;
+
+private:
+    alignas(std::max_align_t) unsigned char _Storage[CONTEXT_INLINE_SIZE];
+    const Ops* _Ops;
+
+public:
+    Context(): _Ops(nullptr) {}
+    Context(Context&& other) noexcept : _Ops(nullptr) { *this = std::move(other); }
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+    ~Context() { Reset(); }
+
+    Context& operator=(Context&& other) noexcept{
+        if(this != &other){
+            Reset();
+            if(other._Ops){
+                other._Ops->move(other, *this);
+                _Ops = other._Ops;
+                other._Ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    // 销毁原有对象，用参数直接构造一个 T
+    template<class T, class... Args>
+    T& Emplace(Args&&... args){
+        Reset();
+        T* data = Manager<T>::Create(*this, std::forward<Args>(args)...);
+        _Ops = &Manager<T>::ops;
+        return *data;
+    }
+
+    template<class T>
+    typename std::decay<T>::type& Set(T&& value){
+        return Emplace<typename std::decay<T>::type>(std::forward<T>(value));
+    }
+
+    void Reset(){
+        if(_Ops){
+            _Ops->destroy(*this);
+            _Ops = nullptr;
+        }
+    }
+
+    bool Empty() const { return _Ops == nullptr; }
+
+    template<class T>
+    bool Is() const { return _Ops == &Manager<T>::ops; }
+
+    // 为空时返回 void 的类型信息
+    const std::type_info& type() const { return _Ops ? _Ops->type() : typeid(void); }
+
+    template<class T>
+    T* Get(){
+        assert(Is<T>());
+        return Manager<T>::Get(*this);
+    }
+};
+
+
+// 响应缓存每个事件循环分片的默认容量（字节）和条目默认有效期
+#define RESPONSE_CACHE_SHARD_BYTES (64 * 1024 * 1024)
+#define RESPONSE_CACHE_TTL_MS 1000
+// 生成的默认时限，超时后等待者收到空指针，键不再处于生成中
+#define RESPONSE_CACHE_FILL_TIMEOUT_MS 5000
+
+struct ResponseCacheStatsSnapshot
+{
+    uint64_t Hits;
+    uint64_t Misses;      // 没有找到有效条目的查找次数（含过期）
+    uint64_t Fills;       // 发起生成的次数
+    uint64_t Coalesced;   // 未命中但同一个键正在生成，等待同一结果的次数
+    uint64_t FillTimeouts; // 生成超时的次数
+    uint64_t Expired;
+    uint64_t Evicted;
+    uint64_t Entries;
+    uint64_t Bytes;
+};
+
+// 完整响应的缓存，条目是已经序列化好的只读数据，通过引用计数共享
+// 命中时用 Connection::SendShared 直接发送，不拷贝到输出缓冲区
+// 每个事件循环一个分片，只由所属线程访问，查找和插入都不加锁；各分片按字节数上限做 LRU 淘汰，条目过期后视为未命中
+// 同一分片中同一个键未命中时只生成一次，生成期间到达的请求等待同一结果
+class ResponseCache
+{
+public:
+    using Blob = std::shared_ptr<const std::string>;
+    // 生成结束时调用，可以在任意线程调用；blob 为空表示生成失败，不缓存，等待者收到空指针
+    // ttlMs 为 0 时使用缓存的默认有效期；超时之后才调用时结果仍会缓存
+    using FillDone = std::function<void(const Blob&, uint32_t)>;
+    using Filler = std::function<void(const FillDone&)>;
+    using Callback = std::function<void(const Blob&)>;
+
+private:
+    using Counter = std::atomic<uint64_t>;
+
+    struct Entry
+    {
+        Blob Data;
+        uint64_t ExpireUs;
+        std::list<std::string>::iterator Position;
+    };
+
+    // 一次进行中的生成：序号区分同一个键先后发起的生成，超时定时器只处理自己的那一次
+    struct Fill
+    {
+        uint64_t Id;
+        TimerHandle Timer;
+        std::vector<Callback> Waiters;
+    };
+
+    struct Shard
+    {
+        EventLoop* Loop;
+        Shard* Next;
+        std::unordered_map<std::string, Entry> Entries;
+        // 最近使用的在前
+        std::list<std::string> Lru;
+        // 正在生成的键和等待结果的回调
+        std::unordered_map<std::string, Fill> Pending;
+        uint64_t NextFill;
+        // 统计由所属线程写入，任意线程读取
+        Counter Hits, Misses, Fills, Coalesced, FillTimeouts, Expired, Evicted, Count, Bytes;
+
+        Shard(EventLoop* loop): Loop(loop), Next(nullptr), NextFill(0), Hits(0), Misses(0), Fills(0), Coalesced(0),
+                                FillTimeouts(0), Expired(0), Evicted(0), Count(0), Bytes(0) {}
+    };
+
+    // 分片链表，只在头部插入，遍历不加锁
+    std::atomic<Shard*> _Shards;
+    uint64_t _ShardBytes;
+    uint32_t _TtlMs;
+    uint32_t _FillTimeoutMs;
+
+private:
+    static void Add(Counter& counter, int64_t n){
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // 分片只由所属线程创建，因此同一个循环不会创建两个分片
+    Shard* GetShard(EventLoop* loop){
+        loop->AssertInLoop();
+        for(Shard* shard = _Shards.load(std::memory_order_acquire); shard; shard = shard->Next){
+            if(shard->Loop == loop){
+                return shard;
+            }
+        }
+        // 分片一直记录循环的指针，此后线程池不会回收该循环
+        loop->Pin();
+        Shard* shard = new Shard(loop);
+        shard->Next = _Shards.load(std::memory_order_relaxed);
+        while(!_Shards.compare_exchange_weak(shard->Next, shard, std::memory_order_release, std::memory_order_relaxed));
+        return shard;
+    }
+
+    static uint64_t EntrySize(const std::string& key, const Blob& data){
+        return key.size() + data->size();
+    }
+
+    void EraseEntry(Shard* shard, std::unordered_map<std::string, Entry>::iterator iter){
+        Add(shard->Bytes, -(int64_t)EntrySize(iter->first, iter->second.Data));
+        Add(shard->Count, -1);
+        shard->Lru.erase(iter->second.Position);
+        shard->Entries.erase(iter);
+    }
+
+    void CompleteInLoop(EventLoop* loop, const std::string& key, const Blob& blob, uint32_t ttlMs){
+        Shard* shard = GetShard(loop);
+        if(blob){
+            Insert(loop, key, blob, ttlMs);
+        }
+        auto iter = shard->Pending.find(key);
+        if(iter == shard->Pending.end()){
+            return;
+        }
+        // 超时后重新发起的生成也可以直接使用这个结果
+        if(iter->second.Timer.Valid()){
+            loop->CancelTimer(iter->second.Timer);
+        }
+        std::vector<Callback> waiters = std::move(iter->second.Waiters);
+        shard->Pending.erase(iter);
+        for(auto& cb : waiters){
+            cb(blob);
+        }
+    }
+
+    // 生成超时：不再等待这次生成，之后同一个键的请求重新发起生成
+    void ExpireFillInLoop(EventLoop* loop, const std::string& key, uint64_t id){
+        Shard* shard = GetShard(loop);
+        auto iter = shard->Pending.find(key);
+        if(iter == shard->Pending.end() || iter->second.Id != id){
+            return;
+        }
+        std::vector<Callback> waiters = std::move(iter->second.Waiters);
+        shard->Pending.erase(iter);
+        Add(shard->FillTimeouts, 1);
+        for(auto& cb : waiters){
+            cb(nullptr);
+        }
+    }
 
-class LoopThreadPool
-{
-private:
-    int _ThreadCount;
-    int _NextIdx;
-    EventLoop* _BaseLoop;
-    std::vector<LoopThread*> _Threads;
-    std::vector<EventLoop*> _Loops;
 public:
-    LoopThreadPool(EventLoop* baseloop)
-        :_ThreadCount(0)
-        ,_NextIdx(0)
-        ,_BaseLoop(baseloop)
+    ResponseCache(uint64_t shardBytes = RESPONSE_CACHE_SHARD_BYTES, uint32_t ttlMs = RESPONSE_CACHE_TTL_MS):
+        _Shards(nullptr),
+        _ShardBytes(shardBytes),
+        _TtlMs(ttlMs),
+        _FillTimeoutMs(RESPONSE_CACHE_FILL_TIMEOUT_MS)
     {}
 
-    void SetThreadCount(int count){
-        _ThreadCount = count;
-    }
-    void Create(){
-        if(_ThreadCount > 0){
-            _Threads.resize(_ThreadCount);
-            _Loops.resize(_ThreadCount);
-            for(int i = 0; i < _ThreadCount; ++i){
-                _Threads[i] = new LoopThread();
-                _Loops[i] = _Threads[i]->GetLoop();
-            }
-        }
-        return;
-    }
-    EventLoop* NextLoop(){
-        if(_ThreadCount == 0){
-            return _BaseLoop;
+    // 需在所有事件循环停止访问之后销毁
+    ~ResponseCache(){
+        Shard* shard = _Shards.load();
+        while(shard){
+            Shard* next = shard->Next;
+            delete shard;
+            shard = next;
         }
-        _NextIdx = (_NextIdx + 1) % _ThreadCount;
-        return _Loops[_NextIdx];
     }
-};
 
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
 
+    // 生成的时限（毫秒），0 表示一直等待；fill 从未调用 done 时，该键的请求都会挂起
+    void SetFillTimeout(uint32_t ms){
+        _FillTimeoutMs = ms;
+    }
 
-class Any
-{
-private:
-    
-    class PlaceHolder
-    {
-    public:
-        virtual ~PlaceHolder() {}
-        virtual const std::type_info& type() = 0;
-        virtual PlaceHolder* clone() = 0;
-    };
+    // 以下接口都只能在 loop 所属线程中调用（通常是 conn->GetLoop()）
 
-    template<class T>
-    class Holder : public PlaceHolder
-    {
-    public:
-        Holder(const T& data)
-            :_data(data)
-        {}
-        ~Holder() = default;
-        const std::type_info& type(){
-            return typeid(T);
+    // 查找有效的条目，未命中或已过期时返回空指针
+    Blob Lookup(EventLoop* loop, const std::string& key){
+        Shard* shard = GetShard(loop);
+        auto iter = shard->Entries.find(key);
+        if(iter == shard->Entries.end()){
+            Add(shard->Misses, 1);
+            return nullptr;
         }
-        PlaceHolder* clone(){
-            return new Holder(_data);
+        if(MonotonicUs() >= iter->second.ExpireUs){
+            EraseEntry(shard, iter);
+            Add(shard->Expired, 1);
+            Add(shard->Misses, 1);
+            return nullptr;
         }
-    public:
-        T _data;
-        
-    };
-
-private:
-    PlaceHolder* _content;
+        shard->Lru.splice(shard->Lru.begin(), shard->Lru, iter->second.Position);
+        Add(shard->Hits, 1);
+        return iter->second.Data;
+    }
 
-public:
-    Any(): _content(nullptr){}
+    // 插入或替换条目，超出分片容量时淘汰最久未使用的条目
+    void Insert(EventLoop* loop, const std::string& key, const Blob& blob, uint32_t ttlMs = 0){
+        Shard* shard = GetShard(loop);
+        auto iter = shard->Entries.find(key);
+        if(iter != shard->Entries.end()){
+            EraseEntry(shard, iter);
+        }
+        uint64_t size = EntrySize(key, blob);
+        if(size > _ShardBytes){
+            return;
+        }
+        shard->Lru.push_front(key);
+        shard->Entries.emplace(key, Entry{blob, MonotonicUs() + (ttlMs ? ttlMs : _TtlMs) * 1000ULL, shard->Lru.begin()});
+        Add(shard->Bytes, size);
+        Add(shard->Count, 1);
+        while(shard->Bytes.load(std::memory_order_relaxed) > _ShardBytes){
+            EraseEntry(shard, shard->Entries.find(shard->Lru.back()));
+            Add(shard->Evicted, 1);
+        }
+    }
 
-    template <typename T>
-    Any(const T &data) : _content(new Holder<T>(data)) {}
-    Any(const Any &other) : _content(other._content ? other._content->clone() : nullptr) {}
-    ~Any()
-    {
-        if (_content)
-            delete _content;
+    void Erase(EventLoop* loop, const std::string& key){
+        Shard* shard = GetShard(loop);
+        auto iter = shard->Entries.find(key);
+        if(iter != shard->Entries.end()){
+            EraseEntry(shard, iter);
+        }
     }
 
-    // 若 content 不为空，则返回 content 的类型信息，否则返回 void 类型信息
-    const std::type_info &type(){
-        return _content ? _content->type() : typeid(void);
+    // 查找，命中时直接调用 cb；未命中时只有第一个请求调用 fill 生成响应，其余请求等待同一结果
+    // fill 可以同步调用 done，也可以交给其他线程（如计算线程池）完成后再调用，cb 总是在 loop 所属线程中执行
+    // cb 可能在 Get 返回之后才执行，HTTP 处理函数中配合 HttpResponse::Defer 使用
+    void Get(EventLoop* loop, const std::string& key, const Filler& fill, const Callback& cb){
+        Blob blob = Lookup(loop, key);
+        if(blob){
+            return cb(blob);
+        }
+        Shard* shard = GetShard(loop);
+        auto iter = shard->Pending.find(key);
+        if(iter != shard->Pending.end()){
+            Add(shard->Coalesced, 1);
+            iter->second.Waiters.push_back(cb);
+            return;
+        }
+        Fill& pending = shard->Pending[key];
+        pending.Id = ++shard->NextFill;
+        pending.Waiters.push_back(cb);
+        if(_FillTimeoutMs > 0){
+            pending.Timer = loop->RunAfter(_FillTimeoutMs, std::bind(&ResponseCache::ExpireFillInLoop, this, loop, key, pending.Id));
+        }
+        Add(shard->Fills, 1);
+        fill([this, loop, key](const Blob& result, uint32_t ttlMs){
+            loop->RunInLoop(std::bind(&ResponseCache::CompleteInLoop, this, loop, key, result, ttlMs));
+        });
     }
 
-    // 获取 data 指针
-    template<typename T>
-    T* get(){
-        assert(typeid(T) == _content->type());
-        return &(static_cast<Holder<T>*>(_content)->_data);
+    // 各分片统计之和，可在任意线程调用
+    ResponseCacheStatsSnapshot GetStats(){
+        ResponseCacheStatsSnapshot stats = ResponseCacheStatsSnapshot();
+        for(Shard* shard = _Shards.load(std::memory_order_acquire); shard; shard = shard->Next){
+            stats.Hits += shard->Hits.load(std::memory_order_relaxed);
+            stats.Misses += shard->Misses.load(std::memory_order_relaxed);
+            stats.Fills += shard->Fills.load(std::memory_order_relaxed);
+            stats.Coalesced += shard->Coalesced.load(std::memory_order_relaxed);
+            stats.FillTimeouts += shard->FillTimeouts.load(std::memory_order_relaxed);
+            stats.Expired += shard->Expired.load(std::memory_order_relaxed);
+            stats.Evicted += shard->Evicted.load(std::memory_order_relaxed);
+            stats.Entries += shard->Count.load(std::memory_order_relaxed);
+            stats.Bytes += shard->Bytes.load(std::memory_order_relaxed);
+        }
+        return stats;
     }
 };
 
 
-class Connection;
-
 typedef enum { DISCONNECTED, CONNECTING, CONNECTDE, DISCONNECTING } Connstatus;
-using PtrConnection = std::shared_ptr<Connection>;
 
 
 class Connection: public std::enable_shared_from_this<Connection>{
+    friend class ComputePool;
 private:
     int _Sockfd;
     uint64_t _ConnId;
     bool _EnableInactiveRelease;
-    EventLoop* _Loop;
+    uint32_t _InactiveTimeout;
+    // 空闲超时定时器节点，嵌入在连接中，每次事件刷新时不分配内存
+    TimerTask _IdleTimer;
+    // 读期限：输入缓冲区中有数据时，需要在期限内取得进展（消息回调取走数据），取走后重新计时
+    // 写期限：输出缓冲区中出现数据起，需要在期限内全部发出
+    // 单位为毫秒，0 表示不启用；只收到零散数据、没有取走任何数据不会延长读期限
+    uint32_t _ReadDeadline;
+    uint32_t _WriteDeadline;
+    TimerTask _ReadTimer;
+    TimerTask _WriteTimer;
+    // 上层有意把数据留在输入缓冲区中（如排在进行中的响应之后的请求），期间读期限暂停
+    bool _InputHeld;
+    // 连接可以在事件循环之间迁移，其他线程通过它找到当前所属的循环
+    std::atomic<EventLoop*> _Loop;
+    // 是否已挂载到 _Loop 上，迁移途中为 false
+    std::atomic<bool> _Attached;
+    // 迁移负载参考：上次统计以来的收发字节数
+    std::atomic<uint64_t> _Traffic;
+    // 每次 recv 的大小：读满时翻倍，连续读不到一半时减半，按连接的消息大小自适应
+    uint32_t _ReadSize;
+    uint32_t _SmallReads;
+    // 写合并：同一轮中多次发送的数据先追加到输出缓冲区，在一轮结束时一次发出
+    // _Cork 开启时，若还有未读完的输入（流水线请求），用 TCP_CORK 把本轮输出与下一轮合并成满 MSS 的报文
+    bool _Coalesce;
+    bool _Cork;
+    bool _Dirty;
+    bool _Corked;
+    bool _MoreInput;
+    // 输出队列中不经过输出缓冲区的数据段，排在加入时输出缓冲区中已有的数据之后
+    // 文件段由 sendfile 发出；内存段引用共享的只读数据（如缓存的响应），与输出缓冲区的数据一起用 sendmsg 发出
+    struct OutputSegment{
+        std::shared_ptr<const void> Owner;  // 发送完成前保持数据或文件描述符有效
+        int Fd;             // 内存段为 -1
+        const char* Data;   // 文件段为空
+        off_t Offset;
+        uint64_t Length;
+        uint64_t Mark;      // 该段之前的输出缓冲区数据发完时，_OutputConsumed 的值
+    };
+    std::deque<OutputSegment> _OutputSegments;
+    uint64_t _OutputSegmentBytes;
+    // 累计从输出缓冲区发出的字节数
+    uint64_t _OutputConsumed;
+    bool _NonBlock;
+    // 输出水位：待发送的数据（含数据段）超过高水位时以 false 调用回调，之后降到低水位及以下时以 true 调用
+    // 生产者据此暂停和恢复写入；高水位为 0 表示不启用
+    uint64_t _HighWatermark;
+    uint64_t _LowWatermark;
+    bool _AboveWatermark;
+    // 分配连接的对象池，连接释放时缓冲区存储归还到这里，不使用对象池时为空
+    std::shared_ptr<SlotPool> _Pool;
     Socket _Socket;
     Channel _Channel;
     Buffer _InputBuffer;
     Buffer _OutputBuffer;
     Connstatus _Status;
-    PtrConnection _Ptr;
-    Any _Context;
+    Context _Context;
 
     using ConnectionCallback = std::function<void(const PtrConnection&)>;
     using MessageCallback = std::function<void(const PtrConnection&, Buffer*)>;
     using CloseCallback = std::function<void(const PtrConnection&)>;
     using AnyEventCallback = std::function<void(const PtrConnection&)>;
+public:
+    using WatermarkCallback = std::function<void(const PtrConnection&, bool)>;
+    using MigrateCallback = std::function<void(const PtrConnection&, bool)>;
+private:
 
     ConnectionCallback _ConnectionCallback;
     MessageCallback _MessageCallback;
@@ -1156,6 +3237,23 @@ private:
     AnyEventCallback _AnyEventCallback;
 
     CloseCallback _ServerCloseCallback;
+    // 所属循环过载时代替消息回调处理新到的数据，例如直接回复“繁忙”，未设置时照常处理
+    MessageCallback _OverloadCallback;
+    WatermarkCallback _WatermarkCallback;
+    // 迁移时通知上层协议：在旧循环中摘下时以 false 调用，挂载到新循环后以 true 调用
+    // 上层挂在循环上的状态（如自己的定时器）随之从旧循环摘下、在新循环重新登记
+    MigrateCallback _MigrateCallback;
+
+    // 超时回调，未设置时直接关闭连接
+    using DeadlineCallback = std::function<void(const PtrConnection&)>;
+    DeadlineCallback _ReadDeadlineCallback;
+    DeadlineCallback _WriteDeadlineCallback;
+    DeadlineCallback _IdleCallback;
+
+    // 卸载到计算线程池的任务按序号依次交付结果
+    uint64_t _OffloadIssued;
+    uint64_t _OffloadDelivered;
+    std::map<uint64_t, std::function<void()>> _OffloadReady;
 
 private:
     void HandleRead();
@@ -1165,22 +3263,138 @@ private:
     void HandleEvent();
 
     void EstablishedInLoop(){
+        assert(_Status == CONNECTING);
+        _Status = CONNECTDE;
+        _Channel.EnableRead();
+        if(_ConnectionCallback){
+            _ConnectionCallback(shared_from_this());
+        }
         if(_EnableInactiveRelease){
-            _Loop->TimerRefresh(_ConnId);
+            RefreshIdleTimer();
         }
         if(_AnyEventCallback){
             _AnyEventCallback(shared_from_this());
         }
     }
 
+    void AdaptReadSize(size_t n){
+        if(n >= _ReadSize){
+            _ReadSize = std::min<uint32_t>(_ReadSize * 2, READ_SIZE_MAX);
+            _SmallReads = 0;
+        }
+        else if(n < _ReadSize / 2 && ++_SmallReads >= READ_SIZE_SHRINK_ROUNDS){
+            _ReadSize = std::max<uint32_t>(_ReadSize / 2, READ_SIZE_MIN);
+            _SmallReads = 0;
+        }
+        else if(n >= _ReadSize / 2){
+            _SmallReads = 0;
+        }
+        _Channel.SetBulk(_ReadSize >= READ_SIZE_BULK);
+    }
+
+    void RefreshIdleTimer(){
+        GetLoop()->TimerSchedule(&_IdleTimer, _InactiveTimeout * 1000ULL);
+    }
+
+    // 超时处理：定时器不持有连接，执行期间由这里保证连接存活
+    void OnDeadline(const DeadlineCallback& cb){
+        PtrConnection self = shared_from_this();
+        if(cb){
+            return cb(self);
+        }
+        ReleaseInLoop();
+    }
+
+    void OnIdleTimeout(){
+        GetLoop()->GetStats().AddIdleTimeout();
+        OnDeadline(_IdleCallback);
+    }
+
+    void OnReadTimeout(){
+        GetLoop()->GetStats().AddReadTimeout();
+        OnDeadline(_ReadDeadlineCallback);
+    }
+
+    void OnWriteTimeout(){
+        GetLoop()->GetStats().AddWriteTimeout();
+        if(!_WriteDeadlineCallback){
+            // 对端读得太慢，内核发送缓冲区中的数据也不再等待发出
+            _Socket.AbortOnClose();
+        }
+        OnDeadline(_WriteDeadlineCallback);
+    }
+
+    // 缓冲区从空变为非空时开始计时，清空或暂停时停止；progress 表示取走了数据，从现在重新计时
+    void UpdateReadDeadline(bool progress = false){
+        if(_ReadDeadline == 0 || _Status == DISCONNECTED || _InputBuffer.GetReadableSize() == 0 || _InputHeld){
+            return GetLoop()->TimerUnschedule(&_ReadTimer);
+        }
+        if(progress){
+            GetLoop()->TimerUnschedule(&_ReadTimer);
+        }
+        if(!_ReadTimer.IsLinked()){
+            GetLoop()->TimerSchedule(&_ReadTimer, _ReadDeadline);
+        }
+    }
+
+    void UpdateWriteDeadline(){
+        if(_WriteDeadline == 0 || _Status == DISCONNECTED || OutputEmpty()){
+            return GetLoop()->TimerUnschedule(&_WriteTimer);
+        }
+        if(!_WriteTimer.IsLinked()){
+            GetLoop()->TimerSchedule(&_WriteTimer, _WriteDeadline);
+        }
+    }
+
+    void SetReadDeadlineInLoop(uint32_t ms, const DeadlineCallback& cb){
+        _ReadDeadline = ms;
+        _ReadDeadlineCallback = cb;
+        GetLoop()->TimerUnschedule(&_ReadTimer);
+        UpdateReadDeadline();
+    }
+
+    void HoldInputInLoop(bool hold){
+        if(_InputHeld == hold){
+            return;
+        }
+        _InputHeld = hold;
+        UpdateReadDeadline(true);
+    }
+
+    void SetIdleCallbackInLoop(const DeadlineCallback& cb){
+        _IdleCallback = cb;
+    }
+
+    void SetWriteDeadlineInLoop(uint32_t ms, const DeadlineCallback& cb){
+        _WriteDeadline = ms;
+        _WriteDeadlineCallback = cb;
+        GetLoop()->TimerUnschedule(&_WriteTimer);
+        UpdateWriteDeadline();
+    }
+
     void ReleaseInLoop(){
+        // 关闭流程可能被多个事件重复触发
+        if(_Status == DISCONNECTED){
+            return;
+        }
+        GetLoop()->GetStats().RemoveConnection();
         _Status = DISCONNECTED;
         _Channel.Remove();
         _Socket.Close();
+        _OutputSegments.clear();
+        _OutputSegmentBytes = 0;
+        // 通知流式写入器连接已关闭，此时 IsConnected 为 false
+        WatermarkCallback watermarkCallback = std::move(_WatermarkCallback);
+        _WatermarkCallback = WatermarkCallback();
+        if(watermarkCallback){
+            watermarkCallback(shared_from_this(), false);
+        }
 
-        if(_Loop->HasTimer(_ConnId)){
+        if(_IdleTimer.IsLinked()){
             CancelInactiveReleaseInLoop();
         }
+        GetLoop()->TimerUnschedule(&_ReadTimer);
+        GetLoop()->TimerUnschedule(&_WriteTimer);
         if(_CloseCallback){
             _CloseCallback(shared_from_this());
         }
@@ -1190,12 +3404,158 @@ private:
     }
 
     void SendInLoop(Buffer& buffer){
+        return AppendOutputInLoop(buffer.GetReadIndex(), buffer.GetReadableSize());
+    }
+
+    void AppendOutputInLoop(const char* data, size_t len){
+        if(_Status == DISCONNECTED){
+            return;
+        }
+        _OutputBuffer.WritePush(data, len);
+        ScheduleOutputInLoop();
+    }
+
+    // 输出缓冲区中有新数据：开启写事件，或在写合并时登记到本轮的待发送列表
+    void ScheduleOutputInLoop(){
         if(_Status == DISCONNECTED){
             return;
         }
-        _OutputBuffer.WriteBufferPush(buffer);
-        if(_Channel.WriteAble() == false){
-            _Channel.EnableWrite();
+        if(_Channel.IsWriting() == false){
+            if(!_Coalesce){
+                _Channel.EnableWrite();
+            }
+            else if(!_Dirty){
+                _Dirty = true;
+                GetLoop()->AddDirty(shared_from_this());
+            }
+        }
+        UpdateWriteDeadline();
+        CheckWatermark();
+    }
+
+    void CheckWatermark(){
+        if(_HighWatermark == 0 || !_WatermarkCallback){
+            return;
+        }
+        // 回调中可能重新设置水位，先复制一份
+        uint64_t size = GetOutputSize();
+        if(!_AboveWatermark && size > _HighWatermark){
+            _AboveWatermark = true;
+            WatermarkCallback cb = _WatermarkCallback;
+            cb(shared_from_this(), false);
+        }
+        else if(_AboveWatermark && size <= _LowWatermark){
+            _AboveWatermark = false;
+            WatermarkCallback cb = _WatermarkCallback;
+            cb(shared_from_this(), true);
+        }
+    }
+
+    bool OutputEmpty(){
+        return _OutputBuffer.GetReadableSize() == 0 && _OutputSegments.empty();
+    }
+
+    // 发出 n 字节后推进输出缓冲区和内存段
+    void AdvanceOutput(uint64_t n){
+        while(n > 0){
+            uint64_t buffered = _OutputSegments.empty() ? _OutputBuffer.GetReadableSize()
+                                                        : _OutputSegments.front().Mark - _OutputConsumed;
+            if(buffered > 0){
+                uint64_t take = std::min(buffered, n);
+                _OutputBuffer.UpdateReadIndex(take);
+                _OutputConsumed += take;
+                n -= take;
+                continue;
+            }
+            OutputSegment& segment = _OutputSegments.front();
+            uint64_t take = std::min(segment.Length, n);
+            segment.Offset += take;
+            segment.Length -= take;
+            _OutputSegmentBytes -= take;
+            n -= take;
+            if(segment.Length == 0){
+                _OutputSegments.pop_front();
+            }
+        }
+    }
+
+    // 按顺序发送输出缓冲区中的数据和各数据段，直到全部发出或内核发送缓冲区已满
+    // 输出缓冲区和内存段合并成一次 sendmsg，遇到文件段时改用 sendfile
+    // 返回本次发出的字节数，出错时返回 -1
+    ssize_t SendOutputInLoop(){
+        ssize_t total = 0;
+        while(true){
+            struct iovec iov[OUTPUT_IOV_MAX];
+            int count = 0;
+            uint64_t expected = 0;
+            bool file = false;
+            const char* base = _OutputBuffer.GetReadIndex();
+            uint64_t consumed = _OutputConsumed;
+            auto iter = _OutputSegments.begin();
+            for(; iter != _OutputSegments.end() && count + 2 <= OUTPUT_IOV_MAX; ++iter){
+                uint64_t before = iter->Mark - consumed;
+                if(before > 0){
+                    iov[count++] = {(void*)base, before};
+                    base += before;
+                    consumed += before;
+                    expected += before;
+                }
+                if(iter->Fd >= 0){
+                    file = true;
+                    break;
+                }
+                iov[count++] = {(void*)(iter->Data + iter->Offset), iter->Length};
+                expected += iter->Length;
+            }
+            if(iter == _OutputSegments.end()){
+                uint64_t rest = _OutputBuffer.GetReadableSize() - (consumed - _OutputConsumed);
+                if(rest > 0){
+                    iov[count++] = {(void*)base, rest};
+                    expected += rest;
+                }
+            }
+            if(count > 0){
+                // 后面紧跟文件段时（如响应头部）用 MSG_MORE 与文件数据合并成满的报文
+                ssize_t ret = _Socket.SendVector(iov, count, MSG_DONTWAIT | (file ? MSG_MORE : 0));
+                if(ret < 0){
+                    return Socket::IsRetryError(errno) ? total : -1;
+                }
+                AdvanceOutput(ret);
+                total += ret;
+                if((uint64_t)ret < expected){
+                    return total;
+                }
+            }
+            if(_OutputSegments.empty()){
+                return total;
+            }
+            OutputSegment& segment = _OutputSegments.front();
+            if(segment.Fd < 0 || segment.Mark != _OutputConsumed){
+                // iovec 数量达到上限，继续下一批
+                continue;
+            }
+            ssize_t ret = _Socket.SendFile(segment.Fd, &segment.Offset, std::min<uint64_t>(segment.Length, INT_MAX));
+            if(ret < 0){
+                return Socket::IsRetryError(errno) ? total : -1;
+            }
+            // 文件在发送期间被截断，已经发出的响应头部无法兑现，只能关闭连接
+            if(ret == 0){
+                return -1;
+            }
+            segment.Length -= ret;
+            _OutputSegmentBytes -= ret;
+            total += ret;
+            if(segment.Length > 0){
+                return total;
+            }
+            _OutputSegments.pop_front();
+        }
+    }
+
+    void SetCorked(bool on){
+        if(_Corked != on){
+            _Socket.Cork(on);
+            _Corked = on;
         }
     }
 
@@ -1207,37 +3567,118 @@ private:
             }
         }
 
-        if(_OutputBuffer.GetReadableSize() > 0){
-            if(_Channel.WriteAble() == false){
+        if(!OutputEmpty()){
+            if(_Channel.IsWriting() == false){
                 _Channel.EnableWrite();
             }
         }
-        if(_OutputBuffer.GetReadableSize() == 0){
+        if(OutputEmpty()){
             Release();
         }
     }
 
     void EnableInactiveReleaseInLoop(uint32_t timeout){
         _EnableInactiveRelease = true;
-        if(_Loop->HasTimer(_ConnId)){
-            return _Loop->TimerRefresh(_ConnId);
-        }
-        _Loop->TimerAdd(_ConnId, timeout, std::bind(&Connection::ReleaseInLoop, shared_from_this()));
+        _InactiveTimeout = timeout;
+        RefreshIdleTimer();
     }
     
     void CancelInactiveReleaseInLoop(){
         _EnableInactiveRelease = false;
-        if(_Loop->HasTimer(_ConnId)){
-            _Loop->TimerCancel(_ConnId);
+        GetLoop()->TimerUnschedule(&_IdleTimer);
+    }
+
+    // 在连接当前所属的事件循环中执行任务
+    // 迁移途中投递到旧循环或先于挂载到达新循环的任务会被转发，排在挂载之后执行，因此不会乱序
+    void RunInOwnerLoop(const std::function<void()>& task){
+        EventLoop* loop = GetLoop();
+        if(loop->IsInLoop() && _Attached){
+            return task();
         }
+        return QueueInOwnerLoop(task);
     }
 
-    void UpgradeInLoop(const Any& context,
-                const ConnectionCallback& connectionCallback,
+    void QueueInOwnerLoop(const std::function<void()>& task){
+        GetLoop()->QueueInLoop(std::bind(&Connection::ForwardInLoop, shared_from_this(), task));
+    }
+
+    void ForwardInLoop(const std::function<void()>& task){
+        return RunInOwnerLoop(task);
+    }
+
+    // 在旧循环中执行：从旧循环上摘下，再交给新循环挂载
+    // 总是通过任务池执行，此时本轮的就绪事件已经处理完，旧循环不会再分发该连接的事件
+    void MigrateInLoop(EventLoop* target){
+        EventLoop* source = GetLoop();
+        if(target == source || _Status != CONNECTDE){
+            return;
+        }
+        _Channel.Remove();
+        // 待统一发送的数据和未解除的 cork 交给新循环的可写事件处理
+        if(_Dirty || _Corked){
+            _Dirty = false;
+            _Channel.SetEvents(_Channel.GetEvents() | EPOLLOUT);
+        }
+        source->TimerUnschedule(&_IdleTimer);
+        source->TimerUnschedule(&_ReadTimer);
+        source->TimerUnschedule(&_WriteTimer);
+        if(_MigrateCallback){
+            _MigrateCallback(shared_from_this(), false);
+        }
+        source->GetStats().RemoveConnection();
+        target->GetStats().AddConnection();
+        // 连接表中的登记随连接一起迁移
+        bool registered = source->RemoveConnection(_ConnId);
+
+        _Attached = false;
+        _Channel.SetLoop(target);
+        target->Pin();
+        _Loop.store(target, std::memory_order_release);
+        source->Unpin();
+        target->QueueInLoop(std::bind(&Connection::AttachInLoop, shared_from_this(), registered));
+    }
+
+    // 在新循环中执行：重新注册事件监控和定时器，输入输出缓冲区和上下文随对象保留
+    void AttachInLoop(bool registered){
+        _Attached = true;
+        // 迁移途中已经释放：释放时已从连接表中注销，不能再登记，否则连接表会一直持有连接
+        if(_Status == DISCONNECTED){
+            return;
+        }
+        if(registered){
+            GetLoop()->AddConnection(shared_from_this(), _ConnId);
+        }
+        _Channel.Update();
+        if(_EnableInactiveRelease){
+            RefreshIdleTimer();
+        }
+        // 读写期限在新循环中重新计时
+        UpdateReadDeadline();
+        UpdateWriteDeadline();
+        if(_MigrateCallback){
+            _MigrateCallback(shared_from_this(), true);
+        }
+    }
+
+    // 计算结果可能乱序返回，先暂存，按提交顺序执行
+    void CompleteOffloadInLoop(uint64_t seq, const std::function<void()>& done){
+        _OffloadReady[seq] = done;
+        for(auto iter = _OffloadReady.begin();
+            iter != _OffloadReady.end() && iter->first == _OffloadDelivered;
+            iter = _OffloadReady.begin()){
+            std::function<void()> cb = std::move(iter->second);
+            _OffloadReady.erase(iter);
+            ++_OffloadDelivered;
+            if(cb){
+                cb();
+            }
+        }
+    }
+
+    void UpgradeInLoop(const ConnectionCallback& connectionCallback,
                 const MessageCallback& messageCallback,
                 const CloseCallback& closeCallback,
                 const AnyEventCallback& anyEventCallback){
-        _Context = context;
         _ConnectionCallback = connectionCallback;
         _MessageCallback = messageCallback;
         _CloseCallback = closeCallback;
@@ -1245,21 +3686,52 @@ private:
     }
 
 public:
-    Connection(EventLoop* loop, int sockfd, uint64_t connId):
+    Connection(EventLoop* loop, int sockfd, uint64_t connId,
+               const std::shared_ptr<SlotPool>& pool = std::shared_ptr<SlotPool>()):
         _Sockfd(sockfd),
         _ConnId(connId),
         _EnableInactiveRelease(false),
+        _InactiveTimeout(0),
+        _IdleTimer(connId, 0, std::bind(&Connection::OnIdleTimeout, this)),
+        _ReadDeadline(0),
+        _WriteDeadline(0),
+        _ReadTimer(connId, 0, std::bind(&Connection::OnReadTimeout, this)),
+        _WriteTimer(connId, 0, std::bind(&Connection::OnWriteTimeout, this)),
+        _InputHeld(false),
         _Loop(loop),
+        _Attached(true),
+        _Traffic(0),
+        _ReadSize(READ_SIZE_INIT),
+        _SmallReads(0),
+        _Coalesce(true),
+        _Cork(false),
+        _Dirty(false),
+        _Corked(false),
+        _MoreInput(false),
+        _OutputSegmentBytes(0),
+        _OutputConsumed(0),
+        _NonBlock(false),
+        _HighWatermark(0),
+        _LowWatermark(0),
+        _AboveWatermark(false),
+        _Pool(pool),
         _Socket(sockfd),
         _Channel(loop, sockfd),
-        _Status(DISCONNECTED),
-        _Ptr(this),
+        _InputBuffer(_Pool ? _Pool->TakeBuffer() : std::vector<char>()),
+        _OutputBuffer(_Pool ? _Pool->TakeBuffer() : std::vector<char>()),
+        _Status(CONNECTING),
         _Context(),
         _ConnectionCallback(),
         _MessageCallback(),
         _CloseCallback(),
         _AnyEventCallback(),
-        _ServerCloseCallback(){
+        _ServerCloseCallback(),
+        _OffloadIssued(0),
+        _OffloadDelivered(0){
+            // 在分配时就计入连接数，避免突发建连时负载均衡看不到尚未建立完成的连接
+            GetLoop()->GetStats().AddConnection();
+            // 连接对象存在期间计入所属循环的引用，迁移时转到新循环
+            GetLoop()->Pin();
             _Channel.SetReadCallback(std::bind(&Connection::HandleRead, this));
             _Channel.SetWriteCallback(std::bind(&Connection::HandleWrite, this));
             _Channel.SetErrorCallback(std::bind(&Connection::HandleError, this));
@@ -1269,72 +3741,273 @@ public:
 
     ~Connection(){
         DBG_LOG("RELEASE CONNECTION:%p", this);
+        GetLoop()->Unpin();
+        if(_Pool){
+            _Pool->ReturnBuffer(_InputBuffer.TakeStorage());
+            _Pool->ReturnBuffer(_OutputBuffer.TakeStorage());
+        }
     }
 
     int GetFd() const{ return _Sockfd; }
     int GetId() const{ return _ConnId; }
+    EventLoop* GetLoop() const{ return _Loop.load(std::memory_order_acquire); }
+    // 返回上次调用以来的收发字节数并清零
+    uint64_t TakeTraffic(){ return _Traffic.exchange(0, std::memory_order_relaxed); }
     bool IsConnected() const{ return _Status == CONNECTDE; }
 
-    void SetContext(const Any& context){ _Context = context; }
-    Any* GetContext(){ return &_Context; }
+    // 上下文只能在连接所属线程中访问（或在连接建立之前设置）
+    template<class T>
+    void SetContext(T&& context){ _Context.Set(std::forward<T>(context)); }
+    template<class T, class... Args>
+    T& EmplaceContext(Args&&... args){ return _Context.Emplace<T>(std::forward<Args>(args)...); }
+    Context* GetContext(){ return &_Context; }
     
     void SetConnectedCallback(const ConnectionCallback& cb) { _ConnectionCallback = cb;  }
     void SetMessageCallback(const MessageCallback& cb)      { _MessageCallback = cb;     }
     void SetCloseCallback(const CloseCallback& cb)          { _CloseCallback = cb;       }
     void SetAnyEventCallback(const AnyEventCallback& cb)    { _AnyEventCallback = cb;    }
     void SetServerCloseCallback(const CloseCallback& cb)    { _ServerCloseCallback = cb; }
+    void SetOverloadCallback(const MessageCallback& cb)     { _OverloadCallback = cb; }
+
+    // 设置输出水位和回调（见 _HighWatermark），high 为 0 时关闭；只能在连接所属线程中调用
+    // 连接释放时以 false 再调用一次，回调中可以用 IsConnected 区分
+    void SetWatermark(uint64_t high, uint64_t low, const WatermarkCallback& cb){
+        _HighWatermark = high;
+        _LowWatermark = std::min(low, high);
+        _AboveWatermark = false;
+        _WatermarkCallback = cb;
+    }
+
+    // 设置迁移回调（见 _MigrateCallback），只能在连接所属线程中调用
+    void SetMigrateCallback(const MigrateCallback& cb){
+        _MigrateCallback = cb;
+    }
 
     void Established(){
-        _Loop->RunInLoop(std::bind(&Connection::EstablishedInLoop, this));
+        RunInOwnerLoop(std::bind(&Connection::EstablishedInLoop, this));
     }
 
     void Send(const char* data, size_t len){
+        // 在所属线程中直接追加到输出缓冲区，不需要构造任务
+        if(_Attached && GetLoop()->IsInLoop()){
+            return AppendOutputInLoop(data, len);
+        }
         Buffer buffer;
         buffer.WritePush(data, len);
-        _Loop->RunInLoop(std::bind(&Connection::SendInLoop, this, std::move(buffer)));
+        RunInOwnerLoop(std::bind(&Connection::SendInLoop, this, std::move(buffer)));
+    }
+
+    // 在所属线程中直接访问输入缓冲区，例如暂停处理后重新处理其中剩余的消息
+    Buffer* GetInputBuffer(){
+        GetLoop()->AssertInLoop();
+        return &_InputBuffer;
+    }
+
+    // 在所属线程中直接向输出缓冲区写入（如逐段拼接响应头部），写完调用 CommitOutput 安排发送
+    Buffer* GetOutputBuffer(){
+        GetLoop()->AssertInLoop();
+        return &_OutputBuffer;
+    }
+    void CommitOutput(){
+        GetLoop()->AssertInLoop();
+        ScheduleOutputInLoop();
+    }
+
+    // 把文件的 [offset, offset + length) 排在已有的输出之后，由 sendfile 直接发出，不经过用户态缓冲区
+    // owner 在发送完成或连接释放前一直持有，用来保持 fd 打开；只能在连接所属线程中调用
+    void SendFile(int fd, off_t offset, uint64_t length, const std::shared_ptr<const void>& owner){
+        GetLoop()->AssertInLoop();
+        if(_Status == DISCONNECTED || length == 0){
+            return;
+        }
+        if(!_NonBlock){
+            _Socket.SetNonBlock();
+            _NonBlock = true;
+        }
+        _OutputSegments.push_back(OutputSegment{owner, fd, nullptr, offset, length, _OutputConsumed + _OutputBuffer.GetReadableSize()});
+        _OutputSegmentBytes += length;
+        ScheduleOutputInLoop();
+    }
+
+    // 把 owner 持有的只读数据排在已有的输出之后发送，不拷贝到输出缓冲区
+    // 数据在发送完成前不能被修改；只能在连接所属线程中调用
+    void SendShared(const char* data, size_t len, const std::shared_ptr<const void>& owner){
+        GetLoop()->AssertInLoop();
+        if(_Status == DISCONNECTED || len == 0){
+            return;
+        }
+        _OutputSegments.push_back(OutputSegment{owner, -1, data, 0, len, _OutputConsumed + _OutputBuffer.GetReadableSize()});
+        _OutputSegmentBytes += len;
+        ScheduleOutputInLoop();
+    }
+
+    // 尚未发出的字节数，包括文件段
+    uint64_t GetOutputSize(){
+        return _OutputBuffer.GetReadableSize() + _OutputSegmentBytes;
     }
 
     void Shutdown(){
-        _Loop->RunInLoop(std::bind(&Connection::ShutdownInloop, this));
+        RunInOwnerLoop(std::bind(&Connection::ShutdownInloop, this));
     }
 
     void Release(){
-        _Loop->QueueInLoop(std::bind(&Connection::ReleaseInLoop, this));
+        QueueInOwnerLoop(std::bind(&Connection::ReleaseInLoop, this));
     }
 
     void EnableInactiveRelease(uint32_t timeout){
-        _Loop->RunInLoop(std::bind(&Connection::EnableInactiveReleaseInLoop, this, timeout));
+        RunInOwnerLoop(std::bind(&Connection::EnableInactiveReleaseInLoop, this, timeout));
     }
 
     void CancelInactiveRelease(){
-        _Loop->RunInLoop(std::bind(&Connection::CancelInactiveReleaseInLoop, this));
+        RunInOwnerLoop(std::bind(&Connection::CancelInactiveReleaseInLoop, this));
+    }
+
+    // 空闲超时的回调，未设置时关闭连接
+    void SetIdleCallback(const DeadlineCallback& cb){
+        RunInOwnerLoop(std::bind(&Connection::SetIdleCallbackInLoop, this, cb));
+    }
+    // 是否合并同一轮中的多次发送（默认开启），cork 见 _Cork，需在连接建立前设置
+    void SetWriteCoalescing(bool coalesce, bool cork = false){
+        _Coalesce = coalesce;
+        _Cork = coalesce && cork;
+    }
+
+    // 一轮结束时由所属循环调用，发送本轮追加的数据
+    void FlushInLoop(EventLoop* loop){
+        // 已经迁到其他循环，由新循环负责发送
+        if(GetLoop() != loop){
+            return;
+        }
+        _Dirty = false;
+        bool more = _Cork && _MoreInput;
+        _MoreInput = false;
+        if(_Status == DISCONNECTED || _Channel.IsWriting()){
+            return;
+        }
+        if(more){
+            SetCorked(true);
+        }
+        if(!OutputEmpty()){
+            ssize_t ret = SendOutputInLoop();
+            if(ret < 0){
+                return Release();
+            }
+            loop->GetStats().AddWrite();
+            if(ret > 0){
+                loop->GetStats().AddBytesOut(ret);
+                _Traffic.fetch_add(ret, std::memory_order_relaxed);
+                CheckWatermark();
+            }
+            // 内核发送缓冲区已满，剩余数据等待可写事件
+            if(!OutputEmpty()){
+                return _Channel.EnableWrite();
+            }
+            UpdateWriteDeadline();
+            if(_Status == DISCONNECTING){
+                return Release();
+            }
+        }
+        if(more){
+            // 下一轮没有新的输出时再解除 cork
+            _Dirty = true;
+            loop->AddDirty(shared_from_this());
+            return;
+        }
+        SetCorked(false);
     }
 
-    void Upgrade(const Any& context,
+    // 读写期限，单位为毫秒，0 表示关闭；cb 为空时超时直接关闭连接
+    // 回调中可以自行处理（如回复错误后 Shutdown），不关闭连接时，缓冲区再次从空变为非空时重新计时
+    void SetReadDeadline(uint32_t ms, const DeadlineCallback& cb = DeadlineCallback()){
+        RunInOwnerLoop(std::bind(&Connection::SetReadDeadlineInLoop, this, ms, cb));
+    }
+
+    // 暂停或恢复读期限：数据因服务端自身原因留在输入缓冲区中时暂停，恢复时重新计时
+    void HoldInput(bool hold){
+        RunInOwnerLoop(std::bind(&Connection::HoldInputInLoop, this, hold));
+    }
+
+    void SetWriteDeadline(uint32_t ms, const DeadlineCallback& cb = DeadlineCallback()){
+        RunInOwnerLoop(std::bind(&Connection::SetWriteDeadlineInLoop, this, ms, cb));
+    }
+
+    // 将连接迁移到另一个事件循环，可在任意线程调用
+    // 迁移过程中缓冲区中的数据和发送顺序保持不变，空闲超时定时器在新循环上重新计时
+    void MigrateTo(EventLoop* target){
+        QueueInOwnerLoop(std::bind(&Connection::MigrateInLoop, this, target));
+    }
+
+    // 在连接当前所属的循环中执行任务，可在任意线程调用；迁移途中投递的任务会被转发到新循环
+    void RunInLoop(const std::function<void()>& task){
+        RunInOwnerLoop(task);
+    }
+
+    // 切换协议：替换上下文和各回调，只能在连接所属线程中调用，因此直接执行
+    // 原上下文对象随之销毁，调用方不能再使用之前取得的指针
+    template<class T>
+    void Upgrade(T&& context,
                 const ConnectionCallback& connectionCallback,
                 const MessageCallback& messageCallback,
                 const CloseCallback& closeCallback,
                 const AnyEventCallback& anyEventCallback){
-        _Loop->AssertInLoop();
-        _Loop->RunInLoop(std::bind(&Connection::UpgradeInLoop, this, context, connectionCallback, messageCallback, closeCallback, anyEventCallback));
+        GetLoop()->AssertInLoop();
+        _Context.Set(std::forward<T>(context));
+        UpgradeInLoop(connectionCallback, messageCallback, closeCallback, anyEventCallback);
     }
 };
 
+void ComputePool::Offload(const PtrConnection& conn, const ComputeJob& job){
+    conn->GetLoop()->AssertInLoop();
+    uint64_t seq = conn->_OffloadIssued++;
+    Submit([conn, seq, job](){
+        std::function<void()> done = job();
+        conn->QueueInOwnerLoop(std::bind(&Connection::CompleteOffloadInLoop, conn.get(), seq, done));
+    });
+}
+
 void Connection::HandleRead(){
-    char buffer[65536];
-    ssize_t n = _Socket.RecvNonBlock(buffer, sizeof(buffer));
-    if(n < 0){
+    EventLoop* loop = GetLoop();
+    // 本轮读取预算已用完，大流量连接的数据留在内核中，水平触发下一轮仍会就绪
+    if(_Channel.IsBulk() && loop->ReadBudgetExhausted()){
+        _MoreInput = true;
+        return loop->GetStats().AddDeferredRead();
+    }
+    // 直接读入输入缓冲区，省去一次拷贝
+    _InputBuffer.ExpansionWriteSize(_ReadSize);
+    ssize_t n = _Socket.RecvNonBlock(_InputBuffer.GetWriteIndex(), _ReadSize);
+    if(n < 0 && Socket::IsRetryError(errno)){
+        return;
+    }
+    if(n <= 0){
+        // 对端关闭时不再监控读事件，否则发送剩余数据期间会一直触发
+        if(n == 0){
+            _Channel.DisableRead();
+        }
         return ShutdownInloop();
     }
 
-    _InputBuffer.WritePush(buffer, n);
-    if(_InputBuffer.GetReadableSize() > 0){
-        return _MessageCallback(shared_from_this(), &_InputBuffer);
+    _MoreInput = (size_t)n == _ReadSize;
+    loop->ChargeRead(n);
+    loop->GetStats().AddBytesIn(n);
+    _Traffic.fetch_add(n, std::memory_order_relaxed);
+    _InputBuffer.UpdateWriteIndex(n);
+    AdaptReadSize(n);
+    size_t pending = _InputBuffer.GetReadableSize();
+    if(pending > 0){
+        if(_OverloadCallback && loop->IsOverloaded()){
+            loop->GetStats().AddShedRequest();
+            _OverloadCallback(shared_from_this(), &_InputBuffer);
+        }
+        else{
+            _MessageCallback(shared_from_this(), &_InputBuffer);
+        }
     }
+    // 回调取走了数据（如流水线中总留着半个请求的客户端），期限按没有进展的时间计算
+    UpdateReadDeadline(_InputBuffer.GetReadableSize() < pending);
 }
 
 void Connection::HandleWrite(){
-    ssize_t ret = _Socket.SendNonBlock(_OutputBuffer.GetReadIndex(), _OutputBuffer.GetReadableSize());
+    ssize_t ret = SendOutputInLoop();
     if(ret < 0){
         if(_InputBuffer.GetReadableSize() > 0){
             return _MessageCallback(shared_from_this(), &_InputBuffer);
@@ -1342,9 +4015,15 @@ void Connection::HandleWrite(){
         return Release();
     }
 
-    _OutputBuffer.UpdateReadIndex(ret);
-    if(_OutputBuffer.GetReadableSize() == 0){
+    GetLoop()->GetStats().AddWrite();
+    GetLoop()->GetStats().AddBytesOut(ret);
+    _Traffic.fetch_add(ret, std::memory_order_relaxed);
+    // 恢复回调中可能追加新的输出，之后再判断是否发完
+    CheckWatermark();
+    if(OutputEmpty()){
+        SetCorked(false);
         _Channel.DisableWrite();
+        UpdateWriteDeadline();
         if(_Status == DISCONNECTING){
             return Release();
         }
@@ -1365,7 +4044,7 @@ void Connection::HandleClose(){
 
 void Connection::HandleEvent(){
     if(_EnableInactiveRelease){
-        _Loop->TimerRefresh(_ConnId);
+        RefreshIdleTimer();
     }
     if(_AnyEventCallback){
         _AnyEventCallback(shared_from_this());
@@ -1374,8 +4053,147 @@ void Connection::HandleEvent(){
 
 
 
+// 流式写入器的默认水位
+#define STREAM_HIGH_WATERMARK (256 * 1024)
+#define STREAM_LOW_WATERMARK (64 * 1024)
+
+// 流式写入的分帧方式：原样写入，或按 HTTP/1.1 分块编码
+typedef enum { STREAM_RAW, STREAM_CHUNKED } StreamFraming;
+
+// 绑定到连接的流式写入器，数据边生成边发送，不需要先在内存中拼出完整的响应
+// Write 追加一段数据，待发送的数据超过高水位后返回 false，生产者应暂停，数据发到低水位及以下时调用恢复回调
+// 连接关闭时调用关闭回调，之后的写入被丢弃；结束（End）或连接关闭后调用一次结束回调
+// 只能在连接所属线程中使用，其他线程中的生产者通过 conn->GetLoop()->RunInLoop 投递
+class StreamWriter: public std::enable_shared_from_this<StreamWriter>
+{
+public:
+    using Callback = std::function<void()>;
+
+private:
+    PtrConnection _Conn;
+    StreamFraming _Framing;
+    // 丢弃写入的数据（如 HEAD 请求），只保留流的生命周期
+    bool _Discard;
+    bool _Paused;
+    bool _Ended;
+    bool _Closed;
+    Callback _ResumeCallback;
+    Callback _CloseCallback;
+    Callback _FinishCallback;
+
+private:
+    void OnWatermark(const PtrConnection& conn, bool writable){
+        if(!conn->IsConnected()){
+            return OnClosed();
+        }
+        _Paused = !writable;
+        if(writable && !_Ended && _ResumeCallback){
+            _ResumeCallback();
+        }
+    }
+
+    void OnClosed(){
+        if(_Closed || _Ended){
+            return;
+        }
+        _Closed = true;
+        _Paused = true;
+        if(_CloseCallback){
+            _CloseCallback();
+        }
+        Finish();
+    }
+
+    void Finish(){
+        _ResumeCallback = Callback();
+        _CloseCallback = Callback();
+        Callback cb = std::move(_FinishCallback);
+        _FinishCallback = Callback();
+        if(cb){
+            cb();
+        }
+    }
+
+public:
+    StreamWriter(const PtrConnection& conn, StreamFraming framing, bool discard = false):
+        _Conn(conn),
+        _Framing(framing),
+        _Discard(discard),
+        _Paused(false),
+        _Ended(false),
+        _Closed(false)
+    {}
+
+    // 创建写入器并在连接上设置输出水位，连接同一时间只能有一个写入器
+    static std::shared_ptr<StreamWriter> Create(const PtrConnection& conn, StreamFraming framing, bool discard = false,
+                                                uint64_t high = STREAM_HIGH_WATERMARK, uint64_t low = STREAM_LOW_WATERMARK){
+        std::shared_ptr<StreamWriter> writer = std::make_shared<StreamWriter>(conn, framing, discard);
+        std::weak_ptr<StreamWriter> weak = writer;
+        conn->SetWatermark(high, low, [weak](const PtrConnection& conn, bool writable){
+            if(std::shared_ptr<StreamWriter> writer = weak.lock()){
+                writer->OnWatermark(conn, writable);
+            }
+        });
+        if(!conn->IsConnected()){
+            writer->_Closed = true;
+        }
+        return writer;
+    }
+
+    const PtrConnection& GetConnection() const { return _Conn; }
+    bool Paused() const { return _Paused; }
+    bool Closed() const { return _Closed; }
+    bool Ended() const { return _Ended; }
+
+    void SetResumeCallback(const Callback& cb) { _ResumeCallback = cb; }
+    void SetCloseCallback(const Callback& cb)  { _CloseCallback = cb; }
+    // 结束回调供上层协议使用，HttpServer 用它继续处理后续请求，HTTP 处理函数不要设置
+    void SetFinishCallback(const Callback& cb) { _FinishCallback = cb; }
+
+    // 返回 false 表示应暂停写入，本次的数据仍然会发送
+    bool Write(const char* data, size_t len){
+        if(_Ended || _Closed){
+            return false;
+        }
+        if(!_Discard && len > 0){
+            Buffer* output = _Conn->GetOutputBuffer();
+            if(_Framing == STREAM_CHUNKED){
+                char size[24];
+                int n = snprintf(size, sizeof(size), "%zx\r\n", len);
+                output->WritePush(size, n);
+                output->WritePush(data, len);
+                output->WritePush("\r\n", 2);
+            }
+            else{
+                output->WritePush(data, len);
+            }
+            _Conn->CommitOutput();
+        }
+        return !_Paused && !_Closed;
+    }
+
+    bool Write(const std::string& data){
+        return Write(data.data(), data.size());
+    }
+
+    // 结束流，分块编码时写入结束块
+    void End(){
+        if(_Ended || _Closed){
+            return;
+        }
+        _Ended = true;
+        if(_Framing == STREAM_CHUNKED && !_Discard){
+            _Conn->GetOutputBuffer()->WritePush("0\r\n\r\n", 5);
+            _Conn->CommitOutput();
+        }
+        _Conn->SetWatermark(0, 0, Connection::WatermarkCallback());
+        Finish();
+    }
+};
+
+
 class Acceptor{
-    using AcceptCallback = std::function<void(int)>;
+    using AcceptCallback = std::function<void(int, const struct sockaddr_in&)>;
 private:
     Socket _Socket;
     EventLoop* _Loop;
@@ -1384,12 +4202,13 @@ private:
     AcceptCallback _AcceptCallback;
 private:
     void HandleRead(){
-        int fd = _Socket.Accept();
+        struct sockaddr_in peer;
+        int fd = _Socket.Accept(&peer);
         if(fd == -1){
             return;
         }
         if(_AcceptCallback){
-            _AcceptCallback(fd);
+            _AcceptCallback(fd, peer);
         }
     }
 
@@ -1419,59 +4238,480 @@ public:
 
 
 
+// 每个来源 IP 的令牌桶数量超过该值时，清理已经回满的桶
+#define ADMISSION_MAX_SOURCES 65536
+
+// 准入控制统计
+struct AdmissionStatsSnapshot
+{
+    uint64_t Accepted;       // 准入的连接数
+    uint64_t ShedTotal;      // 超过总连接数上限被拒绝的连接数
+    uint64_t ShedLoopFull;   // 所有循环都达到单循环连接数上限被拒绝的连接数
+    uint64_t ShedRate;       // 超过来源 IP 建连速率被拒绝的连接数
+    uint64_t ShedLag;        // 所有循环延迟都超过阈值被拒绝的连接数
+};
+
+// 新连接的准入控制，只在主循环线程中调用（统计和 Release 可在任意线程调用）
+// 依次检查来源 IP 的建连速率、总连接数和所选循环的连接数与延迟
+// 所选循环已满或过载时改选其余循环中连接最少的合格循环，都不合格时拒绝
+// 宁可快速拒绝一部分连接，也不让所有连接的延迟一起升高
+class AdmissionControl
+{
+    using Counter = std::atomic<uint64_t>;
+
+    struct Bucket{
+        double Tokens;
+        uint64_t LastUs;
+    };
+private:
+    uint64_t _MaxConnections;      // 总连接数上限，0 表示不限制
+    uint64_t _MaxLoopConnections;  // 单个循环的连接数上限，0 表示不限制
+    double _Rate;                  // 每个来源 IP 每秒可建立的连接数，0 表示不限制
+    double _Burst;                 // 允许的突发连接数
+    uint64_t _ShedLagUs;           // 循环延迟阈值（微秒），0 表示不检查
+    std::unordered_map<uint32_t, Bucket> _Buckets;
+    // 已准入、尚未释放的连接数；连接可能在目标循环中异步构造，循环的连接数统计会滞后，总数上限按它检查
+    Counter _Reserved;
+    Counter _Accepted;
+    Counter _ShedTotal;
+    Counter _ShedLoopFull;
+    Counter _ShedRate;
+    Counter _ShedLag;
+
+private:
+    static void Add(Counter &counter){
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    bool Eligible(EventLoop* loop, uint64_t nowUs) const{
+        LoopStats& stats = loop->GetStats();
+        return (_MaxLoopConnections == 0 || stats.GetConnections() < _MaxLoopConnections)
+            && (_ShedLagUs == 0 || stats.GetCurrentLagUs(nowUs) <= _ShedLagUs);
+    }
+
+    // 清理已经回满的桶，它们和新建的桶没有区别
+    void Prune(uint64_t nowUs){
+        for(auto iter = _Buckets.begin(); iter != _Buckets.end();){
+            if(iter->second.Tokens + (nowUs - iter->second.LastUs) * _Rate / 1000000 >= _Burst){
+                iter = _Buckets.erase(iter);
+            }
+            else{
+                ++iter;
+            }
+        }
+    }
+
+    bool AllowSource(uint32_t ip){
+        uint64_t now = MonotonicUs();
+        if(_Buckets.size() >= ADMISSION_MAX_SOURCES){
+            Prune(now);
+        }
+        auto iter = _Buckets.find(ip);
+        if(iter == _Buckets.end()){
+            iter = _Buckets.emplace(ip, Bucket{_Burst, now}).first;
+        }
+        Bucket& bucket = iter->second;
+        bucket.Tokens = std::min(_Burst, bucket.Tokens + (now - bucket.LastUs) * _Rate / 1000000);
+        bucket.LastUs = now;
+        if(bucket.Tokens < 1){
+            return false;
+        }
+        bucket.Tokens -= 1;
+        return true;
+    }
+
+public:
+    AdmissionControl()
+        :_MaxConnections(0), _MaxLoopConnections(0), _Rate(0), _Burst(0), _ShedLagUs(0),
+        _Reserved(0), _Accepted(0), _ShedTotal(0), _ShedLoopFull(0), _ShedRate(0), _ShedLag(0)
+    {}
+
+    void SetMaxConnections(uint64_t total, uint64_t perLoop){
+        _MaxConnections = total;
+        _MaxLoopConnections = perLoop;
+    }
+    void SetAcceptRate(double perSecond, double burst){
+        _Rate = perSecond;
+        _Burst = std::max(burst, 1.0);
+        _Buckets.clear();
+    }
+    void SetShedLag(uint64_t us){
+        _ShedLagUs = us;
+    }
+    bool Enabled() const{
+        return _MaxConnections > 0 || _MaxLoopConnections > 0 || _Rate > 0 || _ShedLagUs > 0;
+    }
+
+    // 每个建立的连接占用一个名额；释放时总会调用 Release，未经 Admit 的连接也要计数
+    void Reserve(){
+        _Reserved.fetch_add(1, std::memory_order_relaxed);
+    }
+    // 连接释放时调用，可在任意线程中执行
+    void Release(){
+        _Reserved.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // 返回连接应分配到的循环，拒绝时返回 nullptr；preferred 为负载均衡选出的循环
+    EventLoop* Admit(const struct sockaddr_in& peer, EventLoop* preferred, const std::vector<EventLoop*>& loops){
+        if(_Rate > 0 && !AllowSource(peer.sin_addr.s_addr)){
+            Add(_ShedRate);
+            return nullptr;
+        }
+        if(_MaxConnections > 0 && _Reserved.load(std::memory_order_relaxed) >= _MaxConnections){
+            Add(_ShedTotal);
+            return nullptr;
+        }
+        uint64_t now = MonotonicUs();
+        EventLoop* target = Eligible(preferred, now) ? preferred : nullptr;
+        bool fallback = target == nullptr;
+        for(size_t i = 0; fallback && i < loops.size(); ++i){
+            if(loops[i] != preferred && Eligible(loops[i], now)
+               && (target == nullptr || loops[i]->GetStats().GetConnections() < target->GetStats().GetConnections())){
+                target = loops[i];
+            }
+        }
+        if(target == nullptr){
+            // 区分拒绝原因：有未满的循环说明是延迟超标
+            bool full = _MaxLoopConnections > 0 && preferred->GetStats().GetConnections() >= _MaxLoopConnections;
+            for(EventLoop* loop : loops){
+                full = full && (_MaxLoopConnections > 0 && loop->GetStats().GetConnections() >= _MaxLoopConnections);
+            }
+            Add(full ? _ShedLoopFull : _ShedLag);
+            return nullptr;
+        }
+        Add(_Accepted);
+        Reserve();
+        return target;
+    }
+
+    AdmissionStatsSnapshot Snapshot() const{
+        AdmissionStatsSnapshot snap;
+        snap.Accepted = _Accepted.load(std::memory_order_relaxed);
+        snap.ShedTotal = _ShedTotal.load(std::memory_order_relaxed);
+        snap.ShedLoopFull = _ShedLoopFull.load(std::memory_order_relaxed);
+        snap.ShedRate = _ShedRate.load(std::memory_order_relaxed);
+        snap.ShedLag = _ShedLag.load(std::memory_order_relaxed);
+        return snap;
+    }
+};
+
+
+
 class TCPServer{
 private:
     uint64_t _NextID;
     int _Port;
     int _Timeout;
     bool _EnableInactiveRelease;
+    // 连接对象从所属循环的对象池分配
+    bool _ConnectionPool;
+    // 连接的读写期限（毫秒）和超时回调
+    uint32_t _ReadDeadline;
+    uint32_t _WriteDeadline;
+    uint64_t _DeferredBudget;
+    uint64_t _ReadBudgetBytes;
+    uint64_t _ReadBudgetEvents;
+    // 写合并和 TCP_CORK 模式，见 Connection::SetWriteCoalescing
+    bool _WriteCoalesce;
+    bool _WriteCork;
+    // 准入控制；被拒绝的连接在关闭前先发送 _ShedResponse（为空时直接关闭）
+    AdmissionControl _Admission;
+    std::string _ShedResponse;
+    // 循环延迟超过该值时，新到的消息交给 _OverloadCallback 处理
+    uint64_t _RequestShedLagUs;
+    int _BaseLoopCpu;
+    int _ComputeThreadCount;
+    // 自动再平衡：循环延迟连续超过阈值时，把其中流量最大的连接迁走
+    uint64_t _RebalanceLagUs;
+    int _RebalanceInterval;
+    int _RebalanceMoves;
+    std::vector<int> _HotRounds;
+    // 按负载自动调整线程数
+    int _ScaleMin;
+    int _ScaleMax;
+    uint32_t _ScaleHighPermille;
+    uint32_t _ScaleLowPermille;
+    int _ScaleInterval;
+    // 是否已经安排了回收移出线程的检查
+    bool _ParkSweep;
+    std::atomic<bool> _Started;
     EventLoop _BaseLoop;
     Acceptor _Acceptor;
     LoopThreadPool _ThreadPool;
-    std::unordered_map<uint64_t, PtrConnection> _Connections;
+    std::unique_ptr<ComputePool> _ComputePool;
 
     using ConnectedCallback = std::function<void(const PtrConnection&)>;
     using MessageCallback = std::function<void(const PtrConnection&, Buffer*)>;
     using CloseCallback = std::function<void(const PtrConnection&)>;
     using AnyEventCallback = std::function<void(const PtrConnection&)>;
     using Functor = std::function<void()>;
+    using BatchEndCallback = std::function<void(EventLoop*)>;
 
     ConnectedCallback _ConnectedCallback;
     MessageCallback _MessageCallback;
     CloseCallback _CloseCallback;
     AnyEventCallback _AnyEventCallback;
+    using DeadlineCallback = std::function<void(const PtrConnection&)>;
+    DeadlineCallback _ReadDeadlineCallback;
+    DeadlineCallback _WriteDeadlineCallback;
+    DeadlineCallback _IdleCallback;
+    BatchEndCallback _BatchEndCallback;
+    MessageCallback _OverloadCallback;
 
 private:
+    // 把每轮循环的相关设置应用到主循环和新建的从属循环
+    void ConfigureLoop(EventLoop* loop){
+        loop->SetDeferredBudget(_DeferredBudget);
+        loop->SetReadBudget(_ReadBudgetBytes, _ReadBudgetEvents);
+        loop->SetShedLag(_RequestShedLagUs);
+        if(_BatchEndCallback){
+            loop->SetBatchEndCallback(std::bind(_BatchEndCallback, loop));
+        }
+    }
+
     void RunAfterInLoop(int timeout, const Functor& task){
-        _NextID++;
-        _BaseLoop.TimerAdd(_NextID, timeout, task);
+        _BaseLoop.RunAfter(timeout * 1000ULL, task);
     }
 
-    void NewConnection(int fd){
-        _NextID++;
-        PtrConnection conn(new Connection(&_BaseLoop, fd, _NextID));
+    void CreateConnection(EventLoop* loop, int fd, uint64_t id){
+        PtrConnection conn;
+        if(_ConnectionPool){
+            // 连接对象和控制块一次分配，来自所属循环回收的内存块
+            const std::shared_ptr<SlotPool>& pool = loop->GetConnectionPool();
+            conn = std::allocate_shared<Connection>(PoolAllocator<Connection>(pool), loop, fd, id, pool);
+        }
+        else{
+            conn.reset(new Connection(loop, fd, id));
+        }
         conn->SetConnectedCallback(_ConnectedCallback);
         conn->SetMessageCallback(_MessageCallback);
         conn->SetCloseCallback(_CloseCallback);
         conn->SetAnyEventCallback(_AnyEventCallback);
         conn->SetServerCloseCallback(std::bind(&TCPServer::RemoveConnection, this, std::placeholders::_1));
+        conn->SetWriteCoalescing(_WriteCoalesce, _WriteCork);
+        conn->SetOverloadCallback(_OverloadCallback);
         if(_EnableInactiveRelease){
+            conn->SetIdleCallback(_IdleCallback);
             conn->EnableInactiveRelease(_Timeout);
         }
+        if(_ReadDeadline > 0){
+            conn->SetReadDeadline(_ReadDeadline, _ReadDeadlineCallback);
+        }
+        if(_WriteDeadline > 0){
+            conn->SetWriteDeadline(_WriteDeadline, _WriteDeadlineCallback);
+        }
+        // 连接登记在所属循环的连接表中，登记任务排在连接建立之前
+        loop->RunInLoop(std::bind(&EventLoop::AddConnection, loop, conn, id));
         conn->Established();
-        _Connections[_NextID] = conn;
     }
 
-    void RemoveConnectionInLoop(const PtrConnection& conn){
-        int ID = conn->GetId();
-        auto iter = _Connections.find(ID);
-        if(iter != _Connections.end()){
-            _Connections.erase(iter);
+    // 拒绝的连接不创建 Connection，尽力发送拒绝响应后直接关闭
+    void ShedConnection(int fd){
+        if(!_ShedResponse.empty()){
+            send(fd, _ShedResponse.data(), _ShedResponse.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+        close(fd);
+    }
+
+    void NewConnection(int fd, const struct sockaddr_in& peer){
+        EventLoop* loop = _ThreadPool.NextLoop();
+        if(_Admission.Enabled()){
+            const std::vector<EventLoop*>& loops = _ThreadPool.GetLoops();
+            loop = _Admission.Admit(peer, loop, loops.empty() ? std::vector<EventLoop*>{&_BaseLoop} : loops);
+            if(loop == nullptr){
+                return ShedConnection(fd);
+            }
+        }
+        else{
+            _Admission.Reserve();
+        }
+        _NextID++;
+        if(_ThreadPool.IsNumaLocal() && loop != &_BaseLoop){
+            // 在所属线程中构造连接，使连接对象和缓冲区分配在该线程的 NUMA 节点上
+            // 构造前先计入目标循环的连接数，突发建连时单循环上限和负载均衡能看到还在路上的连接
+            uint64_t id = _NextID;
+            loop->GetStats().AddConnection();
+            loop->RunInLoop(std::bind(&TCPServer::CreateNumaLocalConnection, this, loop, fd, id));
+            return;
         }
+        CreateConnection(loop, fd, _NextID);
+    }
+
+    // 连接构造时已计入循环的连接数，去掉建连时预先计入的一次
+    void CreateNumaLocalConnection(EventLoop* loop, int fd, uint64_t id){
+        CreateConnection(loop, fd, id);
+        loop->GetStats().RemoveConnection();
     }
 
+    // 在连接所属的循环中执行，不需要经过主循环
     void RemoveConnection(const PtrConnection& conn){
-        _BaseLoop.QueueInLoop(std::bind(&TCPServer::RemoveConnectionInLoop, this, conn));
+        conn->GetLoop()->RemoveConnection(conn->GetId());
+        _Admission.Release();
+    }
+
+    // 在主循环中把任务分发到每个事件循环（包括主循环），task 在各循环线程中执行
+    // 全部执行完后，done 在最后完成的循环线程中执行
+    void FanOutInLoop(const std::function<void(EventLoop*)>& task, const std::function<void()>& done){
+        std::vector<EventLoop*> loops = _ThreadPool.GetLoops();
+        loops.insert(loops.begin(), &_BaseLoop);
+        std::shared_ptr<std::atomic<size_t>> remaining = std::make_shared<std::atomic<size_t>>(loops.size());
+        for(EventLoop* loop : loops){
+            loop->RunInLoop([loop, task, done, remaining](){
+                task(loop);
+                if(remaining->fetch_sub(1) == 1 && done){
+                    done();
+                }
+            });
+        }
+    }
+
+    void FanOut(const std::function<void(EventLoop*)>& task, const std::function<void()>& done = std::function<void()>()){
+        _BaseLoop.RunInLoop(std::bind(&TCPServer::FanOutInLoop, this, task, done));
+    }
+
+    // 在过热的循环中执行：开始统计各连接的流量
+    static void ResetTrafficInLoop(EventLoop* loop){
+        for(auto& item : loop->GetConnections()){
+            item.second->TakeTraffic();
+        }
+    }
+
+    // 在过热的循环中执行：把开始统计以来流量最大的几个连接迁到目标循环
+    static void MigrateHottestInLoop(EventLoop* loop, EventLoop* target, int moves){
+        std::vector<std::pair<uint64_t, PtrConnection>> conns;
+        for(auto& item : loop->GetConnections()){
+            conns.push_back(std::make_pair(item.second->TakeTraffic(), item.second));
+        }
+        std::sort(conns.begin(), conns.end(), [](const std::pair<uint64_t, PtrConnection>& a,
+                                                const std::pair<uint64_t, PtrConnection>& b){
+            return a.first > b.first;
+        });
+        for(int n = 0; n < (int)conns.size() && n < moves && conns[n].first > 0; ++n){
+            DBG_LOG("REBALANCE CONNECTION %d", conns[n].second->GetId());
+            conns[n].second->MigrateTo(target);
+        }
+    }
+
+    // 在主循环中定期执行
+    void RebalanceInLoop(){
+        const std::vector<EventLoop*>& loops = _ThreadPool.GetLoops();
+        if(loops.size() >= 2){
+            _HotRounds.resize(loops.size(), 0);
+            int coolest = 0;
+            for(size_t i = 1; i < loops.size(); ++i){
+                if(loops[i]->GetStats().GetLagUs() < loops[coolest]->GetStats().GetLagUs()){
+                    coolest = i;
+                }
+            }
+            for(size_t i = 0; i < loops.size(); ++i){
+                if(loops[i]->GetStats().GetLagUs() <= _RebalanceLagUs){
+                    _HotRounds[i] = 0;
+                    continue;
+                }
+                // 刚开始超标时由该循环自己清零各连接的流量，之后按这段时间的流量挑选迁移的连接
+                if(++_HotRounds[i] == 1 && REBALANCE_HOT_ROUNDS > 1){
+                    loops[i]->RunInLoop(std::bind(&TCPServer::ResetTrafficInLoop, loops[i]));
+                }
+                // 只在延迟持续超标、且有低于阈值的目标循环时迁移
+                if(_HotRounds[i] < REBALANCE_HOT_ROUNDS || (int)i == coolest
+                   || loops[coolest]->GetStats().GetLagUs() > _RebalanceLagUs){
+                    continue;
+                }
+                loops[i]->RunInLoop(std::bind(&TCPServer::MigrateHottestInLoop, loops[i], loops[coolest], _RebalanceMoves));
+                _HotRounds[i] = 0;
+            }
+        }
+        RunAfterInLoop(_RebalanceInterval, std::bind(&TCPServer::RebalanceInLoop, this));
+    }
+
+    void ResizeInLoop(int count){
+        while(_ThreadPool.GetThreadCount() < count){
+            EventLoop* loop = _ThreadPool.AddLoop();
+            ConfigureLoop(loop);
+            INF_LOG("LOOP THREAD ADDED, COUNT: %d", _ThreadPool.GetThreadCount());
+        }
+        while(_ThreadPool.GetThreadCount() > count && count >= 0){
+            RetireLoopInLoop(_ThreadPool.RemoveLoop());
+            INF_LOG("LOOP THREAD REMOVED, COUNT: %d", _ThreadPool.GetThreadCount());
+        }
+    }
+
+    // 把移出的循环上的连接迁到其余循环，循环本身暂时保留以备复用
+    // 迁移任务都排在随后投递的检查任务之前，检查任务执行时这些连接已经从该循环上摘下
+    void RetireLoopInLoop(EventLoop* loop){
+        // 迁移期间线程数又增加，循环已被复用
+        if(!_ThreadPool.IsParked(loop)){
+            return;
+        }
+        std::vector<EventLoop*> targets = _ThreadPool.GetLoops();
+        if(targets.empty()){
+            targets.push_back(&_BaseLoop);
+        }
+        // 由移出的循环遍历自己的连接表，依次分给其余循环
+        loop->RunInLoop([this, loop, targets](){
+            size_t next = 0;
+            for(auto& item : loop->GetConnections()){
+                item.second->MigrateTo(targets[next++ % targets.size()]);
+            }
+            loop->QueueInLoop([this, loop](){
+                _BaseLoop.QueueInLoop(std::bind(&TCPServer::FinishRetireInLoop, this, loop));
+            });
+        });
+    }
+
+    void FinishRetireInLoop(EventLoop* loop){
+        // 还有正在关闭或尚未建立完成的连接，稍后再迁移一次
+        if(loop->GetStats().GetConnections() > 0){
+            return RunAfterInLoop(1, std::bind(&TCPServer::RetireLoopInLoop, this, loop));
+        }
+        ScheduleParkSweepInLoop();
+    }
+
+    void ScheduleParkSweepInLoop(){
+        if(_ParkSweep){
+            return;
+        }
+        _ParkSweep = true;
+        RunAfterInLoop(LOOP_PARK_GRACE, std::bind(&TCPServer::SweepParkedInLoop, this));
+    }
+
+    // 结束移出时间超过 LOOP_PARK_GRACE 且不再被引用的线程，还有移出的线程时继续定期检查
+    void SweepParkedInLoop(){
+        _ParkSweep = false;
+        for(EventLoop* loop : _ThreadPool.IdleParked(LOOP_PARK_GRACE * 1000000ULL)){
+            // 先由该循环确认没有待执行的定时器，之前投递给它的任务此时都已执行完
+            loop->RunInLoop([this, loop](){
+                if(loop->TimerCount() == 0){
+                    _BaseLoop.QueueInLoop(std::bind(&TCPServer::ExitParkedInLoop, this, loop));
+                }
+            });
+        }
+        if(_ThreadPool.HasParked()){
+            ScheduleParkSweepInLoop();
+        }
+    }
+
+    void ExitParkedInLoop(EventLoop* loop){
+        if(_ThreadPool.ReleaseParked(loop)){
+            INF_LOG("PARKED LOOP THREAD EXITED");
+        }
+    }
+
+    // 按从属循环的平均忙碌比例增减一个线程
+    void AutoScaleInLoop(){
+        int count = _ThreadPool.GetThreadCount();
+        uint32_t total = 0;
+        for(int i = 0; i < count; ++i){
+            total += _ThreadPool.RecentBusyPermille(i);
+        }
+        uint32_t average = count > 0 ? total / count : 1000;
+        if(average > _ScaleHighPermille && count < _ScaleMax){
+            ResizeInLoop(count + 1);
+        }
+        else if(average < _ScaleLowPermille && count > _ScaleMin){
+            ResizeInLoop(count - 1);
+        }
+        RunAfterInLoop(_ScaleInterval, std::bind(&TCPServer::AutoScaleInLoop, this));
     }
 
 public:
@@ -1480,16 +4720,84 @@ public:
         ,_Port(port)
         ,_Timeout(0)
         ,_EnableInactiveRelease(false)
+        ,_ConnectionPool(true)
+        ,_ReadDeadline(0)
+        ,_WriteDeadline(0)
+        ,_DeferredBudget(DEFAULT_DEFERRED_BUDGET_US)
+        ,_ReadBudgetBytes(DEFAULT_READ_BUDGET_BYTES)
+        ,_ReadBudgetEvents(DEFAULT_READ_BUDGET_EVENTS)
+        ,_WriteCoalesce(true)
+        ,_WriteCork(false)
+        ,_RequestShedLagUs(0)
+        ,_BaseLoopCpu(-1)
+        ,_ComputeThreadCount(0)
+        ,_RebalanceLagUs(0)
+        ,_RebalanceInterval(0)
+        ,_RebalanceMoves(0)
+        ,_ScaleMin(0)
+        ,_ScaleMax(0)
+        ,_ScaleHighPermille(0)
+        ,_ScaleLowPermille(0)
+        ,_ScaleInterval(0)
+        ,_ParkSweep(false)
+        ,_Started(false)
         ,_BaseLoop()
         ,_Acceptor(&_BaseLoop, port)
         ,_ThreadPool(&_BaseLoop)
     {
-        _Acceptor.SetAcceptCallback(std::bind(&TCPServer::NewConnection, this, std::placeholders::_1));
+        _Acceptor.SetAcceptCallback(std::bind(&TCPServer::NewConnection, this, std::placeholders::_1, std::placeholders::_2));
         _Acceptor.Listen();
     }
 
+    // Start 之后调用会在运行时增减线程，减少时把连接迁到其余循环
+    // 移出的线程先保留，再次增加时复用；移出 LOOP_PARK_GRACE 秒后，没有连接、定时器句柄或缓存分片引用它时退出
     void SetThreadCount(int count){
-        return _ThreadPool.SetThreadCount(count);
+        if(!_Started){
+            return _ThreadPool.SetThreadCount(count);
+        }
+        _BaseLoop.RunInLoop(std::bind(&TCPServer::ResizeInLoop, this, count));
+    }
+    // 按负载自动调整线程数，需在 Start 之前调用
+    // 每 interval 秒检查一次从属循环的平均忙碌比例（千分比），高于 high 增加一个线程，低于 low 减少一个
+    // 减少的线程与 SetThreadCount 一样先保留，之后空闲时退出
+    void SetAutoScale(int minCount, int maxCount, uint32_t highPermille = 800, uint32_t lowPermille = 200, int interval = 10){
+        _ScaleMin = minCount;
+        _ScaleMax = maxCount;
+        _ScaleHighPermille = highPermille;
+        _ScaleLowPermille = lowPermille;
+        _ScaleInterval = interval;
+    }
+    // 新连接分配事件循环的策略，默认轮询
+    void SetLoopBalance(LoopBalance balance){
+        return _ThreadPool.SetBalance(balance);
+    }
+    void SetLoopSelector(const LoopSelector& selector){
+        return _ThreadPool.SetSelector(selector);
+    }
+    // 以下线程放置相关的设置需在 Start 之前调用
+    // 第 i 个从属线程绑定到 cpuSets[i % cpuSets.size()]
+    void SetLoopCpuSets(const std::vector<std::vector<int>>& cpuSets){
+        return _ThreadPool.SetCpuSets(cpuSets);
+    }
+    void SetLoopThreadName(const std::string& name){
+        return _ThreadPool.SetThreadName(name);
+    }
+    // 从属线程的内存（连接对象、缓冲区、epoll 事件数组）优先分配在其所绑定 CPU 的 NUMA 节点
+    void SetNumaLocal(bool numaLocal){
+        return _ThreadPool.SetNumaLocal(numaLocal);
+    }
+    // 从属线程定时器的 tick 粒度（毫秒），决定连接超时等定时任务的精度，需在 Start 之前设置
+    void SetTimerTick(uint32_t tickMs){
+        return _ThreadPool.SetTimerTick(tickMs);
+    }
+    // 从属线程的定时器是否使用无节拍模式（默认开启），关闭后按 tick 周期唤醒，需在 Start 之前设置
+    void SetTimerTickless(bool tickless){
+        return _ThreadPool.SetTimerTickless(tickless);
+    }
+    // 将主循环绑定到单独的 CPU，未指定从属线程 CPU 集合时，从属线程不会调度到该 CPU
+    void SetBaseLoopCpu(int cpu){
+        _BaseLoopCpu = cpu;
+        return _ThreadPool.SetReservedCpu(cpu);
     }
     void SetConnectedCallback(const ConnectedCallback& cb){
         _ConnectedCallback = cb;
@@ -1507,16 +4815,184 @@ public:
         _EnableInactiveRelease = true;
         _Timeout = timeout;
     }
-    void RunAfter(const Functor& task, int timeout){
-        _BaseLoop.RunInLoop(std::bind(&TCPServer::RunAfterInLoop, this, timeout, task));
+    // 空闲超时的回调，未设置时关闭连接
+    void SetIdleCallback(const DeadlineCallback& cb){
+        _IdleCallback = cb;
+    }
+    // 是否从对象池分配连接（默认开启），需在 Start 之前设置
+    void SetConnectionPool(bool enable){
+        _ConnectionPool = enable;
+    }
+    // 新连接的读期限：输入缓冲区中有数据时，每 ms 毫秒内消息回调至少要取走一部分数据
+    // 防止慢速发送的客户端长期占用连接，cb 为空时超时关闭连接
+    void SetReadDeadline(uint32_t ms, const DeadlineCallback& cb = DeadlineCallback()){
+        _ReadDeadline = ms;
+        _ReadDeadlineCallback = cb;
+    }
+    // 新连接的写期限：输出缓冲区出现数据后 ms 毫秒内需全部发出，防止慢速读取的客户端占用缓冲区
+    void SetWriteDeadline(uint32_t ms, const DeadlineCallback& cb = DeadlineCallback()){
+        _WriteDeadline = ms;
+        _WriteDeadlineCallback = cb;
+    }
+    // 对所有连接执行 cb，可在任意线程调用
+    // 每个事件循环遍历自己的连接表，cb 在连接所属线程中执行；遍历期间正在迁移的连接可能被跳过
+    void ForEachConnection(const std::function<void(const PtrConnection&)>& cb){
+        FanOut([cb](EventLoop* loop){
+            std::vector<PtrConnection> conns;
+            conns.reserve(loop->GetConnections().size());
+            for(auto& item : loop->GetConnections()){
+                conns.push_back(item.second);
+            }
+            for(auto& conn : conns){
+                cb(conn);
+            }
+        });
+    }
+    // 向所有连接发送同一份数据
+    void Broadcast(const char* data, size_t len){
+        std::shared_ptr<std::string> message = std::make_shared<std::string>(data, len);
+        ForEachConnection([message](const PtrConnection& conn){
+            conn->Send(message->data(), message->size());
+        });
+    }
+    // 统计各循环连接表中的连接数，done 在最后完成统计的循环线程中执行
+    void CountConnections(const std::function<void(size_t)>& done){
+        std::shared_ptr<std::atomic<size_t>> total = std::make_shared<std::atomic<size_t>>(0);
+        FanOut([total](EventLoop* loop){
+            total->fetch_add(loop->GetConnections().size());
+        }, [total, done](){
+            done(total->load());
+        });
+    }
+    // timeout 单位为秒，任务在主循环中执行
+    TimerHandle RunAfter(const Functor& task, int timeout){
+        return _BaseLoop.RunAfter(timeout * 1000ULL, task);
+    }
+    // 取消 RunAfter 或任意事件循环 RunAt/RunAfter/RunEvery 返回的定时器
+    void CancelTimer(const TimerHandle& handle){
+        if(handle.Valid()){
+            handle.GetLoop()->CancelTimer(handle);
+        }
+    }
+    // 设置所有事件循环的延迟任务时间预算（微秒），需在 Start 之前调用
+    void SetDeferredBudget(uint64_t us){
+        _DeferredBudget = us;
+    }
+    // 设置所有事件循环每轮的读取预算，需在 Start 之前调用
+    // 读取的字节数或读事件数达到预算后，大流量连接的读取推迟到下一轮，为 0 表示该项不限制
+    void SetReadBudget(uint64_t bytes, uint64_t events = DEFAULT_READ_BUDGET_EVENTS){
+        _ReadBudgetBytes = bytes;
+        _ReadBudgetEvents = events;
+    }
+    // 写合并（默认开启）：连接在一轮中的多次 Send 在本轮结束时一次发出，需在 Start 之前设置
+    // cork 开启时，流水线请求尚未读完的连接用 TCP_CORK 把相邻几轮的输出合并成满 MSS 的报文
+    void SetWriteCoalescing(bool coalesce, bool cork = false){
+        _WriteCoalesce = coalesce;
+        _WriteCork = cork;
+    }
+    // 连接数上限：总数和单个循环的上限，0 表示不限制，需在 Start 之前设置
+    void SetMaxConnections(uint64_t total, uint64_t perLoop = 0){
+        _Admission.SetMaxConnections(total, perLoop);
+    }
+    // 每个来源 IP 的建连速率上限（令牌桶），perSecond 为 0 表示不限制，需在 Start 之前设置
+    void SetAcceptRate(double perSecond, double burst){
+        _Admission.SetAcceptRate(perSecond, burst);
+    }
+    // 过载保护，需在 Start 之前设置，lagUs 为 0 表示关闭
+    // 新连接：所有循环的延迟都超过 lagUs 时拒绝
+    // 新消息：所属循环本轮已处理超过 lagUs 且设置了 cb 时交给 cb 处理（例如回复协议层的“繁忙”），不再调用消息回调
+    void SetOverloadShedding(uint64_t lagUs, const MessageCallback& cb = MessageCallback()){
+        _Admission.SetShedLag(lagUs);
+        _RequestShedLagUs = cb ? lagUs : 0;
+        _OverloadCallback = cb;
+    }
+    // 拒绝连接时在关闭前发送的数据，为空时直接关闭
+    void SetShedResponse(const std::string& response){
+        _ShedResponse = response;
+    }
+    // 准入控制统计，可在任意线程调用；被拒绝的消息数见各循环统计的 ShedRequests
+    AdmissionStatsSnapshot GetAdmissionStats() const{
+        return _Admission.Snapshot();
+    }
+    // 每个事件循环在一轮结束、统一发送之前执行 cb，参数为所在的循环，需在 Start 之前设置
+    // 可用于把本轮积攒的批量输出写入连接
+    void SetBatchEndCallback(const BatchEndCallback& cb){
+        _BatchEndCallback = cb;
+    }
+    // 从属事件循环，可作为 Connection::MigrateTo 的目标，只在主循环线程中调用
+    const std::vector<EventLoop*>& GetLoops(){
+        return _ThreadPool.GetLoops();
+    }
+    // 各事件循环的运行统计，第一个为主循环，可在任意线程调用
+    std::vector<LoopStatsSnapshot> GetLoopStats(){
+        std::vector<LoopStatsSnapshot> stats = _ThreadPool.GetStats();
+        stats.insert(stats.begin(), _BaseLoop.GetStatsSnapshot());
+        return stats;
+    }
+
+    // 开启自动再平衡，需在 Start 之前调用
+    // 每 interval 秒检查一次，某个循环的延迟连续超过 lagUs 时，把其中流量最大的 moves 个连接迁到延迟最低的循环
+    void SetRebalance(uint64_t lagUs, int interval = 5, int moves = 2){
+        _RebalanceLagUs = lagUs;
+        _RebalanceInterval = interval;
+        _RebalanceMoves = moves;
+    }
+    // 计算线程池的线程数，需在 Start 之前调用，为 0 时 Offload 直接在当前循环中执行
+    void SetComputeThreadCount(int count){
+        _ComputeThreadCount = count;
+    }
+    // 在消息回调中把 CPU 密集的处理卸载到计算线程池
+    // job 在计算线程执行，其返回的回调按提交顺序回到连接所属的事件循环执行
+    void Offload(const PtrConnection& conn, const ComputeJob& job){
+        if(!_ComputePool){
+            std::function<void()> done = job();
+            if(done){
+                done();
+            }
+            return;
+        }
+        return _ComputePool->Offload(conn, job);
+    }
+    ComputeStatsSnapshot GetComputeStats(){
+        if(!_ComputePool){
+            return ComputeStatsSnapshot{0, 0, 0, {}};
+        }
+        return _ComputePool->GetStats();
     }
 
     void Start(){
+        if(_ComputeThreadCount > 0){
+            _ComputePool.reset(new ComputePool(_ComputeThreadCount));
+        }
+        // 先创建从属线程再绑定主线程，从属线程的可用 CPU 按进程原本的亲和性计算
         _ThreadPool.Create();
+        if(_BaseLoopCpu >= 0){
+            BindThreadToCpus({_BaseLoopCpu});
+        }
+        ConfigureLoop(&_BaseLoop);
+        for(auto loop : _ThreadPool.GetLoops()){
+            ConfigureLoop(loop);
+        }
+        if(_RebalanceLagUs > 0){
+            RunAfter(std::bind(&TCPServer::RebalanceInLoop, this), _RebalanceInterval);
+        }
+        if(_ScaleInterval > 0){
+            RunAfter(std::bind(&TCPServer::AutoScaleInLoop, this), _ScaleInterval);
+        }
+        _Started = true;
         _BaseLoop.Start();
     }
 };
 
+void EventLoop::FlushDirty(){
+    // 需要在下一轮继续处理的连接会重新登记到 _DirtyConnections
+    _FlushingConnections.swap(_DirtyConnections);
+    for(auto& conn : _FlushingConnections){
+        conn->FlushInLoop(this);
+    }
+    _FlushingConnections.clear();
+}
+
 void Channel::Update(){
     _loop->UpdateEvent(this);
 }
@@ -1526,12 +5002,18 @@ void Channel::Remove(){
 }
 
 void TimerWheel::TimerAdd(uint64_t id, uint32_t delay, const TaskFunc &cb){
-    auto iter = _TimerMap.find(id);
-    if(iter == _TimerMap.end()) return;
-    _Loop->RunInLoop(std::bind(&TimerWheel::TimerAddInLoop, this, id, delay, cb));
+    return TimerAddMs(id, delay * 1000ULL, cb);
+}
+
+void TimerWheel::TimerAddMs(uint64_t id, uint64_t delayMs, const TaskFunc &cb){
+    _Loop->RunInLoop(std::bind(&TimerWheel::TimerAddInLoop, this, id, delayMs, cb));
 }
 
 void TimerWheel::TimerRefresh(uint64_t id){
+    // 在所属线程中直接执行，避免为每次刷新构造任务对象
+    if(_Loop->IsInLoop()){
+        return TimerRefreshInLoop(id);
+    }
     _Loop->RunInLoop(std::bind(&TimerWheel::TimerRefreshInLoop, this, id));
 }
 
@@ -1539,6 +5021,80 @@ void TimerWheel::TimerCancel(uint64_t id){
     _Loop->RunInLoop(std::bind(&TimerWheel::TimerCancelInLoop, this, id));
 }
 
+void TimerWheel::Schedule(TimerTask* node, uint64_t delayMs){
+    _Loop->AssertInLoop();
+    assert(!node->_owned);
+    node->SetTimeout(delayMs);
+    uint64_t expire = NowTick() + ToTicks(delayMs);
+    if(node->IsLinked()){
+        return _Wheel.Update(node, expire);
+    }
+    node->SetExpire(expire);
+    _Wheel.Add(node);
+}
+
+void TimerWheel::Unschedule(TimerTask* node){
+    _Loop->AssertInLoop();
+    _Wheel.Remove(node);
+}
+
+void TimerWheel::CancelHandleInLoop(uint64_t id, bool retry){
+    auto iter = _HandleMap.find(id);
+    if(iter == _HandleMap.end()){
+        // 其他线程创建的定时器可能还在任务队列中，排到它后面再取消一次
+        if(retry){
+            _Loop->QueueInLoop(std::bind(&TimerWheel::CancelHandleInLoop, this, id, false));
+        }
+        return;
+    }
+    TimerTask* node = iter->second;
+    _HandleMap.erase(iter);
+    _Wheel.Remove(node);
+    FreeNode(node);
+}
+
+TimerHandle TimerWheel::RunAt(uint64_t whenUs, uint32_t intervalMs, const TaskFunc &cb){
+    uint64_t id = _NextHandle.fetch_add(1, std::memory_order_relaxed) + 1;
+    _Loop->RunInLoop(std::bind(&TimerWheel::RunAtInLoop, this, id, whenUs, intervalMs, cb));
+    return TimerHandle(id, _Loop);
+}
+
+TimerHandle::TimerHandle(uint64_t id, EventLoop* loop): _Id(id), _Loop(loop){
+    _Loop->Pin();
+}
+
+TimerHandle::TimerHandle(const TimerHandle& other): _Id(other._Id), _Loop(other._Loop){
+    if(_Loop){
+        _Loop->Pin();
+    }
+}
+
+TimerHandle& TimerHandle::operator=(const TimerHandle& other){
+    if(other._Loop){
+        other._Loop->Pin();
+    }
+    if(_Loop){
+        _Loop->Unpin();
+    }
+    _Id = other._Id;
+    _Loop = other._Loop;
+    return *this;
+}
+
+TimerHandle::~TimerHandle(){
+    if(_Loop){
+        _Loop->Unpin();
+    }
+}
+
+void TimerWheel::Cancel(const TimerHandle &handle){
+    if(!handle.Valid()){
+        return;
+    }
+    assert(handle._Loop == _Loop);
+    _Loop->RunInLoop(std::bind(&TimerWheel::CancelHandleInLoop, this, handle._Id, true));
+}
+
 class NetWrok
 {
 public:
@@ -1550,4 +5106,6 @@ public:
     }
 };
 // 定义静态全局是为了保证构造函数中的信号忽略处理能够在程序启动阶段就被直接执⾏
-static NetWrok g_network;
\ No newline at end of file
+static NetWrok g_network;
+
+#endif // _SERVER_HPP_
@@ -0,0 +1,103 @@
+#include "../Codec.hpp"
+#include <iostream>
+
+// 4 字节大端长度前缀的分帧吞吐：各协议在消息回调里手写的方式与 LengthFieldCodec
+// manual: 每次窥视 4 字节长度，帧完整后用 ReadAsStringPop 拷贝出帧体，每帧调用一次处理函数
+// codec: 一次解出缓冲区中所有完整的帧，帧体是缓冲区的视图，整批交给回调
+// 编码同样对比先拼出头部加帧体的字符串再写入输出缓冲区，与 BeginFrame/EndFrame 直接在输出缓冲区中写帧体
+// 每次向缓冲区写入 batch 个帧，模拟一次读到多个帧，单线程运行
+// 用法: ./CodecBench [帧数] [帧体字节数] [每次读到的帧数]
+
+static volatile uint64_t g_sink = 0;
+
+void Handle(std::string_view body){
+    g_sink = g_sink + body.size() + (uint8_t)body[body.size() / 2];
+}
+
+void ManualDecode(Buffer* buffer){
+    while(buffer->GetReadableSize() >= 4){
+        const uint8_t* p = (const uint8_t*)buffer->GetReadIndex();
+        uint32_t length = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        if(buffer->GetReadableSize() - 4 < length){
+            break;
+        }
+        buffer->UpdateReadIndex(4);
+        std::string body = buffer->ReadAsStringPop(length);
+        Handle(body);
+    }
+}
+
+void Report(const char* name, uint64_t frames, uint64_t us){
+    std::cout << name << ": " << (us ? frames * 1000000 / us : 0) << " frames/s, "
+              << (frames ? us * 1000.0 / frames : 0) << " ns/frame" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    uint64_t count = argc > 1 ? atoll(argv[1]) : 10000000;
+    size_t size = argc > 2 ? atoi(argv[2]) : 256;
+    int batch = argc > 3 ? atoi(argv[3]) : 16;
+    uint64_t rounds = count / batch;
+    LengthFieldCodec codec(4);
+    codec.SetFrameCallback([](const PtrConnection&, const CodecFrame* frames, size_t n){
+        for(size_t i = 0; i < n; ++i){
+            Handle(frames[i].Body);
+        }
+    });
+
+    std::string body(size, 'x');
+    Buffer wire;
+    for(int i = 0; i < batch; ++i){
+        LengthFieldCodec::FrameMark mark = codec.BeginFrame(&wire);
+        wire.WritePush(body.data(), body.size());
+        codec.EndFrame(&wire, mark);
+    }
+    std::string data(wire.GetReadIndex(), wire.GetReadableSize());
+
+    Buffer buffer;
+    uint64_t start = MonotonicUs();
+    for(uint64_t i = 0; i < rounds; ++i){
+        buffer.WritePush(data.data(), data.size());
+        ManualDecode(&buffer);
+    }
+    Report("manual decode", rounds * batch, MonotonicUs() - start);
+
+    PtrConnection conn;
+    start = MonotonicUs();
+    for(uint64_t i = 0; i < rounds; ++i){
+        buffer.WritePush(data.data(), data.size());
+        codec(conn, &buffer);
+    }
+    Report("codec decode", rounds * batch, MonotonicUs() - start);
+
+    // 编码：帧体由若干字段拼成，模拟序列化
+    Buffer output;
+    start = MonotonicUs();
+    for(uint64_t i = 0; i < count; ++i){
+        std::string frame(4, '\0');
+        frame.append(body.data(), body.size() / 2);
+        frame.append(body.data(), body.size() - body.size() / 2);
+        uint32_t length = frame.size() - 4;
+        frame[0] = (char)(length >> 24);
+        frame[1] = (char)(length >> 16);
+        frame[2] = (char)(length >> 8);
+        frame[3] = (char)length;
+        output.WritePush(frame.data(), frame.size());
+        if(output.GetReadableSize() > 65536){
+            output.UpdateReadIndex(output.GetReadableSize());
+        }
+    }
+    Report("string encode", count, MonotonicUs() - start);
+
+    start = MonotonicUs();
+    for(uint64_t i = 0; i < count; ++i){
+        LengthFieldCodec::FrameMark mark = codec.BeginFrame(&output);
+        output.WritePush(body.data(), body.size() / 2);
+        output.WritePush(body.data(), body.size() - body.size() / 2);
+        codec.EndFrame(&output, mark);
+        if(output.GetReadableSize() > 65536){
+            output.UpdateReadIndex(output.GetReadableSize());
+        }
+    }
+    Report("codec encode", count, MonotonicUs() - start);
+    return 0;
+}
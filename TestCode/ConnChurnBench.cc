@@ -0,0 +1,77 @@
+#include "../Server.hpp"
+#include <iostream>
+#include <cstring>
+
+// 短连接场景下的建连/断连吞吐：每个客户端连接后收发 1 字节即关闭
+// 分别测试连接对象直接 new 和从每个循环的对象池分配（TCPServer::SetConnectionPool）
+// 用法: ./ConnChurnBench [服务端线程数] [每种情况运行秒数] [客户端线程数]
+
+static std::atomic<bool> g_stop(false);
+static std::atomic<uint64_t> g_done(0);
+
+void OnMessage(const PtrConnection& conn, Buffer* buffer){
+    conn->Send(buffer->GetReadIndex(), buffer->GetReadableSize());
+    buffer->UpdateReadIndex(buffer->GetReadableSize());
+}
+
+void Client(int port){
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    while(!g_stop){
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+            close(fd);
+            continue;
+        }
+        char c = 'x';
+        if(send(fd, &c, 1, 0) == 1 && recv(fd, &c, 1, 0) == 1){
+            ++g_done;
+        }
+        // 以 RST 关闭，避免客户端端口耗尽在 TIME_WAIT 中
+        struct linger opt = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &opt, sizeof(opt));
+        close(fd);
+    }
+}
+
+void Run(const char* name, int port, int threads, int seconds, int clients, bool pool){
+    std::atomic<bool> started(false);
+    std::thread([&started, port, threads, pool](){
+        // 主循环需要在运行它的线程中构造
+        TCPServer* server = new TCPServer(port);
+        server->SetThreadCount(threads);
+        server->SetConnectionPool(pool);
+        server->SetMessageCallback(OnMessage);
+        started = true;
+        server->Start();
+    }).detach();
+    while(!started) usleep(1000);
+    usleep(200000);
+
+    g_stop = false;
+    g_done = 0;
+    std::vector<std::thread> workers;
+    for(int i = 0; i < clients; ++i){
+        workers.emplace_back(Client, port);
+    }
+    sleep(seconds);
+    g_stop = true;
+    for(auto& worker : workers){
+        worker.join();
+    }
+    std::cerr << name << ": " << g_done / seconds << " connections/s" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    int threads = argc > 1 ? atoi(argv[1]) : 2;
+    int seconds = argc > 2 ? atoi(argv[2]) : 5;
+    int clients = argc > 3 ? atoi(argv[3]) : 4;
+    // 每个连接都会输出日志，结果输出到标准错误
+    freopen("/dev/null", "w", stdout);
+    Run("new Connection", 9601, threads, seconds, clients, false);
+    Run("pooled Connection", 9602, threads, seconds, clients, true);
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "../Server.hpp"
+#include <iostream>
+
+// 连接上下文的开销：Any 与内联存储的 Context
+// switch: 连接切换协议时替换上下文（构造一个典型的协议状态对象）
+// access: 每条消息取出上下文并更新状态
+// 用法: ./ContextBench [次数]
+
+// 典型的协议状态：解析状态、已处理字节数和一个小的字符串
+struct ProtocolState{
+    int stage;
+    uint64_t consumed;
+    std::string name;
+    ProtocolState(int s = 0): stage(s), consumed(0), name("http") {}
+};
+
+// 只能移动的上下文，Any 无法保存
+struct MoveOnlyState{
+    std::unique_ptr<ProtocolState> state;
+    MoveOnlyState(): state(new ProtocolState(1)) {}
+};
+
+static volatile uint64_t g_sink = 0;
+
+// 模拟消息回调，阻止编译器把循环中的取上下文操作外提
+__attribute__((noinline)) void OnMessage(Any& any, uint64_t len){
+    any.get<ProtocolState>()->consumed += len;
+}
+
+__attribute__((noinline)) void OnMessage(Context& context, uint64_t len){
+    context.Get<ProtocolState>()->consumed += len;
+}
+
+void Report(const char* name, uint64_t count, uint64_t us){
+    std::cout << name << ": " << (count ? us * 1000.0 / count : 0) << " ns/op" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    uint64_t count = argc > 1 ? atoll(argv[1]) : 10000000;
+
+    uint64_t start = MonotonicUs();
+    for(uint64_t i = 0; i < count; ++i){
+        Any any = Any(ProtocolState((int)i));
+        g_sink = g_sink + any.get<ProtocolState>()->stage;
+    }
+    Report("Any switch", count, MonotonicUs() - start);
+
+    Context context;
+    start = MonotonicUs();
+    for(uint64_t i = 0; i < count; ++i){
+        context.Emplace<ProtocolState>((int)i);
+        g_sink = g_sink + context.Get<ProtocolState>()->stage;
+    }
+    Report("Context switch", count, MonotonicUs() - start);
+
+    Any any = Any(ProtocolState());
+    start = MonotonicUs();
+    for(uint64_t i = 0; i < count; ++i){
+        OnMessage(any, i);
+    }
+    g_sink = g_sink + any.get<ProtocolState>()->consumed;
+    Report("Any access", count, MonotonicUs() - start);
+
+    context.Emplace<ProtocolState>();
+    start = MonotonicUs();
+    for(uint64_t i = 0; i < count; ++i){
+        OnMessage(context, i);
+    }
+    g_sink = g_sink + context.Get<ProtocolState>()->consumed;
+    Report("Context access", count, MonotonicUs() - start);
+
+    start = MonotonicUs();
+    for(uint64_t i = 0; i < count; ++i){
+        context.Emplace<MoveOnlyState>();
+        g_sink = g_sink + context.Get<MoveOnlyState>()->state->stage;
+    }
+    Report("Context switch (move-only)", count, MonotonicUs() - start);
+    return 0;
+}
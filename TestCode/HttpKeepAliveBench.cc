@@ -0,0 +1,131 @@
+#include "../Http.hpp"
+#include <iostream>
+
+// HttpServer 在三种客户端模式下的吞吐
+// close: 每个请求新建一个连接（HTTP/1.0 短连接）
+// keep-alive: 同一连接上逐个发送请求
+// pipeline: 同一连接上一次发送多个请求，再依次读取响应
+// 用法: ./HttpKeepAliveBench [客户端数] [流水线深度] [每种情况运行秒数]
+
+#define BENCH_PORT 9645
+
+static std::atomic<bool> g_stop(false);
+static std::atomic<uint64_t> g_requests(0);
+
+static const char* g_request = "GET /hello HTTP/1.1\r\nHost: bench\r\n\r\n";
+static const char* g_request10 = "GET /hello HTTP/1.0\r\nHost: bench\r\n\r\n";
+
+int Connect(){
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 读取 count 个完整的响应，返回是否成功
+bool ReadResponses(int fd, int count, std::string& data){
+    data.clear();
+    size_t pos = 0;
+    while(count > 0){
+        size_t end = data.find("\r\n\r\n", pos);
+        if(end != std::string::npos){
+            size_t length = atoi(data.c_str() + data.find("Content-Length: ", pos) + 16);
+            if(data.size() >= end + 4 + length){
+                pos = end + 4 + length;
+                --count;
+                continue;
+            }
+        }
+        char buf[16384];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0){
+            return false;
+        }
+        data.append(buf, n);
+    }
+    return true;
+}
+
+void Client(int mode, int depth){
+    std::string data;
+    std::string batch;
+    for(int i = 0; i < depth; ++i){
+        batch += g_request;
+    }
+    int fd = mode == 0 ? -1 : Connect();
+    while(!g_stop){
+        if(mode == 0){
+            fd = Connect();
+            if(fd < 0){
+                continue;
+            }
+            send(fd, g_request10, strlen(g_request10), 0);
+            bool ok = ReadResponses(fd, 1, data);
+            close(fd);
+            if(!ok){
+                continue;
+            }
+            ++g_requests;
+        }
+        else{
+            int count = mode == 1 ? 1 : depth;
+            send(fd, batch.data(), strlen(g_request) * count, 0);
+            if(!ReadResponses(fd, count, data)){
+                break;
+            }
+            g_requests += count;
+        }
+    }
+    if(mode != 0){
+        close(fd);
+    }
+}
+
+void Run(const char* name, int mode, int clients, int depth, int seconds){
+    g_stop = false;
+    g_requests = 0;
+    std::vector<std::thread> workers;
+    for(int i = 0; i < clients; ++i){
+        workers.emplace_back(Client, mode, depth);
+    }
+    sleep(seconds);
+    g_stop = true;
+    for(auto& worker : workers){
+        worker.join();
+    }
+    std::cerr << name << ": " << g_requests / seconds << " requests/s" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    int clients = argc > 1 ? atoi(argv[1]) : 16;
+    int depth = argc > 2 ? atoi(argv[2]) : 16;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    // 每个连接都会输出日志，结果输出到标准错误
+    freopen("/dev/null", "w", stdout);
+
+    std::atomic<bool> started(false);
+    std::thread([&started](){
+        // 主循环需要在运行它的线程中构造
+        HttpServer* server = new HttpServer(BENCH_PORT);
+        server->SetThreadCount(2);
+        server->Get("/hello", [](const HttpRequest&, HttpResponse& response){
+            response.Reply(200, "text/plain", "hello world");
+        });
+        started = true;
+        server->Start();
+    }).detach();
+    while(!started) usleep(1000);
+    usleep(200000);
+
+    Run("close", 0, clients, depth, seconds);
+    Run("keep-alive", 1, clients, depth, seconds);
+    Run("pipeline", 2, clients, depth, seconds);
+    return 0;
+}
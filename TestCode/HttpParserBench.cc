@@ -0,0 +1,127 @@
+#include "../Http.hpp"
+#include <iostream>
+#include <regex>
+#include <unordered_map>
+
+// HTTP 请求解析的吞吐：RegexMatching.cc 中的正则方式与增量解析器 HttpParser
+// regex: 用正则匹配请求行，按行切分头部存入 unordered_map，请求体拷贝成 string
+// parser: 在 Buffer 上直接解析，所有字段都是指向缓冲区的视图
+// 每个请求都从缓冲区中取走，单线程运行，结果即每核每秒请求数
+// 用法: ./HttpParserBench [请求数]
+
+static const char* g_request =
+    "GET /index.html?name=123&age=20 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Cookie: session=0123456789abcdef; theme=dark\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 11\r\n"
+    "\r\n"
+    "hello=world";
+
+static volatile uint64_t g_sink = 0;
+
+struct RegexRequest{
+    std::string method;
+    std::string path;
+    std::string query;
+    std::string version;
+    std::unordered_map<std::string, std::string> headers;
+    std::string body;
+};
+
+// 返回解析掉的字节数，数据不完整时返回 0
+size_t RegexParse(const std::regex& reg, Buffer* buffer, RegexRequest* request){
+    std::string data(buffer->GetReadIndex(), buffer->GetReadableSize());
+    size_t lineEnd = data.find("\r\n");
+    if(lineEnd == std::string::npos){
+        return 0;
+    }
+    std::string line = data.substr(0, lineEnd + 2);
+    std::smatch match;
+    if(!std::regex_match(line, match, reg)){
+        return 0;
+    }
+    request->method = match[1];
+    request->path = match[3];
+    request->query = match[4];
+    request->version = match[5];
+    request->headers.clear();
+    size_t pos = lineEnd + 2;
+    while(true){
+        size_t end = data.find("\r\n", pos);
+        if(end == std::string::npos){
+            return 0;
+        }
+        if(end == pos){
+            pos += 2;
+            break;
+        }
+        std::string header = data.substr(pos, end - pos);
+        size_t colon = header.find(": ");
+        if(colon != std::string::npos){
+            request->headers[header.substr(0, colon)] = header.substr(colon + 2);
+        }
+        pos = end + 2;
+    }
+    auto it = request->headers.find("Content-Length");
+    size_t length = it == request->headers.end() ? 0 : std::stoul(it->second);
+    if(data.size() - pos < length){
+        return 0;
+    }
+    request->body = data.substr(pos, length);
+    return pos + length;
+}
+
+void Report(const char* name, uint64_t count, uint64_t us){
+    std::cout << name << ": " << (us ? count * 1000000 / us : 0) << " requests/s per core, "
+              << (count ? us * 1000.0 / count : 0) << " ns/request" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    uint64_t count = argc > 1 ? atoll(argv[1]) : 1000000;
+    size_t size = strlen(g_request);
+    Buffer buffer;
+
+    std::regex reg("(GET|HEAD|POST|PUT|DELETE) (([^?]+)(?:\\?(.*?))?) (HTTP/1\\.[01])(?:\r\n|\n)");
+    RegexRequest regexRequest;
+    // 正则方式慢得多，只跑十分之一的请求
+    uint64_t regexCount = count / 10;
+    uint64_t start = MonotonicUs();
+    for(uint64_t i = 0; i < regexCount; ++i){
+        buffer.WritePush(g_request, size);
+        size_t used = RegexParse(reg, &buffer, &regexRequest);
+        buffer.UpdateReadIndex(used);
+        g_sink = g_sink + regexRequest.headers.size() + regexRequest.body.size();
+    }
+    Report("regex", regexCount, MonotonicUs() - start);
+
+    HttpParser parser;
+    start = MonotonicUs();
+    for(uint64_t i = 0; i < count; ++i){
+        buffer.WritePush(g_request, size);
+        if(parser.Parse(&buffer) == HttpParser::HTTP_COMPLETE){
+            const HttpRequest& request = parser.GetRequest();
+            g_sink = g_sink + request.HeaderCount() + request.Body().size() + request.GetHeader("host").size();
+            parser.Consume(&buffer);
+        }
+    }
+    Report("parser", count, MonotonicUs() - start);
+
+    // 同样的请求每次只到达 16 字节，测试断点续扫的开销
+    start = MonotonicUs();
+    for(uint64_t i = 0; i < count; ++i){
+        for(size_t off = 0; off < size; off += 16){
+            buffer.WritePush(g_request + off, std::min<size_t>(16, size - off));
+            if(parser.Parse(&buffer) == HttpParser::HTTP_COMPLETE){
+                g_sink = g_sink + parser.GetRequest().HeaderCount();
+                parser.Consume(&buffer);
+            }
+        }
+    }
+    Report("parser (16-byte reads)", count, MonotonicUs() - start);
+    return 0;
+}
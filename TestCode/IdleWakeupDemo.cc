@@ -0,0 +1,39 @@
+#include "../Server.hpp"
+#include <iostream>
+
+// 空闲事件循环的唤醒次数：周期性 timerfd 与无节拍模式对比
+// 每种模式分别测试没有定时器和每个循环挂一个 30 分钟空闲超时定时器两种情况
+// 用法: ./IdleWakeupDemo [线程数] [每种情况运行秒数]
+
+void Run(const char* name, int count, int seconds, bool tickless, bool withTimer){
+    LoopThreadOptions options;
+    options.TimerTickless = tickless;
+    std::vector<std::unique_ptr<LoopThread>> threads;
+    for(int i = 0; i < count; ++i){
+        threads.emplace_back(new LoopThread(options));
+    }
+    std::vector<uint64_t> start;
+    for(auto& thread : threads){
+        if(withTimer){
+            thread->GetLoop()->RunAfter(30 * 60 * 1000, []{});
+        }
+        start.push_back(thread->GetLoop()->GetStatsSnapshot().Iterations);
+    }
+    sleep(seconds);
+    uint64_t total = 0;
+    for(size_t i = 0; i < threads.size(); ++i){
+        total += threads[i]->GetLoop()->GetStatsSnapshot().Iterations - start[i];
+    }
+    std::cout << name << (withTimer ? " with timer" : " no timer") << ": "
+              << total << " wakeups, " << (double)total / count / seconds << " per loop per second" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    int count = argc > 1 ? atoi(argv[1]) : 64;
+    int seconds = argc > 2 ? atoi(argv[2]) : 3;
+    Run("periodic", count, seconds, false, false);
+    Run("periodic", count, seconds, false, true);
+    Run("tickless", count, seconds, true, false);
+    Run("tickless", count, seconds, true, true);
+    return 0;
+}
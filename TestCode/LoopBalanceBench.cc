@@ -0,0 +1,121 @@
+#include "../Server.hpp"
+#include <iostream>
+#include <cmath>
+#include <cstring>
+
+// 负载倾斜场景下各事件循环 CPU 时间的分布
+// 少量高频客户端 + 大量空闲客户端，高频客户端恰好按轮询间隔建立连接
+// 用法: ./LoopBalanceBench [线程数] [每种策略运行秒数]
+
+static std::atomic<bool> g_stop(false);
+
+// 按消息大小消耗 CPU，模拟请求处理
+void OnMessage(const PtrConnection& conn, Buffer* buffer){
+    uint64_t len = buffer->GetReadableSize();
+    uint64_t hash = 0;
+    const char* data = buffer->GetReadIndex();
+    for(int round = 0; round < 50; ++round){
+        for(uint64_t i = 0; i < len; ++i){
+            hash = hash * 131 + data[i];
+        }
+    }
+    buffer->UpdateReadIndex(len);
+    char ack = (char)hash | 1;
+    conn->Send(&ack, 1);
+}
+
+int Connect(int port){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+void ChattyClient(int fd){
+    char data[1024];
+    memset(data, 'x', sizeof(data));
+    while(!g_stop){
+        if(send(fd, data, sizeof(data), 0) <= 0) break;
+        char ack;
+        if(recv(fd, &ack, 1, 0) <= 0) break;
+    }
+}
+
+void RunCase(const char* name, LoopBalance balance, int port, int threads, int seconds){
+    const int chatty = threads;
+    const int total = threads * 16;
+
+    TCPServer* server = nullptr;
+    std::thread([&server, port, threads, balance](){
+        // 主循环需要在运行它的线程中构造
+        TCPServer* srv = new TCPServer(port);
+        srv->SetThreadCount(threads);
+        srv->SetLoopBalance(balance);
+        srv->SetMessageCallback(OnMessage);
+        server = srv;
+        srv->Start();
+    }).detach();
+    while(server == nullptr) usleep(1000);
+    usleep(200000);
+
+    g_stop = false;
+    std::vector<int> fds;
+    std::vector<std::thread> clients;
+    int chattyStarted = 0;
+    for(int i = 0; i < total; ++i){
+        int fd = Connect(port);
+        fds.push_back(fd);
+        if(i % threads == 0 && chattyStarted < chatty){
+            clients.emplace_back(ChattyClient, fd);
+            ++chattyStarted;
+        }
+        // 留出时间让负载体现在统计中
+        usleep(20000);
+    }
+
+    std::vector<LoopStatsSnapshot> before = server->GetLoopStats();
+    sleep(seconds);
+    std::vector<LoopStatsSnapshot> after = server->GetLoopStats();
+
+    g_stop = true;
+    for(auto& fd : fds) shutdown(fd, SHUT_RDWR);
+    for(auto& t : clients) t.join();
+    for(auto& fd : fds) close(fd);
+
+    // 第 0 个为主循环，只统计从属循环
+    std::vector<double> busy;
+    double sum = 0, maxBusy = 0, minBusy = 1e18;
+    for(size_t i = 1; i < after.size(); ++i){
+        double ms = (after[i].BusyUs - before[i].BusyUs) / 1000.0;
+        busy.push_back(ms);
+        sum += ms;
+        maxBusy = std::max(maxBusy, ms);
+        minBusy = std::min(minBusy, ms);
+    }
+    double mean = sum / busy.size(), var = 0;
+    for(double ms : busy) var += (ms - mean) * (ms - mean);
+    double cv = mean > 0 ? std::sqrt(var / busy.size()) / mean : 0;
+
+    printf("%-22s busy ms per loop:", name);
+    for(size_t i = 0; i < busy.size(); ++i){
+        printf(" %8.1f(%llu conns)", busy[i], (unsigned long long)after[i + 1].Connections);
+    }
+    printf("\n%-22s max/min = %.2f, cv = %.3f\n", "", minBusy > 0 ? maxBusy / minBusy : 0.0, cv);
+}
+
+int main(int argc, char* argv[]){
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int seconds = argc > 2 ? atoi(argv[2]) : 3;
+    RunCase("round robin", ROUND_ROBIN, 9301, threads, seconds);
+    RunCase("least connections", LEAST_CONNECTIONS, 9302, threads, seconds);
+    RunCase("least busy", LEAST_BUSY, 9303, threads, seconds);
+    RunCase("power of two choices", POWER_OF_TWO_CHOICES, 9304, threads, seconds);
+    return 0;
+}
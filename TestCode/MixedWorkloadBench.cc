@@ -0,0 +1,151 @@
+#include "../Server.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <netinet/tcp.h>
+
+// 同一个事件循环上混合大流量上传和小请求时，小请求的延迟
+// 大流量客户端不停发送数据，服务端逐字节计算校验和模拟处理开销；小请求客户端发送 32 字节请求并等待回应
+// 分别测试不限制每轮读取预算和默认预算（TCPServer::SetReadBudget），输出小请求延迟的分位数和上传吞吐
+// 用法: ./MixedWorkloadBench [大流量客户端数] [小请求客户端数] [每种情况运行秒数]
+
+#define REQUEST_SIZE 32
+
+static std::atomic<bool> g_stop(false);
+static std::atomic<uint64_t> g_uploaded(0);
+static std::mutex g_mutex;
+static std::vector<uint64_t> g_latencies;
+static volatile uint64_t g_sink = 0;
+
+void OnMessage(const PtrConnection& conn, Buffer* buffer){
+    // 大流量连接只发送 'B'，小请求以 'P' 开头
+    if(*buffer->GetReadIndex() == 'B'){
+        uint64_t sum = 0;
+        const char* data = buffer->GetReadIndex();
+        for(uint64_t i = 0; i < buffer->GetReadableSize(); ++i){
+            sum = sum * 31 + data[i];
+        }
+        g_sink = g_sink + sum;
+        buffer->UpdateReadIndex(buffer->GetReadableSize());
+        return;
+    }
+    while(buffer->GetReadableSize() >= REQUEST_SIZE){
+        conn->Send(buffer->GetReadIndex(), REQUEST_SIZE);
+        buffer->UpdateReadIndex(REQUEST_SIZE);
+    }
+}
+
+int Connect(int port){
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        close(fd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+void BulkClient(int port){
+    int fd = Connect(port);
+    std::vector<char> data(256 * 1024, 'B');
+    while(fd >= 0 && !g_stop){
+        ssize_t n = send(fd, data.data(), data.size(), 0);
+        if(n <= 0){
+            break;
+        }
+        g_uploaded += n;
+    }
+    close(fd);
+}
+
+void SmallClient(int port){
+    int fd = Connect(port);
+    char request[REQUEST_SIZE];
+    memset(request, 'P', sizeof(request));
+    std::vector<uint64_t> latencies;
+    while(fd >= 0 && !g_stop){
+        uint64_t start = MonotonicUs();
+        if(send(fd, request, sizeof(request), 0) != sizeof(request)){
+            break;
+        }
+        size_t got = 0;
+        char reply[REQUEST_SIZE];
+        while(got < sizeof(reply)){
+            ssize_t n = recv(fd, reply + got, sizeof(reply) - got, 0);
+            if(n <= 0){
+                break;
+            }
+            got += n;
+        }
+        if(got < sizeof(reply)){
+            break;
+        }
+        latencies.push_back(MonotonicUs() - start);
+        usleep(1000);
+    }
+    close(fd);
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_latencies.insert(g_latencies.end(), latencies.begin(), latencies.end());
+}
+
+void Run(const char* name, int port, int bulks, int smalls, int seconds, uint64_t budgetBytes, uint64_t budgetEvents){
+    std::atomic<bool> started(false);
+    std::thread([&started, port, budgetBytes, budgetEvents](){
+        // 主循环需要在运行它的线程中构造
+        TCPServer* server = new TCPServer(port);
+        // 所有连接放在同一个循环上
+        server->SetThreadCount(1);
+        server->SetReadBudget(budgetBytes, budgetEvents);
+        server->SetMessageCallback(OnMessage);
+        started = true;
+        server->Start();
+    }).detach();
+    while(!started) usleep(1000);
+    usleep(200000);
+
+    g_stop = false;
+    g_uploaded = 0;
+    g_latencies.clear();
+    std::vector<std::thread> workers;
+    for(int i = 0; i < bulks; ++i){
+        workers.emplace_back(BulkClient, port);
+    }
+    // 等大流量连接的读取大小增长到稳定后再开始测量
+    usleep(500000);
+    g_uploaded = 0;
+    for(int i = 0; i < smalls; ++i){
+        workers.emplace_back(SmallClient, port);
+    }
+    sleep(seconds);
+    g_stop = true;
+    for(auto& worker : workers){
+        worker.join();
+    }
+
+    std::sort(g_latencies.begin(), g_latencies.end());
+    size_t count = g_latencies.size();
+    if(count == 0){
+        std::cerr << name << ": no requests completed" << std::endl;
+        return;
+    }
+    std::cerr << name << ": " << count << " requests, latency p50 " << g_latencies[count / 2]
+              << " us, p99 " << g_latencies[count * 99 / 100] << " us, max " << g_latencies[count - 1]
+              << " us, upload " << g_uploaded / seconds / (1024 * 1024) << " MB/s" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    int bulks = argc > 1 ? atoi(argv[1]) : 16;
+    int smalls = argc > 2 ? atoi(argv[2]) : 8;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    // 每个连接都会输出日志，结果输出到标准错误
+    freopen("/dev/null", "w", stdout);
+    Run("no read budget", 9611, bulks, smalls, seconds, 0, 0);
+    Run("default read budget", 9612, bulks, smalls, seconds, DEFAULT_READ_BUDGET_BYTES, DEFAULT_READ_BUDGET_EVENTS);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "../Server.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+// 过载时的请求延迟：一个事件循环，每个请求处理耗时 200us，客户端数超过服务能力
+// 分别测试不做过载保护和按循环延迟拒绝新消息（TCPServer::SetOverloadShedding，回复 BUSY）
+// 输出正常处理的请求的延迟分位数、吞吐和被拒绝的比例；被拒绝的客户端等待 1ms 后重试
+// 用法: ./OverloadBench [客户端数] [延迟阈值(us)] [每种情况运行秒数]
+
+#define REQUEST_SIZE 16
+
+static std::atomic<bool> g_stop(false);
+static std::atomic<uint64_t> g_rejected(0);
+static std::mutex g_mutex;
+static std::vector<uint64_t> g_latencies;
+
+void Work(uint64_t us){
+    uint64_t end = MonotonicUs() + us;
+    while(MonotonicUs() < end);
+}
+
+void OnMessage(const PtrConnection& conn, Buffer* buffer){
+    while(buffer->GetReadableSize() >= REQUEST_SIZE){
+        Work(200);
+        conn->Send(buffer->GetReadIndex(), REQUEST_SIZE);
+        buffer->UpdateReadIndex(REQUEST_SIZE);
+    }
+}
+
+// 过载时不处理请求，每个请求回复同样长度的 BUSY
+void OnOverload(const PtrConnection& conn, Buffer* buffer){
+    char busy[REQUEST_SIZE];
+    memset(busy, 'B', sizeof(busy));
+    while(buffer->GetReadableSize() >= REQUEST_SIZE){
+        conn->Send(busy, sizeof(busy));
+        buffer->UpdateReadIndex(REQUEST_SIZE);
+    }
+}
+
+void Client(int port){
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        close(fd);
+        return;
+    }
+    char request[REQUEST_SIZE];
+    memset(request, 'Q', sizeof(request));
+    std::vector<uint64_t> latencies;
+    while(!g_stop){
+        uint64_t start = MonotonicUs();
+        if(send(fd, request, sizeof(request), 0) != sizeof(request)){
+            break;
+        }
+        char reply[REQUEST_SIZE];
+        size_t got = 0;
+        while(got < sizeof(reply)){
+            ssize_t n = recv(fd, reply + got, sizeof(reply) - got, 0);
+            if(n <= 0){
+                break;
+            }
+            got += n;
+        }
+        if(got < sizeof(reply)){
+            break;
+        }
+        if(reply[0] == 'B'){
+            ++g_rejected;
+            usleep(1000);
+            continue;
+        }
+        latencies.push_back(MonotonicUs() - start);
+    }
+    close(fd);
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_latencies.insert(g_latencies.end(), latencies.begin(), latencies.end());
+}
+
+void Run(const char* name, int port, int clients, uint64_t lagUs, int seconds){
+    std::atomic<bool> started(false);
+    std::thread([&started, port, lagUs](){
+        // 主循环需要在运行它的线程中构造
+        TCPServer* server = new TCPServer(port);
+        server->SetThreadCount(1);
+        server->SetMessageCallback(OnMessage);
+        if(lagUs > 0){
+            server->SetOverloadShedding(lagUs, OnOverload);
+        }
+        started = true;
+        server->Start();
+    }).detach();
+    while(!started) usleep(1000);
+    usleep(200000);
+
+    g_stop = false;
+    g_rejected = 0;
+    g_latencies.clear();
+    std::vector<std::thread> workers;
+    for(int i = 0; i < clients; ++i){
+        workers.emplace_back(Client, port);
+    }
+    sleep(seconds);
+    g_stop = true;
+    for(auto& worker : workers){
+        worker.join();
+    }
+
+    std::sort(g_latencies.begin(), g_latencies.end());
+    size_t count = g_latencies.size();
+    if(count == 0){
+        std::cerr << name << ": no requests completed" << std::endl;
+        return;
+    }
+    std::cerr << name << ": " << count / seconds << " requests/s, latency p50 " << g_latencies[count / 2]
+              << " us, p99 " << g_latencies[count * 99 / 100] << " us, rejected "
+              << g_rejected * 100.0 / (g_rejected + count) << "%" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    int clients = argc > 1 ? atoi(argv[1]) : 64;
+    uint64_t lagUs = argc > 2 ? atoll(argv[2]) : 1000;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    // 每个连接都会输出日志，结果输出到标准错误
+    freopen("/dev/null", "w", stdout);
+    Run("no shedding", 9631, clients, 0, seconds);
+    Run("lag shedding", 9632, clients, lagUs, seconds);
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "../Server.hpp"
+#include <iostream>
+#include <cstring>
+
+// 流水线请求的发送开销：客户端一次发出一批 16 字节的请求，服务端对每个请求单独 Send 一个 32 字节的回应
+// 分别测试关闭写合并、开启写合并和写合并加 TCP_CORK（TCPServer::SetWriteCoalescing）
+// 输出每秒请求数，以及服务端平均每个请求的发送、epoll_ctl 和循环轮数（每轮一次 epoll_wait）
+// 用法: ./PipelineBench [客户端数] [每批请求数] [每种情况运行秒数]
+
+#define REQUEST_SIZE 16
+#define RESPONSE_SIZE 32
+
+static std::atomic<bool> g_stop(false);
+static std::atomic<uint64_t> g_requests(0);
+
+void OnMessage(const PtrConnection& conn, Buffer* buffer){
+    char response[RESPONSE_SIZE];
+    memset(response, 'R', sizeof(response));
+    while(buffer->GetReadableSize() >= REQUEST_SIZE){
+        conn->Send(response, sizeof(response));
+        buffer->UpdateReadIndex(REQUEST_SIZE);
+    }
+}
+
+void Client(int port, int depth){
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        close(fd);
+        return;
+    }
+    std::vector<char> requests(REQUEST_SIZE * depth, 'Q');
+    std::vector<char> responses(RESPONSE_SIZE * depth);
+    while(!g_stop){
+        if(send(fd, requests.data(), requests.size(), 0) != (ssize_t)requests.size()){
+            break;
+        }
+        size_t got = 0;
+        while(got < responses.size()){
+            ssize_t n = recv(fd, responses.data() + got, responses.size() - got, 0);
+            if(n <= 0){
+                break;
+            }
+            got += n;
+        }
+        if(got < responses.size()){
+            break;
+        }
+        g_requests += depth;
+    }
+    close(fd);
+}
+
+// 所有循环的发送次数、epoll_ctl 次数和循环轮数之和
+LoopStatsSnapshot Total(TCPServer* server){
+    LoopStatsSnapshot total;
+    memset(&total, 0, sizeof(total));
+    for(auto& stats : server->GetLoopStats()){
+        total.Writes += stats.Writes;
+        total.EventUpdates += stats.EventUpdates;
+        total.Iterations += stats.Iterations;
+    }
+    return total;
+}
+
+void Run(const char* name, int port, int clients, int depth, int seconds, bool coalesce, bool cork){
+    std::atomic<TCPServer*> started(nullptr);
+    std::thread([&started, port, coalesce, cork](){
+        // 主循环需要在运行它的线程中构造
+        TCPServer* server = new TCPServer(port);
+        server->SetThreadCount(1);
+        server->SetWriteCoalescing(coalesce, cork);
+        server->SetMessageCallback(OnMessage);
+        started = server;
+        server->Start();
+    }).detach();
+    while(started == nullptr) usleep(1000);
+    TCPServer* server = started;
+    usleep(200000);
+
+    g_stop = false;
+    g_requests = 0;
+    LoopStatsSnapshot before = Total(server);
+    std::vector<std::thread> workers;
+    for(int i = 0; i < clients; ++i){
+        workers.emplace_back(Client, port, depth);
+    }
+    sleep(seconds);
+    g_stop = true;
+    for(auto& worker : workers){
+        worker.join();
+    }
+    LoopStatsSnapshot after = Total(server);
+    double requests = g_requests ? (double)g_requests : 1;
+    std::cerr << name << ": " << g_requests / seconds << " requests/s, per request: "
+              << (after.Writes - before.Writes) / requests << " writes, "
+              << (after.EventUpdates - before.EventUpdates) / requests << " epoll_ctl, "
+              << (after.Iterations - before.Iterations) / requests << " iterations" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    int clients = argc > 1 ? atoi(argv[1]) : 4;
+    int depth = argc > 2 ? atoi(argv[2]) : 20;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    // 每个连接都会输出日志，结果输出到标准错误
+    freopen("/dev/null", "w", stdout);
+    Run("no coalescing", 9621, clients, depth, seconds, false, false);
+    Run("coalescing", 9622, clients, depth, seconds, true, false);
+    Run("coalescing + cork", 9623, clients, depth, seconds, true, true);
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include "../Http.hpp"
+#include <iostream>
+
+// 响应缓存的效果：客户端反复请求少量几个键，响应每秒变化一次
+// none: 每个请求都重新生成响应（约 2KB 的 JSON）
+// copy: 缓存生成好的响应体，命中时仍由 Reply 拷贝到输出缓冲区
+// cached: 缓存完整的序列化响应，命中时由 SendCached 直接引用发送
+// 两种缓存都通过 ResponseCache::Get 查找和生成，结果交给 HttpResponse::Defer 返回的延迟响应
+// 用法: ./ResponseCacheBench [客户端数] [流水线深度] [每种情况运行秒数]
+
+#define BENCH_PORT 9647
+#define BENCH_KEYS 8
+
+static std::atomic<bool> g_stop(false);
+static std::atomic<uint64_t> g_requests(0);
+static ResponseCache g_cache(RESPONSE_CACHE_SHARD_BYTES, 1000);
+
+// 模拟从数据生成响应
+std::string Render(std::string_view key){
+    std::string body = "{\"key\":\"" + std::string(key) + "\",\"items\":[";
+    char item[64];
+    for(int i = 0; i < 64; ++i){
+        int len = snprintf(item, sizeof(item), "%s{\"id\":%d,\"score\":%.3f}", i ? "," : "", i, i * 1.618);
+        body.append(item, len);
+    }
+    body += "]}";
+    return body;
+}
+
+void NoCache(const HttpRequest& request, HttpResponse& response){
+    response.Reply(200, "application/json", Render(request.Query()));
+}
+
+// 生成失败或超时时回复 503
+void ReplyUnavailable(HttpResponse& response){
+    response.Reply(503, "text/plain", "Service Unavailable\n");
+}
+
+void CopyCache(const HttpRequest& request, HttpResponse& response){
+    EventLoop* loop = response.GetConnection()->GetLoop();
+    std::string query(request.Query());
+    std::shared_ptr<HttpDeferred> deferred = response.Defer();
+    g_cache.Get(loop, "copy:" + query, [query](const ResponseCache::FillDone& done){
+        done(std::make_shared<std::string>(Render(query)), 0);
+    }, [deferred](const ResponseCache::Blob& body){
+        deferred->Complete([body](HttpResponse& response){
+            if(!body){
+                return ReplyUnavailable(response);
+            }
+            response.Reply(200, "application/json", *body);
+        });
+    });
+}
+
+void WireCache(const HttpRequest& request, HttpResponse& response){
+    EventLoop* loop = response.GetConnection()->GetLoop();
+    std::string query(request.Query());
+    std::shared_ptr<HttpDeferred> deferred = response.Defer();
+    g_cache.Get(loop, "wire:" + query, [query](const ResponseCache::FillDone& done){
+        done(HttpBuildResponse(200, "application/json", Render(query)), 0);
+    }, [deferred](const ResponseCache::Blob& wire){
+        deferred->Complete([wire](HttpResponse& response){
+            if(!wire){
+                return ReplyUnavailable(response);
+            }
+            response.SendCached(wire);
+        });
+    });
+}
+
+int Connect(){
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 读取 count 个完整的响应
+bool ReadResponses(int fd, int count, std::string& data){
+    data.clear();
+    size_t pos = 0;
+    while(count > 0){
+        size_t end = data.find("\r\n\r\n", pos);
+        if(end != std::string::npos){
+            size_t length = atoi(data.c_str() + data.find("Content-Length: ", pos) + 16);
+            if(data.size() >= end + 4 + length){
+                pos = end + 4 + length;
+                --count;
+                continue;
+            }
+        }
+        char buf[65536];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0){
+            return false;
+        }
+        data.append(buf, n);
+    }
+    return true;
+}
+
+void Client(const std::string& path, int depth, int seed){
+    std::string batch;
+    for(int i = 0; i < depth; ++i){
+        batch += "GET " + path + "?key" + std::to_string((seed + i) % BENCH_KEYS) + " HTTP/1.1\r\n\r\n";
+    }
+    std::string data;
+    int fd = Connect();
+    while(!g_stop){
+        send(fd, batch.data(), batch.size(), 0);
+        if(!ReadResponses(fd, depth, data)){
+            break;
+        }
+        g_requests += depth;
+    }
+    close(fd);
+}
+
+void Run(const char* name, const std::string& path, int clients, int depth, int seconds){
+    g_stop = false;
+    g_requests = 0;
+    std::vector<std::thread> workers;
+    for(int i = 0; i < clients; ++i){
+        workers.emplace_back(Client, path, depth, i);
+    }
+    sleep(seconds);
+    g_stop = true;
+    for(auto& worker : workers){
+        worker.join();
+    }
+    std::cerr << name << ": " << g_requests / seconds << " requests/s" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    int clients = argc > 1 ? atoi(argv[1]) : 8;
+    int depth = argc > 2 ? atoi(argv[2]) : 16;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    // 每个连接都会输出日志，结果输出到标准错误
+    freopen("/dev/null", "w", stdout);
+
+    std::atomic<bool> started(false);
+    std::thread([&started](){
+        // 主循环需要在运行它的线程中构造
+        HttpServer* server = new HttpServer(BENCH_PORT);
+        server->SetThreadCount(2);
+        server->Get("/none", NoCache);
+        server->Get("/copy", CopyCache);
+        server->Get("/cached", WireCache);
+        started = true;
+        server->Start();
+    }).detach();
+    while(!started) usleep(1000);
+    usleep(200000);
+
+    Run("none", "/none", clients, depth, seconds);
+    Run("copy", "/copy", clients, depth, seconds);
+    Run("cached", "/cached", clients, depth, seconds);
+    ResponseCacheStatsSnapshot stats = g_cache.GetStats();
+    std::cerr << "cache: " << stats.Hits << " hits, " << stats.Misses << " misses, "
+              << stats.Expired << " expired, " << stats.Fills << " fills" << std::endl;
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "../Http.hpp"
+#include <iostream>
+
+// 静态文件服务的吞吐：每个请求 open/fstat/read/close 与 StaticFileHandler（文件缓存 + sendfile/内存副本）
+// 客户端使用保持连接逐个请求同一个文件，分别测试 4KB（走内存副本）和 256KB（走 sendfile）的文件
+// 用法: ./StaticFileBench [客户端数] [每种情况运行秒数]
+
+#define BENCH_PORT 9646
+#define BENCH_DIR "/tmp/StaticFileBench"
+
+static std::atomic<bool> g_stop(false);
+static std::atomic<uint64_t> g_requests(0);
+
+// 不做缓存的实现：每个请求都打开文件、读入内存再关闭
+void NaiveHandler(const HttpRequest& request, HttpResponse& response){
+    std::string path = BENCH_DIR + std::string(request.Path().substr(5));
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        return response.Reply(404, "text/plain", "Not Found\n");
+    }
+    struct stat st;
+    fstat(fd, &st);
+    std::string content(st.st_size, '\0');
+    size_t got = 0;
+    while(got < content.size()){
+        ssize_t n = read(fd, &content[got], content.size() - got);
+        if(n <= 0){
+            break;
+        }
+        got += n;
+    }
+    close(fd);
+    response.Reply(200, HttpMimeType(path), content);
+}
+
+int Connect(){
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 读取一个完整的响应
+bool ReadResponse(int fd, std::vector<char>& data){
+    size_t size = 0;
+    size_t total = 0;
+    while(true){
+        if(total == 0){
+            char* end = (char*)memmem(data.data(), size, "\r\n\r\n", 4);
+            if(end != nullptr){
+                char* length = (char*)memmem(data.data(), end - data.data(), "Content-Length: ", 16);
+                total = end + 4 - data.data() + atoll(length + 16);
+            }
+        }
+        if(total > 0 && size >= total){
+            return true;
+        }
+        if(data.size() - size < 65536){
+            data.resize(size + 65536);
+        }
+        ssize_t n = recv(fd, data.data() + size, data.size() - size, 0);
+        if(n <= 0){
+            return false;
+        }
+        size += n;
+    }
+}
+
+void Client(std::string request){
+    std::vector<char> data;
+    int fd = Connect();
+    while(!g_stop){
+        send(fd, request.data(), request.size(), 0);
+        if(!ReadResponse(fd, data)){
+            break;
+        }
+        ++g_requests;
+    }
+    close(fd);
+}
+
+void Run(const char* name, const std::string& path, int clients, int seconds){
+    g_stop = false;
+    g_requests = 0;
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: bench\r\n\r\n";
+    std::vector<std::thread> workers;
+    for(int i = 0; i < clients; ++i){
+        workers.emplace_back(Client, request);
+    }
+    sleep(seconds);
+    g_stop = true;
+    for(auto& worker : workers){
+        worker.join();
+    }
+    std::cerr << name << ": " << g_requests / seconds << " requests/s" << std::endl;
+}
+
+void WriteFile(const std::string& path, size_t size){
+    std::string content(size, 'x');
+    FILE* file = fopen(path.c_str(), "w");
+    fwrite(content.data(), 1, content.size(), file);
+    fclose(file);
+}
+
+int main(int argc, char* argv[]){
+    int clients = argc > 1 ? atoi(argv[1]) : 8;
+    int seconds = argc > 2 ? atoi(argv[2]) : 5;
+    // 每个连接都会输出日志，结果输出到标准错误
+    freopen("/dev/null", "w", stdout);
+    mkdir(BENCH_DIR, 0755);
+    WriteFile(BENCH_DIR "/small.html", 4 * 1024);
+    WriteFile(BENCH_DIR "/large.bin", 256 * 1024);
+
+    std::shared_ptr<FileCache> cache = std::make_shared<FileCache>();
+    std::atomic<bool> started(false);
+    std::thread([&started, cache](){
+        // 主循环需要在运行它的线程中构造
+        HttpServer* server = new HttpServer(BENCH_PORT);
+        server->SetThreadCount(2);
+        server->Mount("/open/", NaiveHandler);
+        server->Mount("/cache/", StaticFileHandler("/cache/", BENCH_DIR, cache));
+        started = true;
+        server->Start();
+    }).detach();
+    while(!started) usleep(1000);
+    usleep(200000);
+
+    Run("4KB open per request", "/open/small.html", clients, seconds);
+    Run("4KB cached", "/cache/small.html", clients, seconds);
+    Run("256KB open per request", "/open/large.bin", clients, seconds);
+    Run("256KB cached + sendfile", "/cache/large.bin", clients, seconds);
+    FileCacheStatsSnapshot stats = cache->GetStats();
+    std::cerr << "cache: " << stats.Hits << " hits, " << stats.Revalidated << " revalidated, "
+              << stats.Opened << " opened" << std::endl;
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include "../Http.hpp"
+#include <sys/resource.h>
+#include <iostream>
+
+// 大响应（CSV 导出）的首字节时间、总耗时和服务端内存
+// buffered: 先在内存中拼出完整的响应体，再由 Reply 写入输出缓冲区
+// stream: 通过 HttpResponse::Stream 边生成边发送，输出超过高水位后暂停生成，发到低水位后继续
+// 先运行 stream，两次的峰值 RSS 之差即为 buffered 额外占用的内存
+// 用法: ./StreamingBench [客户端数] [每个响应的行数]
+
+#define BENCH_PORT 9648
+#define BENCH_BATCH 256
+
+static std::atomic<uint64_t> g_peakOutput(0);
+
+// 模拟从数据源生成一行
+size_t RenderRow(uint64_t id, char* row, size_t size){
+    return snprintf(row, size, "%llu,user%llu@example.com,%.4f,2026-01-01T00:00:00Z,active\n",
+                    (unsigned long long)id, (unsigned long long)id, id * 0.618);
+}
+
+void UpdatePeak(uint64_t size){
+    uint64_t peak = g_peakOutput;
+    while(size > peak && !g_peakOutput.compare_exchange_weak(peak, size));
+}
+
+void BufferedExport(uint64_t rows, HttpResponse& response){
+    std::string body;
+    char row[128];
+    for(uint64_t id = 0; id < rows; ++id){
+        body.append(row, RenderRow(id, row, sizeof(row)));
+    }
+    response.Reply(200, "text/csv", body);
+    UpdatePeak(body.size() + response.GetConnection()->GetOutputSize());
+}
+
+struct ExportProducer{
+    std::shared_ptr<StreamWriter> Writer;
+    uint64_t Next;
+    uint64_t Rows;
+};
+
+// 每次生成一批行，写入器要求暂停时返回，等待恢复回调
+void Produce(const std::shared_ptr<ExportProducer>& producer){
+    std::string batch;
+    char row[128];
+    while(producer->Next < producer->Rows){
+        batch.clear();
+        uint64_t end = std::min(producer->Rows, producer->Next + BENCH_BATCH);
+        for(; producer->Next < end; ++producer->Next){
+            batch.append(row, RenderRow(producer->Next, row, sizeof(row)));
+        }
+        bool writable = producer->Writer->Write(batch);
+        UpdatePeak(producer->Writer->GetConnection()->GetOutputSize());
+        if(!writable){
+            return;
+        }
+    }
+    producer->Writer->End();
+}
+
+void StreamExport(uint64_t rows, HttpResponse& response){
+    response.AddHeader("Content-Type", "text/csv");
+    std::shared_ptr<ExportProducer> producer = std::make_shared<ExportProducer>();
+    producer->Writer = response.Stream();
+    producer->Next = 0;
+    producer->Rows = rows;
+    // 恢复回调持有生产者，流结束或连接关闭时写入器清空回调，生产者随之释放
+    producer->Writer->SetResumeCallback([producer](){
+        Produce(producer);
+    });
+    Produce(producer);
+}
+
+int Connect(){
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 读到连接关闭为止（请求为 HTTP/1.0，流式响应以关闭连接结束），返回首字节时间和总字节数
+void Fetch(const std::string& path, uint64_t* ttfb, uint64_t* bytes){
+    std::string request = "GET " + path + " HTTP/1.0\r\n\r\n";
+    uint64_t start = MonotonicUs();
+    int fd = Connect();
+    send(fd, request.data(), request.size(), 0);
+    char buf[65536];
+    *ttfb = 0;
+    *bytes = 0;
+    while(true){
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0){
+            break;
+        }
+        if(*bytes == 0){
+            *ttfb = MonotonicUs() - start;
+        }
+        *bytes += n;
+    }
+    close(fd);
+}
+
+long PeakRssKB(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+void Run(const char* name, const std::string& path, int clients){
+    g_peakOutput = 0;
+    std::vector<uint64_t> ttfb(clients);
+    std::vector<uint64_t> bytes(clients);
+    std::vector<std::thread> workers;
+    uint64_t start = MonotonicUs();
+    for(int i = 0; i < clients; ++i){
+        workers.emplace_back(Fetch, path, &ttfb[i], &bytes[i]);
+    }
+    for(auto& worker : workers){
+        worker.join();
+    }
+    uint64_t elapsed = MonotonicUs() - start;
+    uint64_t totalTtfb = 0;
+    uint64_t totalBytes = 0;
+    for(int i = 0; i < clients; ++i){
+        totalTtfb += ttfb[i];
+        totalBytes += bytes[i];
+    }
+    std::cerr << name << ": ttfb " << totalTtfb / clients / 1000.0 << " ms, total " << elapsed / 1000 << " ms, "
+              << totalBytes / clients / 1024 << " KB per response, peak buffered " << g_peakOutput / 1024
+              << " KB per connection, peak rss " << PeakRssKB() / 1024 << " MB" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    int clients = argc > 1 ? atoi(argv[1]) : 4;
+    uint64_t rows = argc > 2 ? atoll(argv[2]) : 1000000;
+    // 每个连接都会输出日志，结果输出到标准错误
+    freopen("/dev/null", "w", stdout);
+
+    std::atomic<bool> started(false);
+    std::thread([&started, rows](){
+        // 主循环需要在运行它的线程中构造
+        HttpServer* server = new HttpServer(BENCH_PORT);
+        server->SetThreadCount(2);
+        server->Get("/buffered", [rows](const HttpRequest&, HttpResponse& response){
+            BufferedExport(rows, response);
+        });
+        server->Get("/stream", [rows](const HttpRequest&, HttpResponse& response){
+            StreamExport(rows, response);
+        });
+        started = true;
+        server->Start();
+    }).detach();
+    while(!started) usleep(1000);
+    usleep(200000);
+
+    Run("stream", "/stream", clients);
+    Run("buffered", "/buffered", clients);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "../Server.hpp"
+#include <iostream>
+#include <malloc.h>
+
+// 大量活跃连接频繁收发数据时空闲超时定时器的刷新开销和内存占用
+// 每个"连接"都有一个 30 秒的空闲超时，随机挑选连接刷新，模拟每个事件刷新一次
+// 对比按 id 管理的定时器（TimerAdd/TimerRefresh）和嵌入式节点（TimerSchedule）
+// 用法: ./TimerRefreshBench [连接数] [刷新次数]
+
+struct FakeConnection
+{
+    TimerTask _IdleTimer;
+    FakeConnection(uint64_t id): _IdleTimer(id, 0, []{}) {}
+};
+
+uint64_t Random(uint64_t& state){
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+size_t HeapBytes(){
+    return mallinfo2().uordblks;
+}
+
+void Report(const char* name, uint64_t count, uint64_t us, size_t before, size_t after){
+    std::cout << name << ": " << count << " refreshes, " << (count ? us * 1000.0 / count : 0) << " ns/op, "
+              << "heap growth " << (long)(after - before) / 1024 << " KB" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    uint64_t conns = argc > 1 ? atoll(argv[1]) : 100000;
+    uint64_t refreshes = argc > 2 ? atoll(argv[2]) : 10000000;
+    uint64_t rand = 88172645463325252ULL;
+    const uint32_t timeoutMs = 30 * 1000;
+
+    // 事件循环不运行，在本线程中直接调用，定时器都不会到期
+    EventLoop loop;
+
+    // 按 id 管理：加入时从节点池分配，刷新时查表并推迟到期时间
+    size_t before = HeapBytes();
+    for(uint64_t i = 0; i < conns; ++i){
+        loop.TimerAddMs(i, timeoutMs, []{});
+    }
+    size_t added = HeapBytes();
+    std::cout << "id timers: " << conns << " timers, heap " << (added - before) / 1024 << " KB" << std::endl;
+    uint64_t start = MonotonicUs();
+    for(uint64_t i = 0; i < refreshes; ++i){
+        loop.TimerRefresh(Random(rand) % conns);
+    }
+    Report("id refresh", refreshes, MonotonicUs() - start, added, HeapBytes());
+    for(uint64_t i = 0; i < conns; ++i){
+        loop.TimerCancel(i);
+    }
+
+    // 嵌入式节点：节点在连接对象中，刷新只修改到期时间
+    std::vector<std::unique_ptr<FakeConnection>> connections;
+    connections.reserve(conns);
+    for(uint64_t i = 0; i < conns; ++i){
+        connections.emplace_back(new FakeConnection(i));
+    }
+    before = HeapBytes();
+    for(auto& conn : connections){
+        loop.TimerSchedule(&conn->_IdleTimer, timeoutMs);
+    }
+    added = HeapBytes();
+    std::cout << "embedded timers: " << conns << " timers, heap " << (added - before) / 1024 << " KB" << std::endl;
+    start = MonotonicUs();
+    for(uint64_t i = 0; i < refreshes; ++i){
+        loop.TimerSchedule(&connections[Random(rand) % conns]->_IdleTimer, timeoutMs);
+    }
+    Report("embedded refresh", refreshes, MonotonicUs() - start, added, HeapBytes());
+    for(auto& conn : connections){
+        loop.TimerUnschedule(&conn->_IdleTimer);
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "../Server.hpp"
+#include <iostream>
+
+// 分层时间轮在大量活跃定时器下的添加、取消和到期开销
+// 直接驱动 TimingWheel，不经过 timerfd，每个 tick 视为 1ms
+// 最后测量长时间休眠后一次追赶 8 小时 tick 的耗时
+// 用法: ./TimerWheelBench [活跃定时器数] [最大超时 tick]
+
+static uint64_t g_fired = 0;
+
+uint64_t Random(uint64_t& state){
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+void Report(const char* name, uint64_t count, uint64_t us){
+    std::cout << name << ": " << count << " ops, " << us << " us, "
+              << (count ? us * 1000.0 / count : 0) << " ns/op" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    uint64_t count = argc > 1 ? atoll(argv[1]) : 1000000;
+    uint64_t maxTicks = argc > 2 ? atoll(argv[2]) : 30 * 60 * 1000;
+    uint64_t rand = 88172645463325252ULL;
+
+    TimingWheel wheel;
+    std::vector<std::unique_ptr<TimerTask>> timers;
+    timers.reserve(count);
+    for(uint64_t i = 0; i < count; ++i){
+        uint64_t expire = 1 + Random(rand) % maxTicks;
+        std::unique_ptr<TimerTask> timer(new TimerTask(i, expire, []{ ++g_fired; }));
+        timer->SetExpire(expire);
+        timers.push_back(std::move(timer));
+    }
+
+    // 添加
+    uint64_t start = MonotonicUs();
+    for(auto& timer : timers){
+        wheel.Add(timer.get());
+    }
+    Report("add", count, MonotonicUs() - start);
+
+    // 在 count 个活跃定时器下随机取消一半再重新加入，相当于刷新
+    uint64_t half = count / 2;
+    start = MonotonicUs();
+    for(uint64_t i = 0; i < half; ++i){
+        wheel.Remove(timers[Random(rand) % count].get());
+    }
+    Report("cancel", half, MonotonicUs() - start);
+    for(auto& timer : timers){
+        if(!timer->IsLinked()){
+            wheel.Add(timer.get());
+        }
+    }
+
+    // 推进到所有定时器到期，统计每个到期定时器的平均开销（含空槽和级联）
+    uint64_t remaining = wheel.Size();
+    start = MonotonicUs();
+    while(wheel.Size() > 0){
+        wheel.Advance(1, [](TimerTask* timer){ timer->Run(); });
+    }
+    Report("expire", remaining, MonotonicUs() - start);
+    std::cout << "ticks: " << wheel.Current() << ", fired: " << g_fired << std::endl;
+
+    // 无节拍模式下空闲循环整夜休眠后的第一次 RunExpired：一次推进 8 小时的 tick
+    // 分别测试没有定时器，和只挂一个 30 分钟空闲超时、休眠期间每次到期后重新挂入的情况
+    uint64_t sleepTicks = 8 * 3600 * 1000ULL;
+    start = MonotonicUs();
+    wheel.Advance(sleepTicks, [](TimerTask* timer){ timer->Run(); });
+    Report("catch-up empty", sleepTicks, MonotonicUs() - start);
+
+    TimerTask idle(0, 0, []{ ++g_fired; });
+    idle.SetExpire(wheel.Current() + 30 * 60 * 1000);
+    wheel.Add(&idle);
+    start = MonotonicUs();
+    wheel.Advance(sleepTicks, [&wheel](TimerTask* timer){
+        timer->Run();
+        timer->SetExpire(wheel.Current() + 30 * 60 * 1000);
+        wheel.Add(timer);
+    });
+    Report("catch-up idle timer", sleepTicks, MonotonicUs() - start);
+    wheel.Remove(&idle);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "../WebSocket.hpp"
+#include <iostream>
+
+// WebSocket 客户端帧的解析吞吐：逐字节去掩码与 WebSocketUnmask（SSE2/AVX2/NEON + 8 字节）
+// 每种负载大小都把同一帧反复写入缓冲区再解析取走，单线程运行，结果即每核的帧数和负载字节数
+// 用法: ./WebSocketBench [每种大小的总负载 MB]
+
+static volatile uint64_t g_sink = 0;
+
+std::string MakeFrame(size_t size){
+    std::string frame;
+    frame.push_back((char)(0x80 | WS_BINARY));
+    if(size < 126){
+        frame.push_back((char)(0x80 | size));
+    }
+    else if(size <= 0xFFFF){
+        frame.push_back((char)(0x80 | 126));
+        frame.push_back((char)(size >> 8));
+        frame.push_back((char)size);
+    }
+    else{
+        frame.push_back((char)(0x80 | 127));
+        for(int i = 0; i < 8; ++i){
+            frame.push_back((char)(size >> (56 - i * 8)));
+        }
+    }
+    const char key[4] = {0x37, (char)0xfa, 0x21, 0x3d};
+    frame.append(key, 4);
+    for(size_t i = 0; i < size; ++i){
+        frame.push_back((char)('a' + i % 26) ^ key[i & 3]);
+    }
+    return frame;
+}
+
+// 同样的解析流程，负载逐字节去掩码
+uint64_t ParseBytewise(Buffer* buffer){
+    const uint8_t* p = (const uint8_t*)buffer->GetReadIndex();
+    uint64_t length = p[1] & 0x7F;
+    size_t header = 2;
+    if(length == 126){
+        length = (uint64_t)p[2] << 8 | p[3];
+        header = 4;
+    }
+    else if(length == 127){
+        length = 0;
+        for(int i = 2; i < 10; ++i){
+            length = length << 8 | p[i];
+        }
+        header = 10;
+    }
+    const uint8_t* key = p + header;
+    char* payload = buffer->GetReadIndex() + header + 4;
+    for(uint64_t i = 0; i < length; ++i){
+        payload[i] ^= key[i & 3];
+    }
+    g_sink = g_sink + (uint8_t)payload[length / 2];
+    buffer->UpdateReadIndex(header + 4 + length);
+    return length;
+}
+
+void Report(const char* name, size_t size, uint64_t frames, uint64_t us){
+    std::cout << name << " " << size << "B: " << (us ? frames * 1000000 / us : 0) << " frames/s, "
+              << (us ? frames * size / us : 0) << " MB/s" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    uint64_t total = (argc > 1 ? atoll(argv[1]) : 512) << 20;
+    size_t sizes[] = {16, 128, 1024, 16 * 1024, 256 * 1024};
+    Buffer buffer;
+    WebSocketParser parser;
+    for(size_t size : sizes){
+        std::string frame = MakeFrame(size);
+        uint64_t frames = std::max<uint64_t>(total / size / 8, 1);
+
+        uint64_t start = MonotonicUs();
+        for(uint64_t i = 0; i < frames; ++i){
+            buffer.WritePush(frame.data(), frame.size());
+            ParseBytewise(&buffer);
+        }
+        Report("bytewise", size, frames, MonotonicUs() - start);
+
+        start = MonotonicUs();
+        for(uint64_t i = 0; i < frames; ++i){
+            buffer.WritePush(frame.data(), frame.size());
+            if(parser.Parse(&buffer) == WebSocketParser::WS_FRAME){
+                g_sink = g_sink + (uint8_t)parser.Payload()[size / 2];
+                parser.Consume(&buffer);
+            }
+        }
+        Report("parser", size, frames, MonotonicUs() - start);
+    }
+    return 0;
+}
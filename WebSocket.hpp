@@ -0,0 +1,679 @@
+#ifndef _WEBSOCKET_HPP_
+#define _WEBSOCKET_HPP_
+
+#include "Http.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// 单条消息（含分片拼接后）的默认上限，超出时以 1009 关闭
+#define WEBSOCKET_MAX_MESSAGE (16 * 1024 * 1024)
+// 默认的心跳间隔（毫秒）：连接在一个间隔内没有收到任何帧时发送 ping，再过一个间隔仍没有回应则关闭
+#define WEBSOCKET_PING_INTERVAL 30000
+// 共享负载不超过该长度时直接拷贝到输出缓冲区，比单独排一个输出段更省
+#define WEBSOCKET_COPY_THRESHOLD 1024
+
+// 帧的操作码
+typedef enum {
+    WS_CONTINUATION = 0x0,
+    WS_TEXT = 0x1,
+    WS_BINARY = 0x2,
+    WS_CLOSE = 0x8,
+    WS_PING = 0x9,
+    WS_PONG = 0xA
+} WebSocketOpcode;
+
+// 关闭码
+typedef enum {
+    WS_CLOSE_NORMAL = 1000,
+    WS_CLOSE_GOING_AWAY = 1001,
+    WS_CLOSE_PROTOCOL_ERROR = 1002,
+    WS_CLOSE_UNSUPPORTED = 1003,
+    WS_CLOSE_NO_STATUS = 1005,
+    WS_CLOSE_ABNORMAL = 1006,
+    WS_CLOSE_INVALID_DATA = 1007,
+    WS_CLOSE_TOO_BIG = 1009
+} WebSocketCloseCode;
+
+// SHA-1，只用于计算握手的 Sec-WebSocket-Accept
+inline void WebSocketSha1(const char* data, size_t len, uint8_t digest[20]){
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    auto rol = [](uint32_t x, int n){ return (x << n) | (x >> (32 - n)); };
+    uint64_t bits = (uint64_t)len * 8;
+    size_t total = (len + 8) / 64 * 64 + 64;
+    for(size_t block = 0; block < total; block += 64){
+        uint8_t chunk[64];
+        for(size_t i = 0; i < 64; ++i){
+            size_t pos = block + i;
+            if(pos < len){
+                chunk[i] = data[pos];
+            }
+            else if(pos == len){
+                chunk[i] = 0x80;
+            }
+            else if(pos >= total - 8){
+                chunk[i] = (uint8_t)(bits >> ((total - 1 - pos) * 8));
+            }
+            else{
+                chunk[i] = 0;
+            }
+        }
+        uint32_t w[80];
+        for(int i = 0; i < 16; ++i){
+            w[i] = (uint32_t)chunk[i * 4] << 24 | (uint32_t)chunk[i * 4 + 1] << 16 | (uint32_t)chunk[i * 4 + 2] << 8 | chunk[i * 4 + 3];
+        }
+        for(int i = 16; i < 80; ++i){
+            w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for(int i = 0; i < 80; ++i){
+            uint32_t f, k;
+            if(i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if(i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if(i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else            { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+            uint32_t temp = rol(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = temp;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for(int i = 0; i < 20; ++i){
+        digest[i] = (uint8_t)(h[i / 4] >> (24 - (i % 4) * 8));
+    }
+}
+
+inline std::string WebSocketBase64(const uint8_t* data, size_t len){
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((len + 2) / 3 * 4);
+    for(size_t i = 0; i < len; i += 3){
+        uint32_t n = (uint32_t)data[i] << 16;
+        if(i + 1 < len) n |= (uint32_t)data[i + 1] << 8;
+        if(i + 2 < len) n |= data[i + 2];
+        out.push_back(table[(n >> 18) & 63]);
+        out.push_back(table[(n >> 12) & 63]);
+        out.push_back(i + 1 < len ? table[(n >> 6) & 63] : '=');
+        out.push_back(i + 2 < len ? table[n & 63] : '=');
+    }
+    return out;
+}
+
+// 由客户端的 Sec-WebSocket-Key 计算 Sec-WebSocket-Accept
+inline std::string WebSocketAccept(std::string_view key){
+    std::string data(key);
+    data += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    uint8_t digest[20];
+    WebSocketSha1(data.data(), data.size(), digest);
+    return WebSocketBase64(digest, sizeof(digest));
+}
+
+// 就地去掉客户端负载的掩码
+// 每次处理 32/16/8 字节，步长都是 4 的倍数，掩码相位不变，最后不足 8 字节的部分逐字节处理
+inline void WebSocketUnmask(char* data, size_t len, const uint8_t key[4]){
+    uint32_t key32;
+    memcpy(&key32, key, 4);
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i mask256 = _mm256_set1_epi32((int)key32);
+    for(; i + 32 <= len; i += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_xor_si256(v, mask256));
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i mask128 = _mm_set1_epi32((int)key32);
+    for(; i + 16 <= len; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(v, mask128));
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t mask128 = vreinterpretq_u8_u32(vdupq_n_u32(key32));
+    for(; i + 16 <= len; i += 16){
+        uint8_t* p = (uint8_t*)data + i;
+        vst1q_u8(p, veorq_u8(vld1q_u8(p), mask128));
+    }
+#endif
+    uint64_t key64 = ((uint64_t)key32 << 32) | key32;
+    for(; i + 8 <= len; i += 8){
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        v ^= key64;
+        memcpy(data + i, &v, 8);
+    }
+    for(; i < len; ++i){
+        data[i] ^= key[i & 3];
+    }
+}
+
+// 检查文本消息是否为合法的 UTF-8，ASCII 部分每次检查 8 字节
+inline bool WebSocketValidUtf8(const char* str, size_t len){
+    const uint8_t* data = (const uint8_t*)str;
+    size_t i = 0;
+    while(i < len){
+        if(i + 8 <= len){
+            uint64_t v;
+            memcpy(&v, data + i, 8);
+            if((v & 0x8080808080808080ULL) == 0){
+                i += 8;
+                continue;
+            }
+        }
+        uint8_t c = data[i];
+        if(c < 0x80){
+            ++i;
+            continue;
+        }
+        size_t n;
+        uint32_t cp;
+        if((c & 0xE0) == 0xC0)      { n = 1; cp = c & 0x1F; }
+        else if((c & 0xF0) == 0xE0) { n = 2; cp = c & 0x0F; }
+        else if((c & 0xF8) == 0xF0) { n = 3; cp = c & 0x07; }
+        else{
+            return false;
+        }
+        if(i + n >= len){
+            return false;
+        }
+        for(size_t j = 1; j <= n; ++j){
+            if((data[i + j] & 0xC0) != 0x80){
+                return false;
+            }
+            cp = (cp << 6) | (data[i + j] & 0x3F);
+        }
+        // 过长编码、代理区和超出范围的码点
+        if((n == 1 && cp < 0x80) || (n == 2 && cp < 0x800) || (n == 3 && cp < 0x10000) ||
+           (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF){
+            return false;
+        }
+        i += n + 1;
+    }
+    return true;
+}
+
+
+// 帧解析器，直接在连接的输入缓冲区上解析
+// 帧头不超过 14 字节，数据不完整时下次重新解析帧头；整帧到齐后就地去掉掩码，负载是指向缓冲区的视图
+// 处理完调用 Consume 从缓冲区中取走
+class WebSocketParser
+{
+public:
+    enum Status { WS_INCOMPLETE, WS_FRAME, WS_ERROR };
+
+private:
+    bool _Fin;
+    uint8_t _Opcode;
+    size_t _HeaderSize;
+    uint64_t _PayloadLength;
+    char* _Payload;
+    uint64_t _MaxPayload;
+    // 出错时应回复的关闭码
+    uint16_t _Error;
+
+    Status Fail(uint16_t code){
+        _Error = code;
+        return WS_ERROR;
+    }
+
+public:
+    WebSocketParser(uint64_t maxPayload = WEBSOCKET_MAX_MESSAGE):
+        _Fin(false),
+        _Opcode(0),
+        _HeaderSize(0),
+        _PayloadLength(0),
+        _Payload(nullptr),
+        _MaxPayload(maxPayload),
+        _Error(0)
+    {}
+
+    void SetMaxPayload(uint64_t maxPayload) { _MaxPayload = maxPayload; }
+
+    Status Parse(Buffer* buffer){
+        size_t size = buffer->GetReadableSize();
+        if(size < 2){
+            return WS_INCOMPLETE;
+        }
+        const uint8_t* p = (const uint8_t*)buffer->GetReadIndex();
+        // 没有协商扩展，RSV 位必须为 0；客户端发来的帧必须带掩码
+        if((p[0] & 0x70) != 0 || (p[1] & 0x80) == 0){
+            return Fail(WS_CLOSE_PROTOCOL_ERROR);
+        }
+        bool fin = p[0] & 0x80;
+        uint8_t opcode = p[0] & 0x0F;
+        uint64_t length = p[1] & 0x7F;
+        size_t header = 2;
+        if(length == 126){
+            if(size < 4){
+                return WS_INCOMPLETE;
+            }
+            length = (uint64_t)p[2] << 8 | p[3];
+            header = 4;
+        }
+        else if(length == 127){
+            if(size < 10){
+                return WS_INCOMPLETE;
+            }
+            length = 0;
+            for(int i = 2; i < 10; ++i){
+                length = length << 8 | p[i];
+            }
+            header = 10;
+            if(length >> 63){
+                return Fail(WS_CLOSE_PROTOCOL_ERROR);
+            }
+        }
+        if(opcode >= WS_CLOSE){
+            // 控制帧不能分片，负载不超过 125 字节
+            if(opcode > WS_PONG || !fin || length > 125){
+                return Fail(WS_CLOSE_PROTOCOL_ERROR);
+            }
+        }
+        else if(opcode > WS_BINARY){
+            return Fail(WS_CLOSE_PROTOCOL_ERROR);
+        }
+        if(length > _MaxPayload){
+            return Fail(WS_CLOSE_TOO_BIG);
+        }
+        header += 4;
+        if(size < header || size - header < length){
+            return WS_INCOMPLETE;
+        }
+        _Fin = fin;
+        _Opcode = opcode;
+        _HeaderSize = header;
+        _PayloadLength = length;
+        _Payload = buffer->GetReadIndex() + header;
+        WebSocketUnmask(_Payload, length, p + header - 4);
+        return WS_FRAME;
+    }
+
+    void Consume(Buffer* buffer){
+        buffer->UpdateReadIndex(_HeaderSize + _PayloadLength);
+        _Payload = nullptr;
+    }
+
+    bool Fin() const { return _Fin; }
+    uint8_t Opcode() const { return _Opcode; }
+    std::string_view Payload() const { return std::string_view(_Payload, _PayloadLength); }
+    uint16_t GetError() const { return _Error; }
+};
+
+
+class WebSocket;
+using PtrWebSocket = std::shared_ptr<WebSocket>;
+
+// 一个 WebSocket 连接，由 WebSocketHandler 在握手成功后创建，作为连接的上下文
+// 发送接口只能在连接所属线程中调用，其他线程通过 GetConnection()->GetLoop()->RunInLoop 投递
+// 连接关闭后发送接口直接返回 false，GetConnection 返回空
+class WebSocket: public std::enable_shared_from_this<WebSocket>
+{
+    friend class WebSocketHandler;
+public:
+    using OpenCallback = std::function<void(const PtrWebSocket&, const HttpRequest&)>;
+    using MessageCallback = std::function<void(const PtrWebSocket&, std::string_view, bool)>;
+    using CloseCallback = std::function<void(const PtrWebSocket&, uint16_t)>;
+
+    // WebSocketHandler 的配置，同一路由上的连接共享
+    struct Options
+    {
+        OpenCallback Open;
+        MessageCallback Message;
+        CloseCallback Close;
+        uint32_t PingInterval;
+        uint64_t MaxMessage;
+        Options(): PingInterval(WEBSOCKET_PING_INTERVAL), MaxMessage(WEBSOCKET_MAX_MESSAGE) {}
+    };
+
+private:
+    PtrConnection _Conn;
+    std::shared_ptr<const Options> _Options;
+    WebSocketParser _Parser;
+    // 分片消息的数据和首帧的操作码，0 表示没有进行中的分片消息
+    std::string _Fragments;
+    uint8_t _FragmentOpcode;
+    // 心跳：上次检查之后是否收到过帧，是否在等待 pong
+    TimerTask _PingTimer;
+    bool _Received;
+    bool _AwaitingPong;
+    // 连接是否已经切换为 WebSocket，切换前 HttpServer 仍在处理握手请求
+    bool _Attached;
+    // 已发送关闭帧，之后收到的数据直接丢弃
+    bool _Closing;
+    bool _Closed;
+    // 交给关闭回调的关闭码：收到的关闭帧中的关闭码，没有收到关闭帧时为 1006
+    uint16_t _CloseCode;
+
+private:
+    static void WriteHeader(Buffer* output, uint8_t opcode, uint64_t length){
+        uint8_t header[10];
+        size_t size = 2;
+        header[0] = 0x80 | opcode;
+        if(length < 126){
+            header[1] = (uint8_t)length;
+        }
+        else if(length <= 0xFFFF){
+            header[1] = 126;
+            header[2] = (uint8_t)(length >> 8);
+            header[3] = (uint8_t)length;
+            size = 4;
+        }
+        else{
+            header[1] = 127;
+            for(int i = 0; i < 8; ++i){
+                header[2 + i] = (uint8_t)(length >> (56 - i * 8));
+            }
+            size = 10;
+        }
+        output->WritePush((const char*)header, size);
+    }
+
+    bool SendFrame(uint8_t opcode, const char* data, size_t len){
+        if(_Closing || _Closed){
+            return false;
+        }
+        Buffer* output = _Conn->GetOutputBuffer();
+        WriteHeader(output, opcode, len);
+        output->WritePush(data, len);
+        _Conn->CommitOutput();
+        return true;
+    }
+
+    // 连接交给 WebSocket：替换上下文和回调，开始心跳，处理握手之后已经到达的数据
+    void Attach(){
+        PtrConnection conn = _Conn;
+        conn->CancelInactiveRelease();
+        conn->Upgrade(shared_from_this(), nullptr, &WebSocket::OnConnectionMessage, &WebSocket::OnConnectionClose, nullptr);
+        conn->SetMigrateCallback(&WebSocket::OnConnectionMigrate);
+        _Attached = true;
+        if(_Closing){
+            // 打开回调中已经关闭
+            conn->GetInputBuffer()->UpdateReadIndex(conn->GetInputBuffer()->GetReadableSize());
+            return conn->Shutdown();
+        }
+        if(_Options->PingInterval > 0){
+            conn->GetLoop()->TimerSchedule(&_PingTimer, _Options->PingInterval);
+        }
+        if(conn->GetInputBuffer()->GetReadableSize() > 0){
+            OnMessage(conn->GetInputBuffer());
+        }
+    }
+
+    static void OnConnectionMessage(const PtrConnection& conn, Buffer* buffer){
+        (*conn->GetContext()->Get<PtrWebSocket>())->OnMessage(buffer);
+    }
+
+    static void OnConnectionClose(const PtrConnection& conn){
+        (*conn->GetContext()->Get<PtrWebSocket>())->OnClose();
+    }
+
+    static void OnConnectionMigrate(const PtrConnection& conn, bool attached){
+        (*conn->GetContext()->Get<PtrWebSocket>())->OnMigrate(attached);
+    }
+
+    // 心跳定时器挂在连接所属循环的时间轮上，随连接迁移，在新循环中重新计时
+    void OnMigrate(bool attached){
+        if(!attached){
+            return _Conn->GetLoop()->TimerUnschedule(&_PingTimer);
+        }
+        if(_Options->PingInterval > 0 && !_Closing && !_Closed){
+            _Conn->GetLoop()->TimerSchedule(&_PingTimer, _Options->PingInterval);
+        }
+    }
+
+    void OnMessage(Buffer* buffer){
+        PtrWebSocket self = shared_from_this();
+        while(!_Closing && !_Closed){
+            WebSocketParser::Status status = _Parser.Parse(buffer);
+            if(status == WebSocketParser::WS_INCOMPLETE){
+                return;
+            }
+            if(status == WebSocketParser::WS_ERROR){
+                return Fail(_Parser.GetError());
+            }
+            _Received = true;
+            uint8_t opcode = _Parser.Opcode();
+            std::string_view payload = _Parser.Payload();
+            if(opcode == WS_TEXT || opcode == WS_BINARY){
+                if(_FragmentOpcode != 0){
+                    return Fail(WS_CLOSE_PROTOCOL_ERROR);
+                }
+                if(!_Parser.Fin()){
+                    _FragmentOpcode = opcode;
+                    _Fragments.assign(payload.data(), payload.size());
+                }
+                else if(!Deliver(opcode, payload)){
+                    return;
+                }
+            }
+            else if(opcode == WS_CONTINUATION){
+                if(_FragmentOpcode == 0){
+                    return Fail(WS_CLOSE_PROTOCOL_ERROR);
+                }
+                if(_Fragments.size() + payload.size() > _Options->MaxMessage){
+                    return Fail(WS_CLOSE_TOO_BIG);
+                }
+                _Fragments.append(payload.data(), payload.size());
+                if(_Parser.Fin()){
+                    std::string message;
+                    message.swap(_Fragments);
+                    uint8_t messageOpcode = _FragmentOpcode;
+                    _FragmentOpcode = 0;
+                    if(!Deliver(messageOpcode, message)){
+                        return;
+                    }
+                }
+            }
+            else if(opcode == WS_PING){
+                SendFrame(WS_PONG, payload.data(), payload.size());
+            }
+            else if(opcode == WS_PONG){
+                _AwaitingPong = false;
+            }
+            else{
+                return OnCloseFrame(payload);
+            }
+            _Parser.Consume(buffer);
+        }
+        // 关闭过程中收到的数据不再处理
+        buffer->UpdateReadIndex(buffer->GetReadableSize());
+    }
+
+    // 把完整的消息交给回调，连接在回调中关闭时返回 false
+    bool Deliver(uint8_t opcode, std::string_view message){
+        if(opcode == WS_TEXT && !WebSocketValidUtf8(message.data(), message.size())){
+            Fail(WS_CLOSE_INVALID_DATA);
+            return false;
+        }
+        if(_Options->Message){
+            _Options->Message(shared_from_this(), message, opcode == WS_BINARY);
+        }
+        return !_Closing && !_Closed;
+    }
+
+    // 收到关闭帧：回复同样的关闭码，发送完后关闭连接
+    void OnCloseFrame(std::string_view payload){
+        uint16_t code = WS_CLOSE_NO_STATUS;
+        if(payload.size() == 1){
+            return Fail(WS_CLOSE_PROTOCOL_ERROR);
+        }
+        if(payload.size() >= 2){
+            code = (uint16_t)((uint8_t)payload[0] << 8 | (uint8_t)payload[1]);
+            if(code < 1000 || code == WS_CLOSE_NO_STATUS || code == WS_CLOSE_ABNORMAL || code >= 5000 ||
+               !WebSocketValidUtf8(payload.data() + 2, payload.size() - 2)){
+                return Fail(WS_CLOSE_PROTOCOL_ERROR);
+            }
+        }
+        _CloseCode = code;
+        Close(code == WS_CLOSE_NO_STATUS ? (uint16_t)WS_CLOSE_NORMAL : code);
+    }
+
+    void Fail(uint16_t code){
+        _CloseCode = code;
+        Close(code);
+    }
+
+    void OnPingTimer(){
+        if(_Closed){
+            return;
+        }
+        if(_Received){
+            _Received = false;
+            _AwaitingPong = false;
+        }
+        else if(_AwaitingPong){
+            // 一个间隔内没有任何回应，对端已经不可达，直接释放
+            _Closing = true;
+            return _Conn->Release();
+        }
+        else{
+            SendFrame(WS_PING, nullptr, 0);
+            _AwaitingPong = true;
+        }
+        _Conn->GetLoop()->TimerSchedule(&_PingTimer, _Options->PingInterval);
+    }
+
+    void OnClose(){
+        if(_Closed){
+            return;
+        }
+        _Closed = true;
+        _Conn->GetLoop()->TimerUnschedule(&_PingTimer);
+        PtrWebSocket self = shared_from_this();
+        if(_Options->Close){
+            _Options->Close(self, _CloseCode);
+        }
+        // 连接的上下文持有本对象，断开对连接的引用，两者才能释放
+        _Conn.reset();
+    }
+
+public:
+    WebSocket(const PtrConnection& conn, const std::shared_ptr<const Options>& options):
+        _Conn(conn),
+        _Options(options),
+        _Parser(options->MaxMessage),
+        _Fragments(),
+        _FragmentOpcode(0),
+        _PingTimer(conn->GetId(), options->PingInterval, std::bind(&WebSocket::OnPingTimer, this)),
+        _Received(false),
+        _AwaitingPong(false),
+        _Attached(false),
+        _Closing(false),
+        _Closed(false),
+        _CloseCode(WS_CLOSE_ABNORMAL)
+    {}
+
+    const PtrConnection& GetConnection() const { return _Conn; }
+    bool Closed() const { return _Closing || _Closed; }
+
+    bool SendText(std::string_view text){
+        return SendFrame(WS_TEXT, text.data(), text.size());
+    }
+
+    bool SendBinary(std::string_view data){
+        return SendFrame(WS_BINARY, data.data(), data.size());
+    }
+
+    // 只把帧头写入输出缓冲区，负载由 owner 持有，随输出一起聚合发送，不拷贝
+    // 同一份负载可以发给任意多个连接（如广播），发送完成前不能修改
+    bool SendShared(const std::shared_ptr<const std::string>& payload, bool binary = false){
+        if(_Closing || _Closed){
+            return false;
+        }
+        if(payload->size() <= WEBSOCKET_COPY_THRESHOLD){
+            return SendFrame(binary ? WS_BINARY : WS_TEXT, payload->data(), payload->size());
+        }
+        WriteHeader(_Conn->GetOutputBuffer(), binary ? WS_BINARY : WS_TEXT, payload->size());
+        _Conn->SendShared(payload->data(), payload->size(), payload);
+        return true;
+    }
+
+    bool Ping(std::string_view data = std::string_view()){
+        return SendFrame(WS_PING, data.data(), std::min<size_t>(data.size(), 125));
+    }
+
+    // 发送关闭帧，已写入的数据发送完后关闭连接，关闭回调随后调用
+    void Close(uint16_t code = WS_CLOSE_NORMAL, std::string_view reason = std::string_view()){
+        if(_Closing || _Closed){
+            return;
+        }
+        char payload[125];
+        payload[0] = (char)(code >> 8);
+        payload[1] = (char)code;
+        size_t len = std::min<size_t>(reason.size(), sizeof(payload) - 2);
+        if(len > 0){
+            memcpy(payload + 2, reason.data(), len);
+        }
+        SendFrame(WS_CLOSE, payload, len + 2);
+        _Closing = true;
+        if(_Attached){
+            _Conn->GetInputBuffer()->UpdateReadIndex(_Conn->GetInputBuffer()->GetReadableSize());
+            _Conn->Shutdown();
+        }
+    }
+};
+
+
+// WebSocket 握手的处理函数，注册为 HttpServer 的 GET 路由
+// 握手成功后回复 101，调用打开回调（此时请求仍然有效，可以检查路径、查询字符串和头部），随后连接切换为 WebSocket
+// 文本和二进制消息（分片已拼接）交给消息回调，消息是视图，只在回调中有效
+// 升级后的连接不再使用 HTTP 的空闲超时，由 ping/pong 心跳检测失联的客户端；心跳定时器随连接迁移
+class WebSocketHandler
+{
+private:
+    std::shared_ptr<WebSocket::Options> _Options;
+
+public:
+    WebSocketHandler():
+        _Options(std::make_shared<WebSocket::Options>())
+    {}
+
+    void SetOpenCallback(const WebSocket::OpenCallback& cb)       { _Options->Open = cb; }
+    void SetMessageCallback(const WebSocket::MessageCallback& cb) { _Options->Message = cb; }
+    void SetCloseCallback(const WebSocket::CloseCallback& cb)     { _Options->Close = cb; }
+    // 心跳间隔（毫秒），0 表示关闭心跳
+    void SetPingInterval(uint32_t ms) { _Options->PingInterval = ms; }
+    void SetMaxMessage(uint64_t bytes) { _Options->MaxMessage = bytes; }
+
+    void operator()(const HttpRequest& request, HttpResponse& response) const{
+        if(request.Method() != "GET" || request.MinorVersion() < 1){
+            return response.Reply(400, "text/plain", "Bad Request\n");
+        }
+        if(!HttpHasToken(request.GetHeader("Upgrade"), "websocket") ||
+           !HttpHasToken(request.GetHeader("Connection"), "Upgrade") ||
+           request.GetHeader("Sec-WebSocket-Version") != "13"){
+            response.WriteHead(426);
+            response.AddHeader("Upgrade", "websocket");
+            response.AddHeader("Sec-WebSocket-Version", "13");
+            response.AddHeader("Content-Type", "text/plain");
+            return response.End("Upgrade Required\n");
+        }
+        std::string_view key = request.GetHeader("Sec-WebSocket-Key");
+        if(key.size() != 24){
+            return response.Reply(400, "text/plain", "Bad Request\n");
+        }
+        response.WriteHead(101);
+        response.AddHeader("Upgrade", "websocket");
+        response.AddHeader("Connection", "Upgrade");
+        response.AddHeader("Sec-WebSocket-Accept", WebSocketAccept(key));
+        response.End();
+
+        PtrWebSocket socket = std::make_shared<WebSocket>(response.GetConnection(), _Options);
+        if(_Options->Open){
+            _Options->Open(socket, request);
+        }
+        response.SetUpgradeCallback([socket](){
+            socket->Attach();
+        });
+    }
+};
+
+#endif // _WEBSOCKET_HPP_